@@ -0,0 +1,55 @@
+#version 330 core
+
+in vec3 fragmentPos;
+flat in vec3 sphereCenter;
+flat in float fragmentVelocity;
+
+out vec4 color;
+
+uniform float scale;
+
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec4 cameraPosition;
+};
+
+void main()
+{
+    // Ray from the camera through this fragment against the sphere
+    vec3 rayDir = normalize(fragmentPos - cameraPosition.xyz);
+    vec3 toCenter = cameraPosition.xyz - sphereCenter;
+
+    float b = dot(toCenter, rayDir);
+    float c = dot(toCenter, toCenter) - scale * scale;
+    float discriminant = b * b - c;
+    if (discriminant < 0.0)
+        discard;
+
+    vec3 hitPos = cameraPosition.xyz + rayDir * (-b - sqrt(discriminant));
+    vec3 norm = (hitPos - sphereCenter) / scale;
+
+    vec4 clipPos = projection * view * vec4(hitPos, 1.0);
+    gl_FragDepth = (clipPos.z / clipPos.w) * 0.5 + 0.5;
+
+    vec3 lightColor = vec3(1.0, 1.0, 1.0);
+    vec3 lightPos = vec3(10.0, 10.0, 10.0);
+
+    vec3 objectColor = vec3(0.7137, 0.8471, 1.0);
+
+    objectColor = objectColor * (fragmentVelocity + 0.1);
+
+    // ambient
+    float ambientStrength = 0.3;
+    vec3 ambient = ambientStrength * lightColor;
+
+    // diffuse
+    vec3 lightDir = normalize(lightPos - hitPos);
+    float diff = max(dot(norm, lightDir), 0.0);
+    vec3 diffuse = diff * lightColor;
+
+    vec3 result = (ambient + diffuse) * objectColor;
+
+    color = vec4(result, 1.0);
+}
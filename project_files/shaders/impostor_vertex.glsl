@@ -0,0 +1,43 @@
+#version 330 core
+
+// One camera facing quad per instance, the corners come from gl_VertexID
+layout (location = 3) in vec3 instancePosition;
+layout (location = 4) in float instanceVelocity;
+
+uniform float scale;
+// Packed instances are normalized, both are 1 for float instances
+uniform float instanceExtent;
+uniform float speedScale;
+
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec4 cameraPosition;
+};
+
+out vec3 fragmentPos;
+flat out vec3 sphereCenter;
+flat out float fragmentVelocity;
+
+void main()
+{
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+
+    sphereCenter = instancePosition * instanceExtent;
+    fragmentVelocity = instanceVelocity * speedScale;
+
+    // The quad faces the camera position rather than the view plane, so the silhouette
+    // in it is a circle, slightly larger than the radius due to perspective
+    vec3 toSphere = sphereCenter - cameraPosition.xyz;
+    float dist = max(length(toSphere), scale * 1.01);
+    float halfSize = scale * dist / sqrt(dist * dist - scale * scale);
+
+    vec3 cameraUp = vec3(view[0][1], view[1][1], view[2][1]);
+    vec3 right = normalize(cross(toSphere, cameraUp));
+    vec3 up = cross(right, toSphere / dist);
+
+    fragmentPos = sphereCenter + (right * corner.x + up * corner.y) * halfSize;
+
+    gl_Position = projection * view * vec4(fragmentPos, 1.0);
+}
@@ -7,8 +7,16 @@ layout (location = 3) in vec3 instancePosition;
 layout (location = 4) in float instanceVelocity;
 
 uniform float scale;
-uniform mat4 view;
-uniform mat4 projection;
+// Packed instances are normalized, both are 1 for float instances
+uniform float instanceExtent;
+uniform float speedScale;
+
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec4 cameraPosition;
+};
 
 out vec3 fragmentPos;
 out vec3 fragmentVertexNormal;
@@ -25,10 +33,10 @@ mat4 translationMatrix(vec3 translation)
 
 void main()
 {
-    mat4 model = translationMatrix(instancePosition);
+    mat4 model = translationMatrix(instancePosition * instanceExtent);
     fragmentPos = vec3(model * vec4(vertexPos, 1.0));
     fragmentVertexNormal = mat3(transpose(inverse(model))) * vertexNormal;
-    fragmentVelocity = instanceVelocity;
+    fragmentVelocity = instanceVelocity * speedScale;
 
     gl_Position = projection * view * vec4(fragmentPos, 1.0);
 }
\ No newline at end of file
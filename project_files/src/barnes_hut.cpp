@@ -0,0 +1,370 @@
+
+// std includes
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <thread>
+
+// Local includes
+#include "barnes_hut.hpp"
+#include "thread_pool.hpp"
+
+//! Spreads the low 10 bits of Value to every third bit
+static uint32_t SpreadBits( uint32_t Value ) noexcept {
+    Value &= 0x3FF;
+    Value = ( Value | ( Value << 16 ) ) & 0x030000FF;
+    Value = ( Value | ( Value << 8 ) ) & 0x0300F00F;
+    Value = ( Value | ( Value << 4 ) ) & 0x030C30C3;
+    Value = ( Value | ( Value << 2 ) ) & 0x09249249;
+    return Value;
+}
+
+//! Octant of the child at Level + 1 the code falls into
+static unsigned Octant( uint64_t Key, int Level ) noexcept {
+    return static_cast< unsigned >( ( Key >> 32 ) >> ( 27 - 3 * Level ) ) & 7;
+}
+
+static void SplitRange( int ThreadId, int ThreadCount, unsigned Count, unsigned& Start, unsigned& End ) noexcept {
+    Start = ThreadId * ( Count / ThreadCount );
+    End = ThreadId == ThreadCount - 1 ? Count : ( ThreadId + 1 ) * ( Count / ThreadCount );
+}
+
+BarnesHutTree::BarnesHutTree() {
+    THREAD_COUNT = std::thread::hardware_concurrency();
+    thread_buckets.resize( THREAD_COUNT );
+    thread_min.resize( THREAD_COUNT );
+    thread_max.resize( THREAD_COUNT );
+    bucket_nodes.resize( BUCKET_COUNT );
+}
+
+void BarnesHutTree::SetThreadPool( ThreadPool* Pool ) noexcept {
+    thread_pool = Pool;
+}
+
+void BarnesHutTree::Build( const VerletArray& Verlets, unsigned Count, float Softening ) {
+    count = Count;
+    softening_squared = Softening * Softening;
+    nodes.clear();
+    if ( count == 0 ) {
+        return;
+    }
+
+    keys.resize( count );
+    sorted_keys.resize( count );
+    bodies.resize( count );
+    order.resize( count );
+
+    thread_pool->Run( THREAD_COUNT, [&]( unsigned ThreadId ) {
+        unsigned start = 0;
+        unsigned end = 0;
+        SplitRange( ThreadId, THREAD_COUNT, count, start, end );
+
+        glm::vec3 low( FLT_MAX );
+        glm::vec3 high( -FLT_MAX );
+        for ( unsigned i = start; i < end; ++i ) {
+            const glm::vec3 position( Verlets[i].position.x, Verlets[i].position.y, Verlets[i].position.z );
+            low = glm::min( low, position );
+            high = glm::max( high, position );
+        }
+        thread_min[ThreadId] = low;
+        thread_max[ThreadId] = high;
+    } );
+
+    glm::vec3 low( FLT_MAX );
+    glm::vec3 high( -FLT_MAX );
+    for ( int i = 0; i < THREAD_COUNT; ++i ) {
+        low = glm::min( low, thread_min[i] );
+        high = glm::max( high, thread_max[i] );
+    }
+    const glm::vec3 extent = high - low;
+    origin = low;
+    size = std::max( std::max( extent.x, extent.y ), std::max( extent.z, 1e-3f ) ) * 1.0001f;
+
+    // Codes, then a counting sort by bucket: count per thread, offsets, scatter
+    thread_pool->Run( THREAD_COUNT, [&]( unsigned ThreadId ) {
+        unsigned start = 0;
+        unsigned end = 0;
+        SplitRange( ThreadId, THREAD_COUNT, count, start, end );
+
+        std::array< unsigned, BUCKET_COUNT >& buckets = thread_buckets[ThreadId];
+        buckets.fill( 0 );
+
+        const float scale = 1024.f / size;
+        for ( unsigned i = start; i < end; ++i ) {
+            uint32_t cell[3];
+            for ( int j = 0; j < 3; ++j ) {
+                const float coordinate = ( Verlets[i].position[j] - origin[j] ) * scale;
+                cell[j] = static_cast< uint32_t >( std::clamp( coordinate, 0.f, 1023.f ) );
+            }
+
+            const uint32_t code = ( SpreadBits( cell[0] ) << 2 ) | ( SpreadBits( cell[1] ) << 1 ) |
+                                  SpreadBits( cell[2] );
+            keys[i] = ( static_cast< uint64_t >( code ) << 32 ) | i;
+            ++buckets[code >> ( 30 - 3 * BUCKET_LEVEL )];
+        }
+    } );
+
+    std::array< unsigned, BUCKET_COUNT + 1 > bucketStart{};
+    unsigned offset = 0;
+    for ( unsigned bucket = 0; bucket < BUCKET_COUNT; ++bucket ) {
+        bucketStart[bucket] = offset;
+        for ( int i = 0; i < THREAD_COUNT; ++i ) {
+            const unsigned bucketCount = thread_buckets[i][bucket];
+            thread_buckets[i][bucket] = offset;
+            offset += bucketCount;
+        }
+    }
+    bucketStart[BUCKET_COUNT] = offset;
+
+    thread_pool->Run( THREAD_COUNT, [&]( unsigned ThreadId ) {
+        unsigned start = 0;
+        unsigned end = 0;
+        SplitRange( ThreadId, THREAD_COUNT, count, start, end );
+
+        std::array< unsigned, BUCKET_COUNT >& offsets = thread_buckets[ThreadId];
+        for ( unsigned i = start; i < end; ++i ) {
+            sorted_keys[offsets[( keys[i] >> 32 ) >> ( 30 - 3 * BUCKET_LEVEL )]++] = keys[i];
+        }
+    } );
+
+    // Buckets differ a lot in size, threads take the next one until all are built
+    const float mass = 1.f / count;
+    next_bucket = 0;
+    thread_pool->Run( THREAD_COUNT, [&]( unsigned ) {
+        for ( unsigned bucket = next_bucket++; bucket < BUCKET_COUNT; bucket = next_bucket++ ) {
+            const unsigned begin = bucketStart[bucket];
+            const unsigned end = bucketStart[bucket + 1];
+
+            std::sort( sorted_keys.begin() + begin, sorted_keys.begin() + end );
+            for ( unsigned k = begin; k < end; ++k ) {
+                const unsigned index = static_cast< unsigned >( sorted_keys[k] );
+                const vec4& position = Verlets[index].position;
+                bodies[k] = glm::vec4( position.x, position.y, position.z, mass );
+                order[k] = index;
+            }
+
+            std::vector< BarnesHutNode >& subtree = bucket_nodes[bucket];
+            subtree.clear();
+            if ( begin < end ) {
+                subtree.emplace_back();
+                BuildNode( subtree, 0, begin, end, BUCKET_LEVEL );
+            }
+        }
+    } );
+
+    // Root and the level above the buckets, so the bucket roots of every parent are contiguous
+    unsigned parentCount = 0;
+    unsigned bucketRootCount = 0;
+    for ( unsigned parent = 0; parent < 8; ++parent ) {
+        bool used = false;
+        for ( unsigned bucket = parent * 8; bucket < parent * 8 + 8; ++bucket ) {
+            if ( !bucket_nodes[bucket].empty() ) {
+                used = true;
+                ++bucketRootCount;
+            }
+        }
+        parentCount += used ? 1 : 0;
+    }
+
+    std::array< unsigned, BUCKET_COUNT > bucketRoot{};
+    std::array< unsigned, BUCKET_COUNT > bucketBlock{};
+    unsigned nodeCount = 1 + parentCount + bucketRootCount;
+    unsigned nextRoot = 1 + parentCount;
+    for ( unsigned bucket = 0; bucket < BUCKET_COUNT; ++bucket ) {
+        if ( !bucket_nodes[bucket].empty() ) {
+            bucketRoot[bucket] = nextRoot++;
+            bucketBlock[bucket] = nodeCount;
+            nodeCount += static_cast< unsigned >( bucket_nodes[bucket].size() ) - 1;
+        }
+    }
+    nodes.resize( nodeCount );
+
+    next_bucket = 0;
+    thread_pool->Run( THREAD_COUNT, [&]( unsigned ) {
+        for ( unsigned bucket = next_bucket++; bucket < BUCKET_COUNT; bucket = next_bucket++ ) {
+            const std::vector< BarnesHutNode >& subtree = bucket_nodes[bucket];
+            for ( size_t k = 0; k < subtree.size(); ++k ) {
+                BarnesHutNode node = subtree[k];
+                if ( node.child_count > 0 ) {
+                    node.first = bucketBlock[bucket] + node.first - 1;
+                }
+                nodes[k == 0 ? bucketRoot[bucket] : bucketBlock[bucket] + static_cast< unsigned >( k ) - 1] = node;
+            }
+        }
+    } );
+
+    unsigned nextParent = 1;
+    for ( unsigned parent = 0; parent < 8; ++parent ) {
+        BarnesHutNode node{};
+        node.half_size = size * 0.25f;
+        for ( unsigned bucket = parent * 8; bucket < parent * 8 + 8; ++bucket ) {
+            if ( !bucket_nodes[bucket].empty() ) {
+                node.first = node.child_count == 0 ? bucketRoot[bucket] : node.first;
+                ++node.child_count;
+            }
+        }
+
+        if ( node.child_count > 0 ) {
+            Aggregate( node, &nodes[node.first] );
+            nodes[nextParent++] = node;
+        }
+    }
+
+    BarnesHutNode& root = nodes[0];
+    root.half_size = size * 0.5f;
+    root.first = 1;
+    root.count = 0;
+    root.child_count = parentCount;
+    Aggregate( root, &nodes[1] );
+}
+
+void BarnesHutTree::BuildNode( std::vector< BarnesHutNode >& Nodes, unsigned Index, unsigned Begin,
+                               unsigned End, int Level ) const noexcept {
+    BarnesHutNode node{};
+    node.half_size = size / static_cast< float >( 2 << Level );
+
+    if ( End - Begin <= LEAF_SIZE || Level == MAX_LEVEL ) {
+        node.first = Begin;
+        node.count = End - Begin;
+
+        glm::vec3 weighted( 0.f );
+        for ( unsigned k = Begin; k < End; ++k ) {
+            weighted += glm::vec3( bodies[k] ) * bodies[k].w;
+            node.mass += bodies[k].w;
+        }
+        node.center_of_mass = weighted / node.mass;
+
+        Nodes[Index] = node;
+        return;
+    }
+
+    // Keys in the range share every octant above Level, the children are runs of the next one
+    unsigned runs[9];
+    runs[0] = Begin;
+    for ( unsigned octant = 1; octant < 8; ++octant ) {
+        runs[octant] = static_cast< unsigned >(
+            std::partition_point( sorted_keys.begin() + runs[octant - 1], sorted_keys.begin() + End,
+                                  [Level, octant]( uint64_t Key ) {
+                                      return Octant( Key, Level ) < octant;
+                                  } ) -
+            sorted_keys.begin() );
+    }
+    runs[8] = End;
+
+    node.first = static_cast< unsigned >( Nodes.size() );
+    for ( unsigned octant = 0; octant < 8; ++octant ) {
+        node.child_count += runs[octant] < runs[octant + 1] ? 1 : 0;
+    }
+    Nodes.resize( Nodes.size() + node.child_count );
+
+    unsigned child = node.first;
+    for ( unsigned octant = 0; octant < 8; ++octant ) {
+        if ( runs[octant] < runs[octant + 1] ) {
+            BuildNode( Nodes, child++, runs[octant], runs[octant + 1], Level + 1 );
+        }
+    }
+
+    Aggregate( node, &Nodes[node.first] );
+    Nodes[Index] = node;
+}
+
+void BarnesHutTree::Aggregate( BarnesHutNode& Node, const BarnesHutNode* Children ) noexcept {
+    glm::vec3 weighted( 0.f );
+    Node.mass = 0.f;
+    for ( unsigned i = 0; i < Node.child_count; ++i ) {
+        weighted += Children[i].center_of_mass * Children[i].mass;
+        Node.mass += Children[i].mass;
+    }
+    Node.center_of_mass = weighted / Node.mass;
+}
+
+glm::vec3 BarnesHutTree::Evaluate( const glm::vec3& Position, float Theta ) const noexcept {
+    glm::vec3 acceleration( 0.f );
+    if ( nodes.empty() ) {
+        return acceleration;
+    }
+
+    const float thetaSquared = Theta * Theta;
+
+    // Every level leaves at most 7 siblings behind
+    unsigned stack[8 * ( MAX_LEVEL + 1 )];
+    unsigned top = 0;
+    stack[top++] = 0;
+
+    while ( top > 0 ) {
+        const BarnesHutNode& node = nodes[stack[--top]];
+
+        if ( node.child_count == 0 ) {
+            for ( unsigned k = node.first; k < node.first + node.count; ++k ) {
+                const glm::vec3 offset = glm::vec3( bodies[k] ) - Position;
+                const float distanceSquared = glm::dot( offset, offset ) + softening_squared;
+                const float inverse = 1.f / std::sqrt( distanceSquared );
+                acceleration += offset * ( bodies[k].w * inverse * inverse * inverse );
+            }
+            continue;
+        }
+
+        const glm::vec3 offset = node.center_of_mass - Position;
+        const float distanceSquared = glm::dot( offset, offset );
+        const float edge = node.half_size * 2.f;
+
+        if ( edge * edge < thetaSquared * distanceSquared ) {
+            const float inverse = 1.f / std::sqrt( distanceSquared + softening_squared );
+            acceleration += offset * ( node.mass * inverse * inverse * inverse );
+        } else {
+            for ( unsigned i = 0; i < node.child_count; ++i ) {
+                stack[top++] = node.first + i;
+            }
+        }
+    }
+
+    return acceleration;
+}
+
+glm::vec3 BarnesHutTree::EvaluateBruteForce( const glm::vec3& Position ) const noexcept {
+    glm::vec3 acceleration( 0.f );
+
+    for ( unsigned k = 0; k < count; ++k ) {
+        const glm::vec3 offset = glm::vec3( bodies[k] ) - Position;
+        const float distanceSquared = glm::dot( offset, offset ) + softening_squared;
+        const float inverse = 1.f / std::sqrt( distanceSquared );
+        acceleration += offset * ( bodies[k].w * inverse * inverse * inverse );
+    }
+
+    return acceleration;
+}
+
+void BarnesHutTree::ApplyForces( VerletArray& Verlets, float Strength, float Theta ) {
+    if ( count == 0 ) {
+        return;
+    }
+
+    // Bodies are walked in Morton order, neighbours open mostly the same nodes
+    thread_pool->Run( THREAD_COUNT, [&]( unsigned ThreadId ) {
+        unsigned start = 0;
+        unsigned end = 0;
+        SplitRange( ThreadId, THREAD_COUNT, count, start, end );
+
+        for ( unsigned k = start; k < end; ++k ) {
+            const glm::vec3 acceleration = Evaluate( glm::vec3( bodies[k] ), Theta ) * Strength;
+
+            Verlet& verlet = Verlets[order[k]];
+            vec4 force( acceleration.x, acceleration.y, acceleration.z, 0.f );
+            verlet.acceleration = vec_add( verlet.acceleration, force );
+        }
+    } );
+}
+
+size_t BarnesHutTree::GetNodeCount() const noexcept {
+    return nodes.size();
+}
+
+size_t BarnesHutTree::GetMemory() const noexcept {
+    size_t memory = ( keys.capacity() + sorted_keys.capacity() ) * sizeof( uint64_t ) +
+                    bodies.capacity() * sizeof( glm::vec4 ) + order.capacity() * sizeof( unsigned ) +
+                    nodes.capacity() * sizeof( BarnesHutNode );
+    for ( const std::vector< BarnesHutNode >& subtree : bucket_nodes ) {
+        memory += subtree.capacity() * sizeof( BarnesHutNode );
+    }
+    return memory;
+}
@@ -0,0 +1,96 @@
+#ifndef BARNES_HUT_HPP
+#define BARNES_HUT_HPP
+#pragma once
+
+// std includes
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// System includes
+#include <glm/glm.hpp>
+
+// Local includes
+#include "verlet.hpp"
+
+class ThreadPool;
+
+struct BarnesHutNode {
+    glm::vec3 center_of_mass;
+    float mass;
+    float half_size;      //!< half the edge of the node's cube
+    unsigned first;       //!< first child of an inner node, first body of a leaf
+    unsigned count;       //!< bodies of a leaf
+    unsigned child_count; //!< 0 for leaves, children are stored next to each other
+};
+
+/*! Octree over the particles for long range forces, with the mass and
+ *  centre of mass of every node. Particles are sorted by Morton code into
+ *  BUCKET_COUNT buckets, one per node two levels below the root, and the
+ *  subtrees of the buckets are sorted and built in parallel. Forces use
+ *  the Barnes-Hut approximation, a node further away than its size over
+ *  the opening angle acts as a single body. Every particle has the same
+ *  mass and all of them together weigh 1. */
+class BarnesHutTree {
+public:
+    BarnesHutTree();
+
+    //! Pool Build and ApplyForces run on, owned by the caller
+    void SetThreadPool( ThreadPool* Pool ) noexcept;
+
+    /**
+     * @brief Rebuilds the tree over the first Count particles.
+     *
+     * @param Softening Added to every distance, keeps close pairs from blowing up
+     */
+    void Build( const VerletArray& Verlets, unsigned Count, float Softening );
+
+    //! Acceleration at Position, nodes seen under a larger angle than Theta are opened
+    glm::vec3 Evaluate( const glm::vec3& Position, float Theta ) const noexcept;
+
+    //! Exact sum over every body, the reference Evaluate is measured against
+    glm::vec3 EvaluateBruteForce( const glm::vec3& Position ) const noexcept;
+
+    //! Adds Strength * Evaluate() to the acceleration of every particle the tree was built over
+    void ApplyForces( VerletArray& Verlets, float Strength, float Theta );
+
+    size_t GetNodeCount() const noexcept;
+    size_t GetMemory() const noexcept;
+
+    static constexpr unsigned LEAF_SIZE = 8;
+    static constexpr int MAX_LEVEL = 10;   //!< 30 bit Morton codes, 10 bits per axis
+    static constexpr int BUCKET_LEVEL = 2; //!< level of the nodes built as separate tasks
+    static constexpr unsigned BUCKET_COUNT = 1u << ( 3 * BUCKET_LEVEL );
+
+private:
+    //! Builds Nodes[Index] over sorted bodies [Begin, End), children are appended to Nodes
+    void BuildNode( std::vector< BarnesHutNode >& Nodes, unsigned Index, unsigned Begin, unsigned End,
+                    int Level ) const noexcept;
+
+    //! Mass and centre of mass of an inner node from its children
+    static void Aggregate( BarnesHutNode& Node, const BarnesHutNode* Children ) noexcept;
+
+    int THREAD_COUNT = 24;
+    ThreadPool* thread_pool = nullptr;
+
+    unsigned count = 0;
+    float softening_squared = 0.f;
+    glm::vec3 origin{ 0.f }; //!< lowest corner of the root cube
+    float size = 1.f;        //!< edge of the root cube
+
+    std::vector< uint64_t > keys;        //!< Morton code << 32 | particle index
+    std::vector< uint64_t > sorted_keys; //!< keys ordered by bucket, then by code inside a bucket
+    std::vector< glm::vec4 > bodies;     //!< positions in sorted order, mass in w
+    std::vector< unsigned > order;       //!< particle index of every body
+
+    std::vector< BarnesHutNode > nodes; //!< root, its children, the bucket nodes, then the bucket subtrees
+
+    std::vector< std::vector< BarnesHutNode > > bucket_nodes; //!< subtree of every bucket, its root first
+    std::vector< std::array< unsigned, BUCKET_COUNT > > thread_buckets; //!< counts, then scatter offsets
+    std::vector< glm::vec3 > thread_min;
+    std::vector< glm::vec3 > thread_max;
+    std::atomic< unsigned > next_bucket{ 0 };
+};
+
+#endif
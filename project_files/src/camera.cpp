@@ -59,6 +59,10 @@ glm::mat4& Camera::GetViewMatrix() {
     return view_matrix;
 }
 
+glm::vec3 Camera::GetPosition() const {
+    return position;
+}
+
 float Camera::GetOrbitRadius() const {
     return orbit_radius;
 }
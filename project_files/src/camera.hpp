@@ -12,6 +12,7 @@ public:
     void UpdateVectors();
 
     glm::mat4& GetViewMatrix();
+    glm::vec3 GetPosition() const;
 
     float GetOrbitRadius() const;
     void SetOrbitRadius( float OrbitRadius );
@@ -0,0 +1,93 @@
+#ifndef CHUNKED_ARRAY_HPP
+#define CHUNKED_ARRAY_HPP
+#pragma once
+
+// std includes
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+/*! Growable array made of fixed size chunks. Growing only appends chunks, so
+ *  elements never move and pointers to them stay valid for the lifetime of
+ *  the array. Indexing costs a shift and a mask on top of a plain array.
+ *  Chunks are allocated untouched, their pages end up on the NUMA node of
+ *  the thread that constructs the elements. */
+template < typename T, size_t ChunkSize = 16384 >
+class ChunkedArray {
+public:
+    static_assert( ChunkSize > 0 && ( ChunkSize & ( ChunkSize - 1 ) ) == 0,
+                   "ChunkSize must be a power of two" );
+    static_assert( std::is_trivially_destructible_v< T >, "elements are never destroyed" );
+
+    //! Splits [First, Last) over threads, calling Construct on each part
+    using ParallelFor = std::function< void( size_t First, size_t Last,
+                                             const std::function< void( size_t, size_t ) >& Construct ) >;
+
+    T& operator[]( size_t Index ) noexcept {
+        return chunks[Index / ChunkSize].get()[Index % ChunkSize];
+    }
+
+    const T& operator[]( size_t Index ) const noexcept {
+        return chunks[Index / ChunkSize].get()[Index % ChunkSize];
+    }
+
+    /**
+     * @brief Allocates chunks until Count elements fit. New elements are value
+     *        initialized on the calling thread, existing ones are left untouched.
+     */
+    void Reserve( size_t Count ) {
+        Reserve( Count, []( size_t First, size_t Last,
+                            const std::function< void( size_t, size_t ) >& Construct ) {
+            Construct( First, Last );
+        } );
+    }
+
+    //! Same as Reserve, the new elements are constructed by whichever threads Split runs Construct on
+    void Reserve( size_t Count, const ParallelFor& Split ) {
+        const size_t first = GetCapacity();
+        while ( GetCapacity() < Count ) {
+            void* memory = ::operator new( ChunkSize * sizeof( T ), std::align_val_t( CHUNK_ALIGNMENT ) );
+            chunks.emplace_back( static_cast< T* >( memory ) );
+        }
+
+        if ( first == GetCapacity() ) {
+            return;
+        }
+
+        Split( first, GetCapacity(), [this]( size_t Begin, size_t End ) {
+            for ( size_t i = Begin; i < End; ++i ) {
+                new ( &( *this )[i] ) T();
+            }
+        } );
+    }
+
+    //! Number of usable elements, always a multiple of ChunkSize
+    size_t GetCapacity() const noexcept {
+        return chunks.size() * ChunkSize;
+    }
+
+    size_t GetMemory() const noexcept {
+        return GetCapacity() * sizeof( T ) + chunks.capacity() * sizeof( Chunk );
+    }
+
+    static constexpr size_t CHUNK_SIZE = ChunkSize;
+
+private:
+    //! Never less than plain new gives, MSVC only rounds an aligned request up to 8
+    static constexpr size_t CHUNK_ALIGNMENT = std::max( alignof( T ), size_t( __STDCPP_DEFAULT_NEW_ALIGNMENT__ ) );
+
+    struct ChunkDeleter {
+        void operator()( T* Memory ) const noexcept {
+            ::operator delete( Memory, std::align_val_t( CHUNK_ALIGNMENT ) );
+        }
+    };
+    using Chunk = std::unique_ptr< T, ChunkDeleter >;
+
+    std::vector< Chunk > chunks;
+};
+
+#endif
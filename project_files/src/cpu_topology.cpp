@@ -0,0 +1,214 @@
+
+// std includes
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+// System includes
+#if defined( _WIN32 )
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <fmt/core.h>
+
+// Local includes
+#include "cpu_topology.hpp"
+#include "trace.hpp"
+
+#if !defined( _WIN32 )
+//! Parses a /sys cpu list such as "0-7,16-23"
+static std::vector< int > ParseCpuList( const std::string& List ) {
+    std::vector< int > cpus;
+
+    size_t position = 0;
+    while ( position < List.size() ) {
+        size_t end = List.find( ',', position );
+        if ( end == std::string::npos ) {
+            end = List.size();
+        }
+
+        const std::string range = List.substr( position, end - position );
+        const size_t dash = range.find( '-' );
+        try {
+            const int first = std::stoi( range.substr( 0, dash ) );
+            const int last = dash == std::string::npos ? first : std::stoi( range.substr( dash + 1 ) );
+            for ( int cpu = first; cpu <= last; ++cpu ) {
+                cpus.push_back( cpu );
+            }
+        } catch ( const std::exception& ) {
+            // Trailing newline or an empty node
+        }
+
+        position = end + 1;
+    }
+
+    return cpus;
+}
+#endif
+
+CpuTopology::CpuTopology() {
+    Detect();
+}
+
+CpuTopology& CpuTopology::Instance() {
+    static CpuTopology cpuTopologyInstance;
+    return cpuTopologyInstance;
+}
+
+void CpuTopology::Detect() {
+#if defined( _WIN32 )
+    ULONG highestNode = 0;
+    if ( GetNumaHighestNodeNumber( &highestNode ) ) {
+        for ( USHORT node = 0; node <= highestNode; ++node ) {
+            GROUP_AFFINITY affinity{};
+            if ( !GetNumaNodeProcessorMaskEx( node, &affinity ) || affinity.Mask == 0 ) {
+                continue;
+            }
+
+            NumaNode numaNode{ node, {} };
+            for ( int bit = 0; bit < 64; ++bit ) {
+                if ( affinity.Mask & ( KAFFINITY( 1 ) << bit ) ) {
+                    numaNode.cpus.push_back( affinity.Group * 64 + bit );
+                }
+            }
+            nodes.push_back( std::move( numaNode ) );
+        }
+    }
+#else
+    const std::filesystem::path nodeDirectory = "/sys/devices/system/node";
+
+    std::error_code error;
+    for ( const auto& entry : std::filesystem::directory_iterator( nodeDirectory, error ) ) {
+        const std::string name = entry.path().filename().string();
+        if ( name.rfind( "node", 0 ) != 0 || name.size() == 4 ||
+             !std::all_of( name.begin() + 4, name.end(), ::isdigit ) ) {
+            continue;
+        }
+
+        std::ifstream cpuList( entry.path() / "cpulist" );
+        std::string list;
+        std::getline( cpuList, list );
+
+        NumaNode node{ std::stoi( name.substr( 4 ) ), ParseCpuList( list ) };
+        if ( !node.cpus.empty() ) {
+            nodes.push_back( std::move( node ) );
+        }
+    }
+
+    std::sort( nodes.begin(), nodes.end(), []( const NumaNode& A, const NumaNode& B ) {
+        return A.id < B.id;
+    } );
+#endif
+
+    if ( nodes.empty() ) {
+        NumaNode node{ 0, {} };
+        for ( unsigned cpu = 0; cpu < std::max( std::thread::hardware_concurrency(), 1u ); ++cpu ) {
+            node.cpus.push_back( static_cast< int >( cpu ) );
+        }
+        nodes.push_back( std::move( node ) );
+    }
+
+    cpu_count = 0;
+    for ( const NumaNode& node : nodes ) {
+        cpu_count += static_cast< unsigned >( node.cpus.size() );
+        Trace::Message( fmt::format( "NUMA node {}: {} cpus", node.id, node.cpus.size() ) );
+    }
+}
+
+const std::vector< NumaNode >& CpuTopology::GetNodes() const {
+    return nodes;
+}
+
+unsigned CpuTopology::GetCpuCount() const {
+    return cpu_count;
+}
+
+std::vector< int > CpuTopology::ThreadCpus( unsigned ThreadCount ) const {
+    std::vector< int > cpus;
+    cpus.reserve( ThreadCount );
+
+    // More threads than processors wrap around and share
+    while ( cpus.size() < ThreadCount ) {
+        for ( const NumaNode& node : nodes ) {
+            for ( int cpu : node.cpus ) {
+                if ( cpus.size() < ThreadCount ) {
+                    cpus.push_back( cpu );
+                }
+            }
+        }
+    }
+
+    return cpus;
+}
+
+std::vector< int > CpuTopology::ThreadNodes( unsigned ThreadCount ) const {
+    std::vector< int > threadNodes;
+    threadNodes.reserve( ThreadCount );
+
+    while ( threadNodes.size() < ThreadCount ) {
+        for ( size_t i = 0; i < nodes.size(); ++i ) {
+            for ( size_t j = 0; j < nodes[i].cpus.size() && threadNodes.size() < ThreadCount; ++j ) {
+                threadNodes.push_back( static_cast< int >( i ) );
+            }
+        }
+    }
+
+    return threadNodes;
+}
+
+#if defined( _WIN32 )
+static bool SetAffinity( HANDLE Thread, int Cpu ) {
+    GROUP_AFFINITY affinity{};
+
+    if ( Cpu < 0 ) {
+        DWORD_PTR processMask = 0;
+        DWORD_PTR systemMask = 0;
+        GetProcessAffinityMask( GetCurrentProcess(), &processMask, &systemMask );
+        affinity.Mask = processMask;
+    } else {
+        affinity.Group = static_cast< WORD >( Cpu / 64 );
+        affinity.Mask = KAFFINITY( 1 ) << ( Cpu % 64 );
+    }
+
+    return SetThreadGroupAffinity( Thread, &affinity, nullptr ) != 0;
+}
+
+bool CpuTopology::PinThread( std::thread& Thread, int Cpu ) {
+    return SetAffinity( static_cast< HANDLE >( Thread.native_handle() ), Cpu );
+}
+
+bool CpuTopology::PinCurrentThread( int Cpu ) {
+    return SetAffinity( GetCurrentThread(), Cpu );
+}
+#else
+static bool SetAffinity( pthread_t Thread, int Cpu ) {
+    cpu_set_t set;
+    CPU_ZERO( &set );
+
+    if ( Cpu < 0 ) {
+        for ( const NumaNode& node : CpuTopology::Instance().GetNodes() ) {
+            for ( int cpu : node.cpus ) {
+                CPU_SET( cpu, &set );
+            }
+        }
+    } else {
+        CPU_SET( Cpu, &set );
+    }
+
+    return pthread_setaffinity_np( Thread, sizeof( set ), &set ) == 0;
+}
+
+bool CpuTopology::PinThread( std::thread& Thread, int Cpu ) {
+    return SetAffinity( Thread.native_handle(), Cpu );
+}
+
+bool CpuTopology::PinCurrentThread( int Cpu ) {
+    return SetAffinity( pthread_self(), Cpu );
+}
+#endif
@@ -0,0 +1,51 @@
+#ifndef CPU_TOPOLOGY_HPP
+#define CPU_TOPOLOGY_HPP
+#pragma once
+
+// std includes
+#include <thread>
+#include <vector>
+
+struct NumaNode {
+    int id;
+    std::vector< int > cpus; //!< logical processors of the node
+};
+
+/*! NUMA nodes and their processors, read once from /sys on Linux and from
+ *  the NUMA API on Windows. Without NUMA information all processors end up
+ *  in a single node. */
+class CpuTopology {
+public:
+    static CpuTopology& Instance();
+
+    const std::vector< NumaNode >& GetNodes() const;
+    unsigned GetCpuCount() const;
+
+    /**
+     * @brief Processor for each of ThreadCount threads. Consecutive threads
+     *        fill one node before moving on to the next, so a contiguous range
+     *        of threads shares a node.
+     */
+    std::vector< int > ThreadCpus( unsigned ThreadCount ) const;
+
+    //! Index into GetNodes() of the node every one of ThreadCount threads is placed on
+    std::vector< int > ThreadNodes( unsigned ThreadCount ) const;
+
+    /**
+     * @brief Restricts Thread to Cpu, a negative Cpu allows every processor again.
+     *
+     * @return false when the platform refused
+     */
+    static bool PinThread( std::thread& Thread, int Cpu );
+    static bool PinCurrentThread( int Cpu );
+
+private:
+    CpuTopology();
+
+    void Detect();
+
+    std::vector< NumaNode > nodes;
+    unsigned cpu_count = 0;
+};
+
+#endif
@@ -1,6 +1,10 @@
 
+// std includes
+#include <algorithm>
+
 // System headers
 #include <fmt/core.h>
+#include "imgui.h"
 
 // Local headers
 #include "profiler.hpp"
@@ -40,7 +44,12 @@ bool Engine::Initialize() {
 
     VerletManager::Instance().CreateVerlets( ContainerShape::Sphere );
 
+    Editor::Instance().AddDisplayMenuCallback( std::bind( &ModelManager::DisplayMenu,
+                                                          &ModelManager::Instance() ) );
+    Editor::Instance().AddDisplayMenuCallback( std::bind( &Engine::DisplayMenu, this ) );
+
     last_time = steady_clock::now();
+    step_time = last_time;
     accumulator = 0.f;
     time = 0.f;
     is_running = true;
@@ -51,6 +60,10 @@ bool Engine::Initialize() {
 void Engine::Update() {
     Profiler profiler;
 
+    // Physics runs on its own thread, a slow step no longer holds back rendering and
+    // vsync no longer holds back physics
+    simulation_thread = std::thread( &Engine::SimulationLoop, this );
+
     while ( is_running ) {
         curr_time = steady_clock::now();
         time_taken = curr_time - last_time;
@@ -58,42 +71,93 @@ void Engine::Update() {
                      steady_clock::period::num / steady_clock::period::den;
 
         last_time = curr_time;
-        accumulator += delta_time;
 
         glfwSetWindowTitle( Graphics::Instance().GetWindow(),
                             fmt::format( "FPS : {:0.2f} | Balls : {:10} | Time : {:5.2f}",
                                          1.0f / delta_time,
-                                         VerletManager::Instance().GetCurrCount(), time )
+                                         VerletManager::Instance().GetCurrCount(), time.load() )
                                 .c_str() );
 
         // Non-fixed time step update calls
         Input::Instance().Update();
 
+        for ( auto& func : update_callbacks ) {
+            func();
+        }
+
+        Camera::Instance().Update();
+        Graphics::Instance().Update();
+
+        // Nothing moves while paused and nobody looks while in the background
+        GLFWwindow* window = Graphics::Instance().GetWindow();
+        idle = !VerletManager::Instance().IsSimulating() ||
+               !glfwGetWindowAttrib( window, GLFW_FOCUSED ) ||
+               glfwGetWindowAttrib( window, GLFW_ICONIFIED );
+
+        frame_pacer.Wait( idle ? idle_frame_rate : frame_rate_limit );
+    }
+
+    simulation_thread.join();
+}
+
+void Engine::SimulationLoop() {
+    steady_clock::time_point lastTime = steady_clock::now();
+
+    while ( is_running ) {
+        steady_clock::time_point now = steady_clock::now();
+        const float elapsed = duration< float >( now - lastTime ).count();
+        lastTime = now;
+
+        wall_time = wall_time + elapsed;
+
+        // Time dilation trades real time speed for a steady step rate when steps get too slow
+        float scale = 1.f;
+        if ( time_dilation ) {
+            static constexpr float STEP_BUDGET = 0.9f; //!< share of wall time steps may use
+            scale = std::clamp( STEP_BUDGET * fixed_time_step / std::max( step_cost.load(), 1e-6f ),
+                                0.05f, 1.f );
+        }
+        time_scale = scale;
+
+        accumulator += elapsed * scale;
+
         // Fixed time step update calls
-        while ( accumulator >= fixed_time_step ) {
-            // Call fixed updates here
+        const int maxSubsteps = max_substeps;
+        int substeps = 0;
+        while ( accumulator >= fixed_time_step && substeps < maxSubsteps ) {
+            // Callbacks may set the length of the next step
+            const float step = fixed_time_step;
+            accumulator -= step;
+            step_time = now - duration_cast< steady_clock::duration >(
+                                  duration< float >( accumulator / scale ) );
+
+            steady_clock::time_point stepStart = steady_clock::now();
 
             for ( auto& func : fixed_update_callbacks ) {
                 func();
             }
 
-            accumulator -= fixed_time_step;
-            time += fixed_time_step;
-        }
+            const float cost = duration< float >( steady_clock::now() - stepStart ).count();
+            step_cost = step_cost + ( cost - step_cost ) * 0.1f;
 
-        // Non-fixed time step update calls
-        // TODO: will be moved around
+            time = time + step;
+            ++substeps;
+        }
+        last_substeps = substeps;
 
-        for ( auto& func : update_callbacks ) {
-            func();
+        // Out of budget, the backlog could never be caught up and would only keep growing
+        if ( accumulator > fixed_time_step ) {
+            dropped_time = dropped_time + ( accumulator - fixed_time_step );
+            accumulator = fixed_time_step;
         }
 
-        Camera::Instance().Update();
-        Graphics::Instance().Update();
+        std::this_thread::sleep_for( duration< float >( ( fixed_time_step - accumulator ) / scale ) );
     }
 }
 
 void Engine::Shutdown() {
+    VerletManager::Instance().Shutdown();
+    ModelManager::Instance().Shutdown();
     Graphics::Instance().Shutdown();
 }
 
@@ -113,6 +177,58 @@ float Engine::GetFixedTimeStep() const {
     return fixed_time_step;
 }
 
+void Engine::SetFixedTimeStep( float Step ) {
+    fixed_time_step = Step;
+}
+
+steady_clock::time_point Engine::GetStepTime() const {
+    return step_time;
+}
+
+float Engine::GetInterpolationAlpha( steady_clock::time_point StepTime ) const {
+    float alpha = duration< float >( steady_clock::now() - StepTime ).count() * time_scale /
+                  fixed_time_step;
+    return std::clamp( alpha, 0.f, 1.f );
+}
+
+void Engine::DisplayMenu() {
+    ImGui::Begin( "Engine##1" );
+
+    const float lag = wall_time - time;
+
+    ImGui::Text( fmt::format( "Step: {:.2f} ms of {:.2f} ms", step_cost * 1000.f,
+                              fixed_time_step * 1000.f )
+                     .c_str() );
+    ImGui::Text( fmt::format( "Substeps last loop: {}", last_substeps.load() ).c_str() );
+    ImGui::Text( fmt::format( "Simulated time: {:.2f} s | Wall time: {:.2f} s", time.load(),
+                              wall_time.load() )
+                     .c_str() );
+    ImGui::Text( fmt::format( "Behind wall time: {:.2f} s (dropped {:.2f} s)", lag,
+                              dropped_time.load() )
+                     .c_str() );
+    ImGui::Text( fmt::format( "Time scale: {:.0f}%", time_scale * 100.f ).c_str() );
+
+    ImGui::SeparatorText( "Frame pacing" );
+    ImGui::Text( fmt::format( "{} | spin tail {:.2f} ms", idle ? "Idle (paused or unfocused)" : "Active",
+                              frame_pacer.GetSpinTail() )
+                     .c_str() );
+    ImGui::SliderFloat( "Frame limit (0 = off)", &frame_rate_limit, 0.f, 360.f, "%.0f" );
+    ImGui::SliderFloat( "Idle frame rate", &idle_frame_rate, 1.f, 60.f, "%.0f" );
+
+    ImGui::SeparatorText( "Fixed step" );
+    int maxSubsteps = max_substeps;
+    if ( ImGui::SliderInt( "Max substeps", &maxSubsteps, 1, 20 ) ) {
+        max_substeps = maxSubsteps;
+    }
+
+    bool timeDilation = time_dilation;
+    if ( ImGui::Checkbox( "Time dilation##1", &timeDilation ) ) {
+        time_dilation = timeDilation;
+    }
+
+    ImGui::End();
+}
+
 Engine& Engine::Instance() {
     static Engine engineInstance;
     return engineInstance;
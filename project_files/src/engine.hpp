@@ -4,10 +4,15 @@
 #pragma once
 
 // std includes
+#include <atomic>
 #include <chrono>
 #include <functional>
+#include <thread>
 #include <vector>
 
+// Local includes
+#include "frame_pacer.hpp"
+
 using namespace std::chrono;
 
 class Engine {
@@ -21,8 +26,33 @@ public:
 
     float GetFixedTimeStep() const;
 
+    /**
+     * @brief Length of the following fixed steps, simulated and wall time alike.
+     *        Only called on the simulation thread, inside fixed update callbacks.
+     */
+    void SetFixedTimeStep( float Step );
+
+    static constexpr float BASE_TIME_STEP = 0.01f; //!< step the simulation is tuned for
+
+    /**
+     * @brief Time the current fixed step completes at. Only meaningful on the
+     *        simulation thread, inside fixed update callbacks.
+     */
+    steady_clock::time_point GetStepTime() const;
+
+    /**
+     * @brief How far the render thread is past a published step, for
+     *        interpolating between it and the step before.
+     *
+     * @param StepTime GetStepTime() of the published step
+     * @return float   [0, 1] fraction of a fixed time step
+     */
+    float GetInterpolationAlpha( steady_clock::time_point StepTime ) const;
+
     void TriggerShutdown();
 
+    void DisplayMenu();
+
     template < typename TCallback >
     inline void AddFixedUpdateCallback( TCallback&& Callback ) {
         fixed_update_callbacks.insert( fixed_update_callbacks.begin(), Callback );
@@ -38,6 +68,9 @@ public:
 private:
     Engine();
 
+    //! Runs the fixed time step callbacks until shutdown
+    void SimulationLoop();
+
     steady_clock::time_point last_time; //!< last update time
     steady_clock::time_point curr_time; //!< new update time
     steady_clock::duration time_taken;  //!< time between frames
@@ -45,11 +78,29 @@ private:
     std::vector< std::function< void() > > update_callbacks;
     std::vector< std::function< void() > > fixed_update_callbacks;
 
+    std::thread simulation_thread; //!< runs fixed_update_callbacks
+
+    FramePacer frame_pacer;
+    float frame_rate_limit = 144.f; //!< 0 for unlimited
+    float idle_frame_rate = 20.f;   //!< while paused or the window is in the background
+    bool idle = false;
+
     float delta_time;                                //!< time between frames
     float accumulator;                               //!< amount of unused time for physics update
-    float time;                                      //!< total time engine is running
-    static constexpr float fixed_time_step{ 0.01f }; //!< fixed time step for physics update
-    bool is_running;                                 //!< if main loop is running
+    std::atomic< float > time;                       //!< total simulated time
+    steady_clock::time_point step_time;              //!< completion time of the current step
+    std::atomic< float > fixed_time_step{ BASE_TIME_STEP }; //!< fixed time step for physics update
+    std::atomic< bool > is_running;                  //!< if main and simulation loops are running
+
+    std::atomic< int > max_substeps{ 5 };       //!< fixed steps per loop before the accumulator is clamped
+    std::atomic< bool > time_dilation{ false }; //!< slow simulated time down instead of dropping it
+
+    // Simulation thread metrics, shown by DisplayMenu
+    std::atomic< int > last_substeps{ 0 };    //!< fixed steps run by the last loop
+    std::atomic< float > step_cost{ 0.f };    //!< moving average of one fixed step in seconds
+    std::atomic< float > time_scale{ 1.f };   //!< simulated seconds per wall second
+    std::atomic< float > dropped_time{ 0.f }; //!< simulated time discarded by accumulator clamping
+    std::atomic< float > wall_time{ 0.f };    //!< wall time the simulation has been running
 };
 
 #endif
@@ -0,0 +1,197 @@
+
+// std includes
+#include <algorithm>
+
+// System includes
+#include <xmmintrin.h>
+
+// Local includes
+#include "force_fields.hpp"
+#include "verlet.hpp"
+
+//! Linear falloff from 1 at the centre to 0 at the radius, InverseRadius 0 keeps 1 everywhere
+static inline __m128 Falloff( __m128 Distance, __m128 InverseRadius ) noexcept {
+    return _mm_max_ps( _mm_setzero_ps(), _mm_sub_ps( _mm_set1_ps( 1.f ), _mm_mul_ps( Distance, InverseRadius ) ) );
+}
+
+//! 1 / sqrt( Value ), 0 stays finite so coincident points get no direction instead of NaN
+static inline __m128 InverseLength( __m128 LengthSquared ) noexcept {
+    return _mm_div_ps( _mm_set1_ps( 1.f ), _mm_sqrt_ps( _mm_max_ps( LengthSquared, _mm_set1_ps( 1e-12f ) ) ) );
+}
+
+static inline __m128 Dot( __m128 Ax, __m128 Ay, __m128 Az, __m128 Bx, __m128 By, __m128 Bz ) noexcept {
+    return _mm_add_ps( _mm_add_ps( _mm_mul_ps( Ax, Bx ), _mm_mul_ps( Ay, By ) ), _mm_mul_ps( Az, Bz ) );
+}
+
+void ForceFieldSet::Compile( const std::vector< ForceField >& Fields ) {
+    std::array< std::vector< PackedField >, KERNEL_COUNT > kernels;
+
+    for ( const ForceField& field : Fields ) {
+        if ( !field.enabled ) {
+            continue;
+        }
+
+        PackedField packed;
+        packed.center[0] = field.position.x;
+        packed.center[1] = field.position.y;
+        packed.center[2] = field.position.z;
+        packed.strength = field.type == FieldRepulsor ? -field.strength : field.strength;
+        packed.inverse_radius = field.radius > 0.f ? 1.f / field.radius : 0.f;
+
+        const float length = glm::length( field.direction );
+        const glm::vec3 direction = length > 0.f ? field.direction / length : glm::vec3( 0.f );
+        packed.direction[0] = direction.x;
+        packed.direction[1] = direction.y;
+        packed.direction[2] = direction.z;
+
+        switch ( field.type ) {
+        case FieldAttractor:
+        case FieldRepulsor:
+            kernels[KernelRadial].push_back( packed );
+            break;
+        case FieldVortex:
+            kernels[KernelVortex].push_back( packed );
+            break;
+        case FieldDrag:
+            kernels[KernelDrag].push_back( packed );
+            break;
+        case FieldWind:
+            kernels[KernelWind].push_back( packed );
+            break;
+        default:
+            break;
+        }
+    }
+
+    fields.clear();
+    for ( unsigned kernel = 0; kernel < KERNEL_COUNT; ++kernel ) {
+        kernel_first[kernel] = static_cast< unsigned >( fields.size() );
+        fields.insert( fields.end(), kernels[kernel].begin(), kernels[kernel].end() );
+    }
+    kernel_first[KERNEL_COUNT] = static_cast< unsigned >( fields.size() );
+}
+
+void ForceFieldSet::Apply( Verlet* const* Group, unsigned Count, float InverseDt ) const noexcept {
+    Verlet* particles[WIDTH];
+    for ( unsigned j = 0; j < WIDTH; ++j ) {
+        particles[j] = Group[j < Count ? j : 0];
+    }
+
+    // Four particles side by side, one lane each
+    __m128 x = _mm_load_ps( particles[0]->position.a );
+    __m128 y = _mm_load_ps( particles[1]->position.a );
+    __m128 z = _mm_load_ps( particles[2]->position.a );
+    __m128 w = _mm_load_ps( particles[3]->position.a );
+    _MM_TRANSPOSE4_PS( x, y, z, w );
+
+    __m128 ax = _mm_setzero_ps();
+    __m128 ay = _mm_setzero_ps();
+    __m128 az = _mm_setzero_ps();
+
+    for ( unsigned f = kernel_first[KernelRadial]; f < kernel_first[KernelRadial + 1]; ++f ) {
+        const PackedField& field = fields[f];
+        const __m128 dx = _mm_sub_ps( _mm_set1_ps( field.center[0] ), x );
+        const __m128 dy = _mm_sub_ps( _mm_set1_ps( field.center[1] ), y );
+        const __m128 dz = _mm_sub_ps( _mm_set1_ps( field.center[2] ), z );
+
+        const __m128 distanceSquared = Dot( dx, dy, dz, dx, dy, dz );
+        const __m128 inverse = InverseLength( distanceSquared );
+        const __m128 falloff = Falloff( _mm_mul_ps( distanceSquared, inverse ), _mm_set1_ps( field.inverse_radius ) );
+
+        const __m128 scale = _mm_mul_ps( _mm_mul_ps( _mm_set1_ps( field.strength ), falloff ), inverse );
+        ax = _mm_add_ps( ax, _mm_mul_ps( dx, scale ) );
+        ay = _mm_add_ps( ay, _mm_mul_ps( dy, scale ) );
+        az = _mm_add_ps( az, _mm_mul_ps( dz, scale ) );
+    }
+
+    for ( unsigned f = kernel_first[KernelVortex]; f < kernel_first[KernelVortex + 1]; ++f ) {
+        const PackedField& field = fields[f];
+        const __m128 rx = _mm_sub_ps( x, _mm_set1_ps( field.center[0] ) );
+        const __m128 ry = _mm_sub_ps( y, _mm_set1_ps( field.center[1] ) );
+        const __m128 rz = _mm_sub_ps( z, _mm_set1_ps( field.center[2] ) );
+        const __m128 axisX = _mm_set1_ps( field.direction[0] );
+        const __m128 axisY = _mm_set1_ps( field.direction[1] );
+        const __m128 axisZ = _mm_set1_ps( field.direction[2] );
+
+        // Tangent around the axis, its length is the distance to the axis
+        const __m128 tx = _mm_sub_ps( _mm_mul_ps( axisY, rz ), _mm_mul_ps( axisZ, ry ) );
+        const __m128 ty = _mm_sub_ps( _mm_mul_ps( axisZ, rx ), _mm_mul_ps( axisX, rz ) );
+        const __m128 tz = _mm_sub_ps( _mm_mul_ps( axisX, ry ), _mm_mul_ps( axisY, rx ) );
+
+        const __m128 distance = _mm_sqrt_ps( Dot( rx, ry, rz, rx, ry, rz ) );
+        const __m128 falloff = Falloff( distance, _mm_set1_ps( field.inverse_radius ) );
+
+        const __m128 scale = _mm_mul_ps( _mm_mul_ps( _mm_set1_ps( field.strength ), falloff ),
+                                         InverseLength( Dot( tx, ty, tz, tx, ty, tz ) ) );
+        ax = _mm_add_ps( ax, _mm_mul_ps( tx, scale ) );
+        ay = _mm_add_ps( ay, _mm_mul_ps( ty, scale ) );
+        az = _mm_add_ps( az, _mm_mul_ps( tz, scale ) );
+    }
+
+    if ( kernel_first[KernelDrag] < kernel_first[KernelDrag + 1] ) {
+        __m128 ox = _mm_load_ps( particles[0]->old_position.a );
+        __m128 oy = _mm_load_ps( particles[1]->old_position.a );
+        __m128 oz = _mm_load_ps( particles[2]->old_position.a );
+        __m128 ow = _mm_load_ps( particles[3]->old_position.a );
+        _MM_TRANSPOSE4_PS( ox, oy, oz, ow );
+
+        const __m128 inverseDt = _mm_set1_ps( InverseDt );
+        const __m128 vx = _mm_mul_ps( _mm_sub_ps( x, ox ), inverseDt );
+        const __m128 vy = _mm_mul_ps( _mm_sub_ps( y, oy ), inverseDt );
+        const __m128 vz = _mm_mul_ps( _mm_sub_ps( z, oz ), inverseDt );
+
+        for ( unsigned f = kernel_first[KernelDrag]; f < kernel_first[KernelDrag + 1]; ++f ) {
+            const PackedField& field = fields[f];
+            const __m128 dx = _mm_sub_ps( _mm_set1_ps( field.center[0] ), x );
+            const __m128 dy = _mm_sub_ps( _mm_set1_ps( field.center[1] ), y );
+            const __m128 dz = _mm_sub_ps( _mm_set1_ps( field.center[2] ), z );
+
+            const __m128 distance = _mm_sqrt_ps( Dot( dx, dy, dz, dx, dy, dz ) );
+            const __m128 falloff = Falloff( distance, _mm_set1_ps( field.inverse_radius ) );
+
+            const __m128 scale = _mm_mul_ps( _mm_set1_ps( -field.strength ), falloff );
+            ax = _mm_add_ps( ax, _mm_mul_ps( vx, scale ) );
+            ay = _mm_add_ps( ay, _mm_mul_ps( vy, scale ) );
+            az = _mm_add_ps( az, _mm_mul_ps( vz, scale ) );
+        }
+    }
+
+    for ( unsigned f = kernel_first[KernelWind]; f < kernel_first[KernelWind + 1]; ++f ) {
+        const PackedField& field = fields[f];
+        const __m128 dx = _mm_sub_ps( _mm_set1_ps( field.center[0] ), x );
+        const __m128 dy = _mm_sub_ps( _mm_set1_ps( field.center[1] ), y );
+        const __m128 dz = _mm_sub_ps( _mm_set1_ps( field.center[2] ), z );
+
+        const __m128 distance = _mm_sqrt_ps( Dot( dx, dy, dz, dx, dy, dz ) );
+        const __m128 scale = _mm_mul_ps( _mm_set1_ps( field.strength ),
+                                         Falloff( distance, _mm_set1_ps( field.inverse_radius ) ) );
+        ax = _mm_add_ps( ax, _mm_mul_ps( _mm_set1_ps( field.direction[0] ), scale ) );
+        ay = _mm_add_ps( ay, _mm_mul_ps( _mm_set1_ps( field.direction[1] ), scale ) );
+        az = _mm_add_ps( az, _mm_mul_ps( _mm_set1_ps( field.direction[2] ), scale ) );
+    }
+
+    // Back to one particle per register, w of the accelerations is left alone
+    __m128 a0 = _mm_load_ps( particles[0]->acceleration.a );
+    __m128 a1 = _mm_load_ps( particles[1]->acceleration.a );
+    __m128 a2 = _mm_load_ps( particles[2]->acceleration.a );
+    __m128 a3 = _mm_load_ps( particles[3]->acceleration.a );
+    _MM_TRANSPOSE4_PS( a0, a1, a2, a3 );
+    a0 = _mm_add_ps( a0, ax );
+    a1 = _mm_add_ps( a1, ay );
+    a2 = _mm_add_ps( a2, az );
+    _MM_TRANSPOSE4_PS( a0, a1, a2, a3 );
+
+    const __m128 rows[WIDTH] = { a0, a1, a2, a3 };
+    for ( unsigned j = 0; j < Count; ++j ) {
+        _mm_store_ps( particles[j]->acceleration.a, rows[j] );
+    }
+}
+
+bool ForceFieldSet::IsEmpty() const noexcept {
+    return fields.empty();
+}
+
+const char* ForceFieldSet::TypeName( ForceFieldType Type ) noexcept {
+    static const char* names[FIELD_TYPE_COUNT] = { "Attractor", "Repulsor", "Vortex", "Drag", "Wind" };
+    return Type < FIELD_TYPE_COUNT ? names[Type] : "Unknown";
+}
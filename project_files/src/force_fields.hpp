@@ -0,0 +1,75 @@
+#ifndef FORCE_FIELDS_HPP
+#define FORCE_FIELDS_HPP
+#pragma once
+
+// std includes
+#include <array>
+#include <vector>
+
+// System includes
+#include <glm/glm.hpp>
+
+struct Verlet;
+
+enum ForceFieldType {
+    FieldAttractor, //!< pulls towards position
+    FieldRepulsor,  //!< pushes away from position
+    FieldVortex,    //!< swirls around direction through position
+    FieldDrag,      //!< slows particles down
+    FieldWind,      //!< pushes along direction
+    FIELD_TYPE_COUNT,
+};
+
+struct ForceField {
+    ForceFieldType type = FieldAttractor;
+    glm::vec3 position{ 0.f };
+    glm::vec3 direction{ 0.f, 1.f, 0.f }; //!< vortex axis or wind direction
+    float strength = 30.f;
+    float radius = 0.f; //!< strength falls off linearly to 0 at radius, 0 reaches everywhere
+    bool enabled = true;
+};
+
+/*! Force fields packed for evaluation. Enabled fields are sorted by kernel
+ *  so the sweep runs every kernel over its fields without branching per
+ *  field, four particles at a time with SSE. */
+class ForceFieldSet {
+public:
+    //! Packs the enabled Fields, runs whenever the settings change
+    void Compile( const std::vector< ForceField >& Fields );
+
+    /**
+     * @brief Adds the acceleration of every field to Count <= WIDTH particles.
+     *        Missing particles of a short group are padded and not written.
+     *
+     * @param InverseDt Converts the step displacement into the velocity drag works on
+     */
+    void Apply( Verlet* const* Group, unsigned Count, float InverseDt ) const noexcept;
+
+    bool IsEmpty() const noexcept;
+
+    static constexpr unsigned WIDTH = 4;
+
+    static const char* TypeName( ForceFieldType Type ) noexcept;
+
+private:
+    //! Attractors and repulsors share a kernel, repulsors are stored with negated strength
+    enum Kernel {
+        KernelRadial,
+        KernelVortex,
+        KernelDrag,
+        KernelWind,
+        KERNEL_COUNT,
+    };
+
+    struct PackedField {
+        float center[3];
+        float strength;
+        float inverse_radius; //!< 0 without falloff
+        float direction[3];   //!< normalized
+    };
+
+    std::vector< PackedField > fields;                 //!< sorted by kernel
+    std::array< unsigned, KERNEL_COUNT + 1 > kernel_first{}; //!< first field of every kernel
+};
+
+#endif
@@ -0,0 +1,44 @@
+
+// std includes
+#include <algorithm>
+#include <thread>
+
+// Local includes
+#include "frame_pacer.hpp"
+
+void FramePacer::Wait( float Rate ) {
+    using namespace std::chrono;
+
+    steady_clock::time_point now = steady_clock::now();
+    if ( Rate <= 0.f ) {
+        deadline = now;
+        return;
+    }
+
+    const auto period = duration_cast< steady_clock::duration >( duration< float >( 1.f / Rate ) );
+    deadline += period;
+
+    // Too far behind (slow frame, rate change), start over instead of rushing to catch up
+    if ( deadline < now - period || deadline > now + period ) {
+        deadline = now + period;
+    }
+
+    const auto spinTail = duration_cast< steady_clock::duration >(
+        duration< float >( oversleep + MIN_SPIN_TAIL ) );
+
+    if ( deadline - now > spinTail ) {
+        const steady_clock::time_point wakeTime = deadline - spinTail;
+        std::this_thread::sleep_until( wakeTime );
+
+        const float measured = duration< float >( steady_clock::now() - wakeTime ).count();
+        oversleep = std::max( measured, oversleep * 0.99f );
+    }
+
+    while ( steady_clock::now() < deadline ) {
+        std::this_thread::yield();
+    }
+}
+
+float FramePacer::GetSpinTail() const {
+    return ( oversleep + MIN_SPIN_TAIL ) * 1000.f;
+}
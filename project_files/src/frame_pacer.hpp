@@ -0,0 +1,31 @@
+#ifndef FRAME_PACER_HPP
+#define FRAME_PACER_HPP
+#pragma once
+
+// std includes
+#include <chrono>
+
+/*! Holds a loop to a target rate. Most of the wait is spent sleeping, only a
+ *  short tail is spun (yielding) to hit the deadline precisely. The tail
+ *  follows how much the OS oversleeps, which depends on its timer
+ *  granularity. */
+class FramePacer {
+public:
+    /**
+     * @brief Waits for the end of the current frame at Rate frames per second.
+     *
+     * @param Rate Target rate, 0 or less returns immediately
+     */
+    void Wait( float Rate );
+
+    //! Current spin tail in milliseconds
+    float GetSpinTail() const;
+
+    static constexpr float MIN_SPIN_TAIL = 0.25e-3f; //!< seconds
+
+private:
+    std::chrono::steady_clock::time_point deadline;
+    float oversleep = 1e-3f; //!< decaying maximum of the oversleep in seconds
+};
+
+#endif
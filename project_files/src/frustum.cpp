@@ -0,0 +1,37 @@
+
+// Local includes
+#include "frustum.hpp"
+
+Frustum Frustum::FromMatrix( const glm::mat4& ViewProjection ) {
+    // Rows of the matrix, glm is column major
+    glm::vec4 rows[4];
+    for ( int i = 0; i < 4; ++i ) {
+        rows[i] = { ViewProjection[0][i], ViewProjection[1][i], ViewProjection[2][i],
+                    ViewProjection[3][i] };
+    }
+
+    Frustum frustum;
+    frustum.planes = {
+        rows[3] + rows[0], // left
+        rows[3] - rows[0], // right
+        rows[3] + rows[1], // bottom
+        rows[3] - rows[1], // top
+        rows[3] + rows[2], // near
+        rows[3] - rows[2], // far
+    };
+
+    for ( glm::vec4& plane : frustum.planes ) {
+        plane /= glm::length( glm::vec3( plane ) );
+    }
+
+    return frustum;
+}
+
+bool Frustum::IntersectsSphere( const glm::vec3& Center, float Radius ) const {
+    for ( const glm::vec4& plane : planes ) {
+        if ( glm::dot( glm::vec3( plane ), Center ) + plane.w < -Radius ) {
+            return false;
+        }
+    }
+    return true;
+}
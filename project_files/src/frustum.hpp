@@ -0,0 +1,24 @@
+#ifndef FRUSTUM_HPP
+#define FRUSTUM_HPP
+#pragma once
+
+// std includes
+#include <array>
+
+// System includes
+#include <glm/glm.hpp>
+
+/*! View frustum as six inward facing planes (xyz normal, w distance) */
+struct Frustum {
+    /**
+     * @brief Extracts the planes of a combined projection * view matrix.
+     */
+    static Frustum FromMatrix( const glm::mat4& ViewProjection );
+
+    //! False only when the sphere is completely outside one of the planes
+    bool IntersectsSphere( const glm::vec3& Center, float Radius ) const;
+
+    std::array< glm::vec4, 6 > planes;
+};
+
+#endif
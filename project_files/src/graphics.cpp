@@ -104,17 +104,17 @@ bool Graphics::Initialize() {
         static_cast< float >( windowWidth ) / static_cast< float >( windowHeight ),
         0.1f, 100.0f );
 
+    glGenBuffers( 1, &camera_UBO );
+    glBindBuffer( GL_UNIFORM_BUFFER, camera_UBO );
+    glBufferData( GL_UNIFORM_BUFFER, sizeof( CameraBlock ), nullptr, GL_DYNAMIC_DRAW );
+    glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+    glBindBufferBase( GL_UNIFORM_BUFFER, CAMERA_BLOCK_BINDING, camera_UBO );
+
     return true;
 }
 
 void Graphics::Update() {
-    glm::mat4 view = Camera::Instance().GetViewMatrix();
-    // TODO: setup shaders
-    for ( const auto& [key, value] : ShaderManager::Instance().GetShaderList() ) {
-        glUseProgram( value );
-        glUniformMatrix4fv( glGetUniformLocation( value, "view" ), 1, GL_FALSE, &view[0][0] );
-        glUseProgram( 0 );
-    }
+    UpdateCameraBlock();
 
     // Clear colour and depth buffers
     glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT );
@@ -131,18 +131,33 @@ void Graphics::Update() {
     glfwPollEvents();
 }
 
+void Graphics::UpdateCameraBlock() {
+    CameraBlock block;
+    block.view = Camera::Instance().GetViewMatrix();
+    block.projection = projection;
+    block.position = glm::vec4( Camera::Instance().GetPosition(), 1.f );
+
+    glBindBuffer( GL_UNIFORM_BUFFER, camera_UBO );
+    glBufferSubData( GL_UNIFORM_BUFFER, 0, sizeof( CameraBlock ), &block );
+    glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+}
+
 void Graphics::DrawNormal( Model* Model, glm::mat4& Matrix ) {
-    glUseProgram( Model->GetShader() );
+    const Program& program = ShaderManager::Instance().GetProgram( Model->GetShader() );
 
-    glUniformMatrix4fv( glGetUniformLocation( Model->GetShader(), "model" ),
-                        1, GL_FALSE, &Matrix[0][0] );
+    glUseProgram( program.id );
 
-    glUniformMatrix4fv( glGetUniformLocation( Model->GetShader(), "projection" ),
-                        1, GL_FALSE, &projection[0][0] );
+    glUniformMatrix4fv( program.uniforms[UNIFORM_MODEL], 1, GL_FALSE, &Matrix[0][0] );
 
     glBindVertexArray( Model->GetMesh()->VAO );
 
-    glDrawArrays( Model->GetRenderMethod(), 0, Model->GetMesh()->num_vertices );
+    if ( Model->GetRenderMethod() == GL_POINTS ) {
+        // Every unique vertex once, the index buffer would repeat shared corners
+        glDrawArrays( GL_POINTS, 0, Model->GetMesh()->num_vertices );
+    } else {
+        glDrawElements( Model->GetRenderMethod(), Model->GetMesh()->num_indices,
+                        GL_UNSIGNED_INT, nullptr );
+    }
 
     glUseProgram( 0 );
 
@@ -150,6 +165,8 @@ void Graphics::DrawNormal( Model* Model, glm::mat4& Matrix ) {
 }
 
 void Graphics::Shutdown() {
+    glDeleteBuffers( 1, &camera_UBO );
+
     // Terminate GLFW (no need to call glfwDestroyWindow)
     glfwTerminate();
 }
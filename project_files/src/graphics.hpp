@@ -16,6 +16,13 @@
 
 class Model;
 
+//! Matches the std140 Camera uniform block in the shaders
+struct CameraBlock {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec4 position;
+};
+
 class Graphics {
 public:
     bool Initialize();
@@ -45,9 +52,13 @@ private:
 
     std::vector< std::function< void() > > render_callbacks;
 
+    void UpdateCameraBlock();
+
     GLFWwindow* window;
 
     glm::mat4 projection;
+
+    unsigned camera_UBO; //!< bound to CAMERA_BLOCK_BINDING for every program
 };
 
 // Function for handling keypresses
@@ -0,0 +1,139 @@
+
+// std includes
+#include <algorithm>
+
+// System includes
+#include <fmt/core.h>
+
+// Local includes
+#include "instance_buffer.hpp"
+#include "trace.hpp"
+
+bool InstanceBuffer::Initialize( size_t Stride, size_t Capacity ) {
+    Shutdown();
+
+    stride = Stride;
+    capacity = Capacity;
+    region_size = stride * capacity;
+
+    int major = 0;
+    int minor = 0;
+    glGetIntegerv( GL_MAJOR_VERSION, &major );
+    glGetIntegerv( GL_MINOR_VERSION, &minor );
+    persistent = major > 4 || ( major == 4 && minor >= 4 );
+
+    glGenBuffers( 1, &buffer );
+    glBindBuffer( GL_ARRAY_BUFFER, buffer );
+
+    if ( persistent ) {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage( GL_ARRAY_BUFFER, region_size * REGION_COUNT, nullptr, flags );
+        mapped = static_cast< char* >( glMapBufferRange( GL_ARRAY_BUFFER, 0,
+                                                         region_size * REGION_COUNT, flags ) );
+
+        if ( !mapped ) {
+            Trace::Message( "Persistent instance buffer mapping failed, using glBufferSubData." );
+            glDeleteBuffers( 1, &buffer );
+            glGenBuffers( 1, &buffer );
+            glBindBuffer( GL_ARRAY_BUFFER, buffer );
+            persistent = false;
+        }
+    }
+
+    if ( !persistent ) {
+        glBufferData( GL_ARRAY_BUFFER, region_size * REGION_COUNT, nullptr, GL_STREAM_DRAW );
+        staging.resize( region_size );
+    }
+
+    glBindBuffer( GL_ARRAY_BUFFER, 0 );
+
+    Trace::Message( fmt::format( "Instance buffer: {} x {} instances, {}", REGION_COUNT,
+                                 capacity, persistent ? "persistently mapped" : "staged" ) );
+
+    return true;
+}
+
+void InstanceBuffer::Shutdown() {
+    for ( GLsync& fence : fences ) {
+        if ( fence ) {
+            glDeleteSync( fence );
+            fence = nullptr;
+        }
+    }
+
+    if ( buffer ) {
+        if ( mapped ) {
+            glBindBuffer( GL_ARRAY_BUFFER, buffer );
+            glUnmapBuffer( GL_ARRAY_BUFFER );
+            glBindBuffer( GL_ARRAY_BUFFER, 0 );
+        }
+
+        glDeleteBuffers( 1, &buffer );
+    }
+
+    buffer = 0;
+    mapped = nullptr;
+    region = 0;
+    staging.clear();
+}
+
+bool InstanceBuffer::Reserve( size_t Capacity ) {
+    if ( Capacity <= capacity ) {
+        return true;
+    }
+
+    // Buffers the GPU may still read from are kept alive by the driver until it is done
+    return Initialize( stride, std::max( Capacity, capacity + capacity / 2 ) );
+}
+
+void* InstanceBuffer::BeginWrite() {
+    GLsync& fence = fences[region];
+    if ( fence ) {
+        // Normally already signalled, the region was last used two frames ago
+        GLenum result = glClientWaitSync( fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0 );
+        while ( result == GL_TIMEOUT_EXPIRED ) {
+            result = glClientWaitSync( fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000 );
+        }
+
+        glDeleteSync( fence );
+        fence = nullptr;
+    }
+
+    return persistent ? mapped + region * region_size : staging.data();
+}
+
+void InstanceBuffer::EndWrite( size_t Count ) {
+    if ( persistent || Count == 0 ) {
+        return;
+    }
+
+    glBindBuffer( GL_ARRAY_BUFFER, buffer );
+    glBufferSubData( GL_ARRAY_BUFFER, region * region_size, Count * stride, staging.data() );
+    glBindBuffer( GL_ARRAY_BUFFER, 0 );
+}
+
+void InstanceBuffer::Bind() const {
+    glBindVertexBuffer( INSTANCE_BINDING, buffer, region * region_size,
+                        static_cast< GLsizei >( stride ) );
+}
+
+void InstanceBuffer::Fence() {
+    fences[region] = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+    region = ( region + 1 ) % REGION_COUNT;
+}
+
+size_t InstanceBuffer::GetCapacity() const {
+    return capacity;
+}
+
+size_t InstanceBuffer::GetStride() const {
+    return stride;
+}
+
+size_t InstanceBuffer::GetMemory() const {
+    return region_size * REGION_COUNT;
+}
+
+bool InstanceBuffer::IsPersistent() const {
+    return persistent;
+}
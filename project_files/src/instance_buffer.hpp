@@ -0,0 +1,78 @@
+#ifndef INSTANCE_BUFFER_HPP
+#define INSTANCE_BUFFER_HPP
+#pragma once
+
+// std includes
+#include <array>
+#include <cstddef>
+#include <vector>
+
+// System includes
+#include <glad/glad.h>
+
+//! Vertex buffer binding index the instanced VAOs read per-instance data from
+constexpr unsigned INSTANCE_BINDING = 8;
+
+/*! Ring of REGION_COUNT per-frame regions in one buffer. With GL 4.4 the
+ *  buffer is persistently and coherently mapped, so instance data is written
+ *  straight into GPU visible memory. A fence per region keeps the CPU from
+ *  overwriting data the GPU is still reading. Older contexts fall back to a
+ *  staging copy and glBufferSubData. */
+class InstanceBuffer {
+public:
+    bool Initialize( size_t Stride, size_t Capacity );
+    void Shutdown();
+
+    /**
+     * @brief Grows the buffer to at least Capacity instances, by half again
+     *        its size so a slowly rising count does not reallocate every frame.
+     *        Data written before the call is not kept.
+     */
+    bool Reserve( size_t Capacity );
+
+    /**
+     * @brief Waits until the GPU is done with the next region.
+     *
+     * @return void* Memory for up to Capacity instances of Stride bytes
+     */
+    void* BeginWrite();
+
+    /**
+     * @brief Makes the first Count written instances visible to the GPU.
+     */
+    void EndWrite( size_t Count );
+
+    /**
+     * @brief Binds the region written this frame to INSTANCE_BINDING of the
+     *        currently bound VAO.
+     */
+    void Bind() const;
+
+    /**
+     * @brief Fences the current region after the draws that read it and
+     *        advances the ring.
+     */
+    void Fence();
+
+    size_t GetCapacity() const;
+    size_t GetStride() const;
+    size_t GetMemory() const;
+    bool IsPersistent() const;
+
+    static constexpr unsigned REGION_COUNT = 3;
+
+private:
+    unsigned buffer = 0;
+    size_t stride = 0;
+    size_t capacity = 0;
+    size_t region_size = 0;
+
+    unsigned region = 0;
+    std::array< GLsync, REGION_COUNT > fences{};
+
+    char* mapped = nullptr;
+    std::vector< char > staging; //!< used when persistent mapping is unavailable
+    bool persistent = false;
+};
+
+#endif
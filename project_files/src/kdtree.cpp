@@ -10,9 +10,9 @@
 
 KDTree::KDTree() : head( nullptr ), memory_bank() {}
 
-KDTree::KDTree( std::unique_ptr< Verlet >* PointsList,
+KDTree::KDTree( const VerletArray* PointsList,
                 unsigned Size ) : head( nullptr ), points( PointsList ),
-                                  points_size( Size ), memory_bank() {}
+                                  points_size( Size ), memory_bank( static_cast< int >( Size ) ) {}
 
 KDTree::~KDTree() {
     ClearTree();
@@ -47,7 +47,7 @@ Node* KDTree::BuildNode( int* Indices, int PointsSize, int Depth ) {
     const int axis = Depth % 3;
 
     std::sort( Indices, Indices + PointsSize, [&]( const int idx1, const int idx2 ) {
-        return ( points[idx1] )->position[axis] < ( points[idx2] )->position[axis];
+        return ( *points )[idx1].position[axis] < ( *points )[idx2].position[axis];
     } );
 
     const int mid = ( PointsSize - 1 ) / 2;
@@ -84,7 +84,7 @@ void KDTree::SphereSearchNode( const Node* StartNode, vec4 SearchOrigin, float R
         return;
     }
 
-    const vec4 median = ( points[StartNode->idx] )->position;
+    const vec4 median = ( *points )[StartNode->idx].position;
 
     const float distSquared = vec_distance_squared( SearchOrigin, median );
     if ( distSquared < Radius * Radius ) {
@@ -4,16 +4,14 @@
 #pragma once
 
 // std includes
+#include <algorithm>
 #include <vector>
 #include <memory>
 #include <deque>
 
 // Local includes
 #include "math.hpp"
-
-#define BANK_SIZE 80000
-
-struct Verlet;
+#include "verlet.hpp"
 
 struct Node {
     Node() : axis( -1 ), idx( -1 ), left_child( nullptr ), right_child( nullptr ) {}
@@ -26,16 +24,15 @@ struct Node {
 
 class MemoryBank {
 public:
-    MemoryBank() : bank( BANK_SIZE ) {
-        for ( int i = 0; i < BANK_SIZE; ++i ) {
-            bank[i] = reinterpret_cast< Node* >( new char[sizeof( Node )] );
-        }
+    //! BankSize nodes are preallocated, every refill adds as many again
+    explicit MemoryBank( int BankSize = DEFAULT_BANK_SIZE ) : bank_size( std::max( BankSize, 1 ) ) {
+        Allocate();
     }
 
     ~MemoryBank() {
         int c = 0;
         for ( Node* to_delete : bank ) {
-            if ( ( BANK_SIZE - counter ) <= c ) {
+            if ( ( bank_size - counter ) <= c ) {
                 to_delete->~Node();
             }
             ++c;
@@ -44,7 +41,7 @@ public:
     }
 
     void Allocate() {
-        for ( int i = 0; i < BANK_SIZE; ++i ) {
+        for ( int i = 0; i < bank_size; ++i ) {
             bank.push_back( reinterpret_cast< Node* >( new char[sizeof( Node )] ) );
         }
     }
@@ -56,7 +53,7 @@ public:
 
         Node* front = bank.front();
         bank.pop_front();
-        if ( counter >= BANK_SIZE ) {
+        if ( counter >= bank_size ) {
             front->~Node();
         } else {
             ++counter;
@@ -69,14 +66,17 @@ public:
     }
 
 private:
+    static constexpr int DEFAULT_BANK_SIZE = 4096;
+
     std::deque< Node* > bank;
+    int bank_size;
     int counter = 0;
 };
 
 class KDTree {
 public:
     KDTree();
-    KDTree( std::unique_ptr< Verlet >* PointsList, unsigned Size );
+    KDTree( const VerletArray* PointsList, unsigned Size );
     ~KDTree();
 
     void BuildTree( unsigned Size );
@@ -92,7 +92,7 @@ private:
                            std::vector< int >& Targets );
 
     unsigned points_size;
-    std::unique_ptr< Verlet >* points;
+    const VerletArray* points;
     Node* head;
 
     MemoryBank memory_bank;
@@ -14,10 +14,17 @@
 #include "engine.hpp"
 #include "trace.hpp"
 #include "crash_handler.hpp"
+#include "model_manager.hpp"
 
-int main( int, char*[] ) {
+int main( int argc, char* argv[] ) {
     SetupDump();
 
+    // Usage: Super_Waddle --build-mesh-cache [models/file.obj ...]
+    if ( argc > 1 && std::string( argv[1] ) == "--build-mesh-cache" ) {
+        bool built = ModelManager::Instance().BuildMeshCaches( { argv + 2, argv + argc } );
+        return built ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     char dir[256];
     GetModuleFileName( nullptr, dir, 256 );
     Trace::Message( fmt::format( "{}", dir ) );
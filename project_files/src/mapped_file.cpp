@@ -0,0 +1,147 @@
+
+// System includes
+#if defined( _WIN32 )
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <fmt/core.h>
+
+// Local includes
+#include "mapped_file.hpp"
+#include "trace.hpp"
+
+#if defined( _WIN32 )
+MappedFile::MappedFile()
+    : data( nullptr ),
+      size( 0 ),
+      file_handle( INVALID_HANDLE_VALUE ),
+      mapping_handle( nullptr ) {
+}
+#else
+MappedFile::MappedFile()
+    : data( nullptr ),
+      size( 0 ) {
+}
+#endif
+
+MappedFile::~MappedFile() {
+    Close();
+}
+
+#if defined( _WIN32 )
+bool MappedFile::Open( const std::string& FileName ) {
+    Close();
+
+    file_handle = CreateFileA( FileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                               OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr );
+    if ( file_handle == INVALID_HANDLE_VALUE ) {
+        Trace::Message( fmt::format( "Unable to open {}.", FileName ) );
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    if ( !GetFileSizeEx( file_handle, &fileSize ) ) {
+        Trace::Message( fmt::format( "Unable to get size of {}.", FileName ) );
+        Close();
+        return false;
+    }
+
+    size = static_cast< size_t >( fileSize.QuadPart );
+    if ( size == 0 ) {
+        return true;
+    }
+
+    mapping_handle = CreateFileMappingA( file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr );
+    if ( !mapping_handle ) {
+        Trace::Message( fmt::format( "Unable to map {}.", FileName ) );
+        Close();
+        return false;
+    }
+
+    data = static_cast< const char* >( MapViewOfFile( mapping_handle, FILE_MAP_READ, 0, 0, 0 ) );
+    if ( !data ) {
+        Trace::Message( fmt::format( "Unable to map {}.", FileName ) );
+        Close();
+        return false;
+    }
+
+    return true;
+}
+
+void MappedFile::Close() {
+    if ( data ) {
+        UnmapViewOfFile( data );
+    }
+    if ( mapping_handle ) {
+        CloseHandle( mapping_handle );
+    }
+    if ( file_handle != INVALID_HANDLE_VALUE ) {
+        CloseHandle( file_handle );
+    }
+
+    data = nullptr;
+    size = 0;
+    mapping_handle = nullptr;
+    file_handle = INVALID_HANDLE_VALUE;
+}
+#else
+bool MappedFile::Open( const std::string& FileName ) {
+    Close();
+
+    int file = open( FileName.c_str(), O_RDONLY );
+    if ( file < 0 ) {
+        Trace::Message( fmt::format( "Unable to open {}.", FileName ) );
+        return false;
+    }
+
+    struct stat fileStat;
+    if ( fstat( file, &fileStat ) != 0 ) {
+        Trace::Message( fmt::format( "Unable to get size of {}.", FileName ) );
+        close( file );
+        return false;
+    }
+
+    size = static_cast< size_t >( fileStat.st_size );
+    if ( size == 0 ) {
+        close( file );
+        return true;
+    }
+
+    void* mapping = mmap( nullptr, size, PROT_READ, MAP_PRIVATE, file, 0 );
+    close( file );
+
+    if ( mapping == MAP_FAILED ) {
+        Trace::Message( fmt::format( "Unable to map {}.", FileName ) );
+        size = 0;
+        return false;
+    }
+
+    madvise( mapping, size, MADV_SEQUENTIAL );
+    data = static_cast< const char* >( mapping );
+
+    return true;
+}
+
+void MappedFile::Close() {
+    if ( data ) {
+        munmap( const_cast< char* >( data ), size );
+    }
+
+    data = nullptr;
+    size = 0;
+}
+#endif
+
+const char* MappedFile::Data() const {
+    return data;
+}
+
+size_t MappedFile::Size() const {
+    return size;
+}
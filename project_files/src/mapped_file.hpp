@@ -0,0 +1,42 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+#pragma once
+
+// std includes
+#include <cstddef>
+#include <string>
+
+/*! Read-only memory mapping of a file */
+class MappedFile {
+public:
+    MappedFile();
+    ~MappedFile();
+
+    MappedFile( const MappedFile& ) = delete;
+    MappedFile& operator=( const MappedFile& ) = delete;
+
+    /**
+     * @brief Maps the whole file into memory. An empty file maps to a null
+     *        pointer with a size of zero.
+     *
+     * @param FileName File to map
+     * @return true    File was opened and mapped
+     * @return false   File could not be opened or mapped
+     */
+    bool Open( const std::string& FileName );
+    void Close();
+
+    const char* Data() const;
+    size_t Size() const;
+
+private:
+    const char* data;
+    size_t size;
+
+#if defined( _WIN32 )
+    void* file_handle;
+    void* mapping_handle;
+#endif
+};
+
+#endif
@@ -5,7 +5,8 @@
 
 #include <xmmintrin.h>
 
-struct vec4 {
+//! Aligned so the SSE paths can load and store it with _mm_load_ps and _mm_store_ps
+struct alignas( 16 ) vec4 {
     vec4( float Value ) noexcept;
     vec4( float X, float Y, float Z, float W ) noexcept;
 
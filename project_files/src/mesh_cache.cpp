@@ -0,0 +1,198 @@
+
+// std includes
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+// System includes
+#include <fmt/core.h>
+
+// Local includes
+#include "mesh_cache.hpp"
+#include "model_manager.hpp"
+#include "trace.hpp"
+
+static constexpr char CACHE_MAGIC[4] = { 'S', 'W', 'M', 'C' };
+static constexpr const char* CACHE_EXTENSION = ".swmesh";
+
+static uint64_t Fnv1a( const char* Data, size_t Size ) {
+    uint64_t hash = 14695981039346656037ull;
+    for ( size_t i = 0; i < Size; ++i ) {
+        hash ^= static_cast< unsigned char >( Data[i] );
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+bool MeshCache::SourceInfo( const std::string& SourceFile, uint64_t& MTime, uint64_t& Size ) {
+    std::error_code error;
+
+    auto writeTime = std::filesystem::last_write_time( SourceFile, error );
+    if ( error ) {
+        return false;
+    }
+
+    Size = std::filesystem::file_size( SourceFile, error );
+    if ( error ) {
+        return false;
+    }
+
+    MTime = static_cast< uint64_t >( writeTime.time_since_epoch().count() );
+    return true;
+}
+
+bool MeshCache::HashSource( const std::string& SourceFile, uint64_t& Hash ) {
+    MappedFile source;
+    if ( !source.Open( SourceFile ) ) {
+        return false;
+    }
+
+    Hash = Fnv1a( source.Data(), source.Size() );
+    return true;
+}
+
+bool MeshCache::UpdateSourceTime( const std::string& CachePath, size_t Offset, uint64_t MTime ) {
+    std::fstream cache( CachePath, std::ios::binary | std::ios::in | std::ios::out );
+    if ( !cache.is_open() ) {
+        return false;
+    }
+
+    cache.seekp( static_cast< std::streamoff >( Offset ) );
+    cache.write( reinterpret_cast< const char* >( &MTime ), sizeof( MTime ) );
+    cache.close();
+
+    if ( !cache ) {
+        Trace::Message( fmt::format( "Unable to update {}.", CachePath ) );
+        return false;
+    }
+    return true;
+}
+
+std::string MeshCache::CachePath( const std::string& SourceFile ) {
+    return SourceFile + CACHE_EXTENSION;
+}
+
+bool MeshCache::Open( const std::string& SourceFile, uint32_t Flags ) {
+    Close();
+
+    const std::string cachePath = CachePath( SourceFile );
+    if ( !std::filesystem::exists( cachePath ) ) {
+        return false;
+    }
+
+    uint64_t mtime = 0;
+    uint64_t size = 0;
+    if ( !SourceInfo( SourceFile, mtime, size ) || !file.Open( cachePath ) ) {
+        return false;
+    }
+
+    if ( file.Size() < sizeof( MeshCacheHeader ) ) {
+        Close();
+        return false;
+    }
+
+    header = reinterpret_cast< const MeshCacheHeader* >( file.Data() );
+
+    const size_t expectedSize = sizeof( MeshCacheHeader ) +
+                                sizeof( float ) * header->stride * header->vertex_count +
+                                sizeof( unsigned ) * header->index_count;
+
+    if ( memcmp( header->magic, CACHE_MAGIC, sizeof( CACHE_MAGIC ) ) != 0 ||
+         header->version != VERSION || header->stride != STRIDE ||
+         header->flags != Flags || file.Size() != expectedSize ||
+         header->source_size != size ) {
+        Close();
+        return false;
+    }
+
+    if ( header->source_mtime != mtime ) {
+        // Touched (e.g. copied into the build tree) but possibly unchanged
+        uint64_t hash = 0;
+        if ( !HashSource( SourceFile, hash ) || hash != header->source_hash ) {
+            Close();
+            return false;
+        }
+
+        // Unchanged, the new mtime spares the next launch the hash. The mapping keeps the
+        // file from being written on Windows, so it is closed and mapped again.
+        Close();
+        UpdateSourceTime( cachePath, offsetof( MeshCacheHeader, source_mtime ), mtime );
+        if ( !file.Open( cachePath ) || file.Size() != expectedSize ) {
+            Close();
+            return false;
+        }
+        header = reinterpret_cast< const MeshCacheHeader* >( file.Data() );
+    }
+
+    return true;
+}
+
+void MeshCache::Close() {
+    file.Close();
+    header = nullptr;
+}
+
+const float* MeshCache::Vertices() const {
+    return reinterpret_cast< const float* >( file.Data() + sizeof( MeshCacheHeader ) );
+}
+
+const unsigned* MeshCache::Indices() const {
+    return reinterpret_cast< const unsigned* >( Vertices() + header->stride * header->vertex_count );
+}
+
+uint32_t MeshCache::VertexCount() const {
+    return header ? header->vertex_count : 0;
+}
+
+uint32_t MeshCache::IndexCount() const {
+    return header ? header->index_count : 0;
+}
+
+bool MeshCache::Write( const std::string& SourceFile, const MeshData& Data, uint32_t Flags ) {
+    MeshCacheHeader newHeader{};
+    memcpy( newHeader.magic, CACHE_MAGIC, sizeof( CACHE_MAGIC ) );
+    newHeader.version = VERSION;
+    newHeader.stride = STRIDE;
+    newHeader.vertex_count = static_cast< uint32_t >( Data.vertices.size() / STRIDE );
+    newHeader.index_count = static_cast< uint32_t >( Data.indices.size() );
+    newHeader.flags = Flags;
+
+    if ( !SourceInfo( SourceFile, newHeader.source_mtime, newHeader.source_size ) ||
+         !HashSource( SourceFile, newHeader.source_hash ) ) {
+        Trace::Message( fmt::format( "Unable to read {} for mesh cache.", SourceFile ) );
+        return false;
+    }
+
+    const std::string cachePath = CachePath( SourceFile );
+    const std::string tempPath = cachePath + ".tmp";
+
+    std::ofstream output( tempPath, std::ios::binary | std::ios::trunc );
+    if ( !output.is_open() ) {
+        Trace::Message( fmt::format( "Unable to write mesh cache {}.", cachePath ) );
+        return false;
+    }
+
+    output.write( reinterpret_cast< const char* >( &newHeader ), sizeof( newHeader ) );
+    output.write( reinterpret_cast< const char* >( Data.vertices.data() ),
+                  sizeof( float ) * Data.vertices.size() );
+    output.write( reinterpret_cast< const char* >( Data.indices.data() ),
+                  sizeof( unsigned ) * Data.indices.size() );
+    output.close();
+
+    if ( !output ) {
+        Trace::Message( fmt::format( "Unable to write mesh cache {}.", cachePath ) );
+        return false;
+    }
+
+    std::error_code error;
+    std::filesystem::rename( tempPath, cachePath, error );
+    if ( error ) {
+        Trace::Message( fmt::format( "Unable to replace mesh cache {}: {}", cachePath,
+                                     error.message() ) );
+        std::filesystem::remove( tempPath, error );
+        return false;
+    }
+
+    return true;
+}
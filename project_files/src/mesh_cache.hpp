@@ -0,0 +1,75 @@
+#ifndef MESH_CACHE_HPP
+#define MESH_CACHE_HPP
+#pragma once
+
+// std includes
+#include <cstdint>
+#include <string>
+
+// Local includes
+#include "mapped_file.hpp"
+
+struct MeshData;
+
+struct MeshCacheHeader {
+    char magic[4];          //!< "SWMC"
+    uint32_t version;       //!< MeshCache::VERSION
+    uint64_t source_mtime;  //!< last write time of the OBJ when the cache was built
+    uint64_t source_size;   //!< size of the OBJ in bytes
+    uint64_t source_hash;   //!< FNV-1a hash of the OBJ contents
+    uint32_t stride;        //!< floats per vertex
+    uint32_t vertex_count;  //!< vertices following the header
+    uint32_t index_count;   //!< indices following the vertices
+    uint32_t flags;         //!< MeshCache::FLAG_*
+};
+
+/*! Compiled, indexed mesh stored next to its OBJ as <file>.swmesh */
+class MeshCache {
+public:
+    /**
+     * @brief Maps the cache of SourceFile if it exists and still matches the
+     *        source. A changed mtime only invalidates the cache when the
+     *        source contents hash differently.
+     *
+     * @param SourceFile OBJ file the cache was built from
+     * @param Flags      Flags the cache must have been built with
+     * @return true      Cache is mapped and up to date
+     */
+    bool Open( const std::string& SourceFile, uint32_t Flags );
+    void Close();
+
+    const float* Vertices() const;
+    const unsigned* Indices() const;
+    uint32_t VertexCount() const;
+    uint32_t IndexCount() const;
+
+    /**
+     * @brief Writes the cache for SourceFile (via a temporary file and rename).
+     */
+    static bool Write( const std::string& SourceFile, const MeshData& Data, uint32_t Flags );
+
+    static std::string CachePath( const std::string& SourceFile );
+
+    //! Last write time and size of SourceFile, shared with the other caches built from OBJs
+    static bool SourceInfo( const std::string& SourceFile, uint64_t& MTime, uint64_t& Size );
+    static bool HashSource( const std::string& SourceFile, uint64_t& Hash );
+
+    /**
+     * @brief Overwrites the source mtime stored at Offset of the header of
+     *        CachePath, once the hash showed a touched source is unchanged.
+     *        The cache must not be mapped.
+     */
+    static bool UpdateSourceTime( const std::string& CachePath, size_t Offset, uint64_t MTime );
+
+    static constexpr uint32_t VERSION = 2;
+    static constexpr uint32_t FLAG_VERTEX_CACHE_OPTIMIZED = 1 << 0;
+
+private:
+    MappedFile file;
+    const MeshCacheHeader* header = nullptr;
+};
+
+static_assert( sizeof( MeshCacheHeader ) % sizeof( float ) == 0,
+               "Vertex data following the header must stay aligned" );
+
+#endif
@@ -0,0 +1,206 @@
+
+// std includes
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// Local includes
+#include "mesh_optimizer.hpp"
+
+namespace mesh_optimizer {
+// Scoring constants from Forsyth, "Linear-Speed Vertex Cache Optimisation"
+static constexpr float CACHE_DECAY_POWER = 1.5f;
+static constexpr float LAST_TRI_SCORE = 0.75f;
+static constexpr float VALENCE_BOOST_SCALE = 2.f;
+static constexpr float VALENCE_BOOST_POWER = 0.5f;
+
+static float VertexScore( int CachePosition, unsigned RemainingValence ) {
+    if ( RemainingValence == 0 ) {
+        return -1.f;
+    }
+
+    float score = 0.f;
+    if ( CachePosition >= 0 ) {
+        if ( CachePosition < 3 ) {
+            // Vertices of the triangle that was just added
+            score = LAST_TRI_SCORE;
+        } else {
+            const float scaler = 1.f / ( CACHE_SIZE - 3 );
+            score = 1.f - ( CachePosition - 3 ) * scaler;
+            score = std::pow( score, CACHE_DECAY_POWER );
+        }
+    }
+
+    // Boost vertices with few triangles left so they are finished off
+    score += VALENCE_BOOST_SCALE *
+             std::pow( static_cast< float >( RemainingValence ), -VALENCE_BOOST_POWER );
+
+    return score;
+}
+
+void OptimizeVertexCache( std::vector< unsigned >& Indices, unsigned VertexCount ) {
+    const unsigned triangleCount = static_cast< unsigned >( Indices.size() / 3 );
+    if ( triangleCount == 0 || VertexCount == 0 ) {
+        return;
+    }
+
+    // Vertex -> triangle adjacency
+    std::vector< unsigned > valence( VertexCount, 0 );
+    for ( unsigned index : Indices ) {
+        ++valence[index];
+    }
+
+    std::vector< unsigned > adjacencyOffset( VertexCount + 1, 0 );
+    for ( unsigned v = 0; v < VertexCount; ++v ) {
+        adjacencyOffset[v + 1] = adjacencyOffset[v] + valence[v];
+    }
+
+    std::vector< unsigned > adjacency( Indices.size() );
+    std::vector< unsigned > fill( adjacencyOffset.begin(), adjacencyOffset.end() - 1 );
+    for ( unsigned t = 0; t < triangleCount; ++t ) {
+        for ( unsigned c = 0; c < 3; ++c ) {
+            adjacency[fill[Indices[t * 3 + c]]++] = t;
+        }
+    }
+
+    std::vector< int > cachePosition( VertexCount, -1 );
+    std::vector< float > vertexScore( VertexCount );
+    for ( unsigned v = 0; v < VertexCount; ++v ) {
+        vertexScore[v] = VertexScore( -1, valence[v] );
+    }
+
+    std::vector< float > triangleScore( triangleCount );
+    std::vector< bool > triangleAdded( triangleCount, false );
+    for ( unsigned t = 0; t < triangleCount; ++t ) {
+        triangleScore[t] = vertexScore[Indices[t * 3]] +
+                           vertexScore[Indices[t * 3 + 1]] +
+                           vertexScore[Indices[t * 3 + 2]];
+    }
+
+    // Removes a finished triangle from the adjacency of its vertices
+    auto removeAdjacency = [&]( unsigned Vertex, unsigned Triangle ) {
+        unsigned* begin = adjacency.data() + adjacencyOffset[Vertex];
+        unsigned* end = begin + valence[Vertex];
+        unsigned* found = std::find( begin, end, Triangle );
+        std::swap( *found, *( end - 1 ) );
+        --valence[Vertex];
+    };
+
+    std::vector< unsigned > result;
+    result.reserve( Indices.size() );
+
+    // LRU cache, with room for the three vertices pushed in front of it
+    unsigned cache[CACHE_SIZE + 3];
+    unsigned cacheCount = 0;
+
+    int bestTriangle = -1;
+    unsigned scanCursor = 0;
+
+    for ( unsigned added = 0; added < triangleCount; ++added ) {
+        if ( bestTriangle < 0 ) {
+            // Nothing useful in the cache, take the best remaining triangle
+            float bestScore = -1.f;
+            for ( ; scanCursor < triangleCount && triangleAdded[scanCursor]; ++scanCursor ) {
+            }
+            for ( unsigned t = scanCursor; t < triangleCount; ++t ) {
+                if ( !triangleAdded[t] && triangleScore[t] > bestScore ) {
+                    bestScore = triangleScore[t];
+                    bestTriangle = static_cast< int >( t );
+                }
+            }
+        }
+
+        const unsigned triangle = static_cast< unsigned >( bestTriangle );
+        const unsigned* corners = &Indices[triangle * 3];
+
+        triangleAdded[triangle] = true;
+        result.insert( result.end(), corners, corners + 3 );
+
+        // Move the triangle's vertices to the front of the cache
+        unsigned newCache[CACHE_SIZE + 3];
+        unsigned newCount = 0;
+        for ( unsigned c = 0; c < 3; ++c ) {
+            newCache[newCount++] = corners[c];
+            removeAdjacency( corners[c], triangle );
+        }
+        for ( unsigned i = 0; i < cacheCount; ++i ) {
+            const unsigned v = cache[i];
+            if ( v != corners[0] && v != corners[1] && v != corners[2] ) {
+                newCache[newCount++] = v;
+            }
+        }
+
+        // Rescore everything that was or is in the cache
+        for ( unsigned i = 0; i < newCount; ++i ) {
+            const unsigned v = newCache[i];
+            cachePosition[v] = i < CACHE_SIZE ? static_cast< int >( i ) : -1;
+            const float newScore = VertexScore( cachePosition[v], valence[v] );
+            const float diff = newScore - vertexScore[v];
+            vertexScore[v] = newScore;
+
+            for ( unsigned a = 0; a < valence[v]; ++a ) {
+                triangleScore[adjacency[adjacencyOffset[v] + a]] += diff;
+            }
+        }
+
+        cacheCount = std::min( newCount, CACHE_SIZE );
+        std::memcpy( cache, newCache, cacheCount * sizeof( unsigned ) );
+
+        // Next triangle is the best one touching the cache
+        bestTriangle = -1;
+        float bestScore = -1.f;
+        for ( unsigned i = 0; i < cacheCount; ++i ) {
+            const unsigned v = cache[i];
+            for ( unsigned a = 0; a < valence[v]; ++a ) {
+                const unsigned t = adjacency[adjacencyOffset[v] + a];
+                if ( triangleScore[t] > bestScore ) {
+                    bestScore = triangleScore[t];
+                    bestTriangle = static_cast< int >( t );
+                }
+            }
+        }
+    }
+
+    Indices.swap( result );
+}
+
+void OptimizeVertexFetch( std::vector< float >& Vertices, std::vector< unsigned >& Indices,
+                          unsigned Stride ) {
+    const unsigned vertexCount = static_cast< unsigned >( Vertices.size() / Stride );
+    constexpr unsigned UNUSED = ~0u;
+
+    std::vector< unsigned > remap( vertexCount, UNUSED );
+    std::vector< float > result( Vertices.size() );
+    unsigned next = 0;
+
+    for ( unsigned& index : Indices ) {
+        if ( remap[index] == UNUSED ) {
+            std::copy_n( &Vertices[index * Stride], Stride, &result[next * Stride] );
+            remap[index] = next++;
+        }
+        index = remap[index];
+    }
+
+    result.resize( next * Stride );
+    Vertices.swap( result );
+}
+
+float AverageCacheMissRatio( const std::vector< unsigned >& Indices, unsigned VertexCount ) {
+    if ( Indices.empty() ) {
+        return 0.f;
+    }
+
+    std::vector< unsigned > timestamp( VertexCount, 0 );
+    unsigned time = CACHE_SIZE + 1;
+    unsigned misses = 0;
+
+    for ( unsigned index : Indices ) {
+        if ( time - timestamp[index] > CACHE_SIZE ) {
+            timestamp[index] = time++;
+            ++misses;
+        }
+    }
+
+    return static_cast< float >( misses ) / static_cast< float >( Indices.size() / 3 );
+}
+}; // namespace mesh_optimizer
@@ -0,0 +1,39 @@
+#ifndef MESH_OPTIMIZER_HPP
+#define MESH_OPTIMIZER_HPP
+#pragma once
+
+// std includes
+#include <vector>
+
+namespace mesh_optimizer {
+constexpr unsigned CACHE_SIZE = 32; //!< simulated post-transform cache entries
+
+/**
+ * @brief Reorders triangles for post-transform vertex cache reuse using
+ *        Forsyth's linear-speed greedy algorithm.
+ *
+ * @param Indices     Triangle list indices, reordered in place
+ * @param VertexCount Number of unique vertices referenced by Indices
+ */
+void OptimizeVertexCache( std::vector< unsigned >& Indices, unsigned VertexCount );
+
+/**
+ * @brief Reorders vertices into first-use order of the index buffer so that
+ *        vertex fetches walk memory linearly. Indices are remapped to match.
+ *
+ * @param Vertices Interleaved vertex data, reordered in place
+ * @param Indices  Triangle list indices, remapped in place
+ * @param Stride   Floats per vertex
+ */
+void OptimizeVertexFetch( std::vector< float >& Vertices, std::vector< unsigned >& Indices,
+                          unsigned Stride );
+
+/**
+ * @brief Average number of vertex shader invocations per triangle for a FIFO
+ *        cache of CACHE_SIZE entries (1.0 is optimal for large meshes, 3.0 is
+ *        the de-indexed worst case).
+ */
+float AverageCacheMissRatio( const std::vector< unsigned >& Indices, unsigned VertexCount );
+}; // namespace mesh_optimizer
+
+#endif
@@ -1,13 +1,21 @@
 
 // std includes
-#include <array>
+#include <algorithm>
+#include <cstddef>
+#include <filesystem>
 
 // System includes
 #include <glm/glm.hpp>
 #include <fmt/core.h>
+#include "imgui.h"
 
 // Local includes
 #include "model_manager.hpp"
+#include "instance_buffer.hpp"
+#include "mapped_file.hpp"
+#include "mesh_cache.hpp"
+#include "mesh_optimizer.hpp"
+#include "obj_parser.hpp"
 #include "trace.hpp"
 
 Mesh::Mesh() {
@@ -16,19 +24,39 @@ Mesh::Mesh() {
 Mesh::Mesh( std::string ModelFileName ) : model_file_name( ModelFileName ) {
 }
 
+Mesh::~Mesh() {
+    Release();
+}
+
+void Mesh::Release() {
+    unsigned buffers[2] = { VBO, EBO };
+    for ( unsigned buffer : buffers ) {
+        if ( buffer ) {
+            glDeleteBuffers( 1, &buffer );
+        }
+    }
+
+    if ( VAO ) {
+        glDeleteVertexArrays( 1, &VAO );
+    }
+
+    VAO = VBO = EBO = 0;
+    gpu_bytes = 0;
+}
+
 Model::Model()
     : mesh( nullptr ),
       render_method( GL_TRIANGLES ) {
 }
 
-Model::Model( Mesh* NewMesh, unsigned Shader )
-    : mesh( NewMesh ),
+Model::Model( std::shared_ptr< Mesh > NewMesh, unsigned Shader )
+    : mesh( std::move( NewMesh ) ),
       render_method( GL_TRIANGLES ),
       shader( Shader ) {
 }
 
-Model::Model( Mesh* NewMesh, unsigned RenderMethod, unsigned Shader )
-    : mesh( NewMesh ),
+Model::Model( std::shared_ptr< Mesh > NewMesh, unsigned RenderMethod, unsigned Shader )
+    : mesh( std::move( NewMesh ) ),
       render_method( RenderMethod ),
       shader( Shader ) {
 }
@@ -36,12 +64,12 @@ Model::Model( Mesh* NewMesh, unsigned RenderMethod, unsigned Shader )
 void Model::Draw() {
 }
 
-void Model::SetMesh( Mesh* NewMesh ) {
-    mesh = NewMesh;
+void Model::SetMesh( std::shared_ptr< Mesh > NewMesh ) {
+    mesh = std::move( NewMesh );
 }
 
 Mesh* Model::GetMesh() const {
-    return mesh;
+    return mesh.get();
 }
 
 void Model::SetRenderMethod( unsigned RenderMethod ) {
@@ -63,98 +91,144 @@ unsigned Model::GetShader() const {
 ModelManager::ModelManager() {
 }
 
-Model* ModelManager::GetModel( const std::string& ModelFileName, unsigned Shader, bool Instanced ) {
-    Mesh* mesh = GetMesh( ModelFileName, Instanced );
-    Model* model = new Model( mesh, Shader );
+size_t InstanceStride( InstanceFormat Format ) {
+    switch ( Format ) {
+    case InstanceFormat::Packed16:
+        return sizeof( PackedInstanceData );
+    case InstanceFormat::Float32:
+    default:
+        return sizeof( InstanceData );
+    }
+}
 
-    return model;
+std::unique_ptr< Model > ModelManager::GetModel( const std::string& ModelFileName, unsigned Shader,
+                                                 bool Instanced, InstanceFormat Format ) {
+    std::shared_ptr< Mesh > mesh = GetMesh( ModelFileName, Instanced, Format );
+    if ( !mesh ) {
+        return nullptr;
+    }
+
+    return std::make_unique< Model >( std::move( mesh ), Shader );
+}
+
+std::unique_ptr< Model > ModelManager::GetModel( const std::string& ModelFileName,
+                                                 unsigned RenderMethod, unsigned Shader,
+                                                 bool Instanced, InstanceFormat Format ) {
+    std::shared_ptr< Mesh > mesh = GetMesh( ModelFileName, Instanced, Format );
+    if ( !mesh ) {
+        return nullptr;
+    }
+
+    return std::make_unique< Model >( std::move( mesh ), RenderMethod, Shader );
 }
 
-Model* ModelManager::GetModel( const std::string& ModelFileName, unsigned RenderMethod,
-                               unsigned Shader, bool Instanced ) {
-    Mesh* mesh = GetMesh( ModelFileName, Instanced );
-    Model* model = new Model( mesh, RenderMethod, Shader );
+std::shared_ptr< Mesh > ModelManager::GetMesh( const std::string& ModelFileName, bool Instanced,
+                                               InstanceFormat Format ) {
+    if ( !Instanced ) {
+        Format = InstanceFormat::Float32;
+    }
+
+    const MeshKey key{ ModelFileName, Instanced, Format };
+
+    auto it = mesh_list.find( key );
+    if ( it != mesh_list.end() ) {
+        return it->second;
+    }
+
+    std::shared_ptr< Mesh > mesh = CreateMesh( ModelFileName, Instanced, Format );
+    if ( mesh ) {
+        mesh_list.insert( { key, mesh } );
+    }
 
-    return model;
+    return mesh;
 }
 
-std::vector< float >* ModelManager::LoadObj( const std::string& ModelFileName ) {
+MeshData* ModelManager::LoadObj( const std::string& ModelFileName ) {
     auto it = vertices_list.find( ModelFileName );
     if ( it != vertices_list.end() ) {
         return &it->second;
     }
 
-    FILE* file;
-    errno_t err = fopen_s( &file, ModelFileName.c_str(), "r" );
-    if ( err != 0 ) {
-        Trace::Message( fmt::format( "Unable to open {}.", ModelFileName ) );
+    MappedFile file;
+    if ( !file.Open( ModelFileName ) ) {
         return nullptr;
     }
 
+    ObjData data;
+    if ( !ObjParser::Parse( file.Data(), file.Size(), data ) ) {
+        Trace::Message( fmt::format( "{} references missing vertex data.", ModelFileName ) );
+    }
+
     auto vertIter = vertices_list.insert( { ModelFileName, {} } );
-    std::vector< float >* verticesList = &( vertIter.first )->second;
-
-    std::array< glm::vec3, VERTEX_LIMIT > v{};
-    std::array< glm::vec3, VERTEX_LIMIT > vt{};
-    std::array< glm::vec3, VERTEX_LIMIT > vn{};
-
-    int vCount = 0;
-    int vnCount = 0;
-    int vtCount = 0;
-
-    char line[64];
-    char* temp;
-    while ( fgets( line, 64, file ) ) {
-        char* words[4];
-        words[0] = strtok_s( line, " ", &temp );
-        for ( int i = 1; i < 4; ++i ) {
-            words[i] = strtok_s( nullptr, " ", &temp );
-        }
+    MeshData* meshData = &( vertIter.first )->second;
+
+    // One vertex per unique (v, vt, vn) triple
+    std::unordered_map< ObjCorner, unsigned, ObjCornerHash > uniqueCorners;
+    uniqueCorners.reserve( data.positions.size() * 2 );
+
+    meshData->indices.reserve( data.corners.size() );
+    meshData->vertices.reserve( data.positions.size() * 2 * STRIDE );
 
-        if ( strcmp( words[0], "v" ) == 0 ) {
-            v[vCount++] = { atof( words[1] ), atof( words[2] ), atof( words[3] ) };
-        } else if ( strcmp( words[0], "vt" ) == 0 ) {
-            vt[vtCount++] = { atof( words[1] ), atof( words[2] ), 0.f };
-        } else if ( strcmp( words[0], "vn" ) == 0 ) {
-            vn[vnCount++] = { atof( words[1] ), atof( words[2] ), atof( words[3] ) };
-        } else if ( strcmp( words[0], "f" ) == 0 ) {
-            char* v1[3];
-            char* v2[3];
-            char* v3[3];
-
-            v1[0] = strtok_s( words[1], "/", &temp );
-            v1[1] = strtok_s( nullptr, "/", &temp );
-            v1[2] = strtok_s( nullptr, "/", &temp );
-
-            v2[0] = strtok_s( words[2], "/", &temp );
-            v2[1] = strtok_s( nullptr, "/", &temp );
-            v2[2] = strtok_s( nullptr, "/", &temp );
-
-            v3[0] = strtok_s( words[3], "/", &temp );
-            v3[1] = strtok_s( nullptr, "/", &temp );
-            v3[2] = strtok_s( nullptr, "/", &temp );
-
-            InsertData( *verticesList, v1, v, vt, vn );
-            InsertData( *verticesList, v2, v, vt, vn );
-            InsertData( *verticesList, v3, v, vt, vn );
+    for ( const ObjCorner& corner : data.corners ) {
+        unsigned nextIndex = static_cast< unsigned >( uniqueCorners.size() );
+        auto [cornerIter, inserted] = uniqueCorners.try_emplace( corner, nextIndex );
+        if ( inserted ) {
+            InsertData( meshData->vertices, corner, data );
         }
+
+        meshData->indices.push_back( cornerIter->second );
     }
 
-    fclose( file );
+    if ( optimize_vertex_cache ) {
+        const unsigned vertexCount = static_cast< unsigned >( uniqueCorners.size() );
+        const float before = mesh_optimizer::AverageCacheMissRatio( meshData->indices, vertexCount );
+
+        mesh_optimizer::OptimizeVertexCache( meshData->indices, vertexCount );
+        mesh_optimizer::OptimizeVertexFetch( meshData->vertices, meshData->indices, STRIDE );
+
+        Trace::Message( fmt::format( "{}: {} vertices, {} triangles, ACMR {:.3f} -> {:.3f}",
+                                     ModelFileName, vertexCount, meshData->indices.size() / 3, before,
+                                     mesh_optimizer::AverageCacheMissRatio( meshData->indices,
+                                                                            vertexCount ) ) );
+    }
 
-    return verticesList;
+    return meshData;
 }
 
-Mesh* ModelManager::GetMesh( const std::string& ModelFileName, bool Instanced ) {
-    std::vector< float >* vertices = LoadObj( ModelFileName );
-    if ( !vertices ) {
-        return nullptr;
+std::shared_ptr< Mesh > ModelManager::CreateMesh( const std::string& ModelFileName,
+                                                  bool Instanced, InstanceFormat Format ) {
+    // Prefer the compiled cache, its contents are uploaded straight from the mapping
+    MeshCache cache;
+    const float* vertices = nullptr;
+    const unsigned* indices = nullptr;
+    size_t vertexCount = 0;
+    size_t indexCount = 0;
+
+    if ( cache.Open( ModelFileName, CacheFlags() ) ) {
+        vertices = cache.Vertices();
+        indices = cache.Indices();
+        vertexCount = cache.VertexCount();
+        indexCount = cache.IndexCount();
+    } else {
+        MeshData* meshData = LoadObj( ModelFileName );
+        if ( !meshData ) {
+            return nullptr;
+        }
+
+        MeshCache::Write( ModelFileName, *meshData, CacheFlags() );
+
+        vertices = meshData->vertices.data();
+        indices = meshData->indices.data();
+        vertexCount = meshData->vertices.size() / STRIDE;
+        indexCount = meshData->indices.size();
     }
 
-    Mesh* mesh = new Mesh( ModelFileName );
+    auto mesh = std::make_shared< Mesh >( ModelFileName );
 
     mesh->instanced = Instanced;
-    mesh->num_vertices = static_cast< int >( vertices->size() / STRIDE );
+    mesh->instance_format = Format;
+    mesh->num_vertices = static_cast< int >( vertexCount );
+    mesh->num_indices = static_cast< int >( indexCount );
 
     glGenVertexArrays( 1, &( mesh->VAO ) );
     glBindVertexArray( mesh->VAO );
@@ -162,7 +236,14 @@ Mesh* ModelManager::GetMesh( const std::string& ModelFileName, bool Instanced )
     glGenBuffers( 1, &( mesh->VBO ) );
 
     glBindBuffer( GL_ARRAY_BUFFER, mesh->VBO );
-    glBufferData( GL_ARRAY_BUFFER, sizeof( float ) * STRIDE * mesh->num_vertices, vertices->data(), GL_STATIC_DRAW );
+    glBufferData( GL_ARRAY_BUFFER, sizeof( float ) * STRIDE * mesh->num_vertices,
+                  vertices, GL_STATIC_DRAW );
+
+    // Element buffer binding is stored in the VAO
+    glGenBuffers( 1, &( mesh->EBO ) );
+    glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, mesh->EBO );
+    glBufferData( GL_ELEMENT_ARRAY_BUFFER, sizeof( unsigned ) * mesh->num_indices,
+                  indices, GL_STATIC_DRAW );
 
     // Position
     glEnableVertexAttribArray( 0 );
@@ -175,44 +256,200 @@ Mesh* ModelManager::GetMesh( const std::string& ModelFileName, bool Instanced )
     glVertexAttribPointer( 2, 2, GL_FLOAT, GL_FALSE, STRIDE * sizeof( float ), ( void* )24 );
 
     if ( Instanced ) {
-        // Position
-        glGenBuffers( 1, &( mesh->position_VBO ) );
-        glBindBuffer( GL_ARRAY_BUFFER, mesh->position_VBO );
-        glBufferData( GL_ARRAY_BUFFER, sizeof( float ) * INSTANCE_STRIDE * MAX_INSTANCES, NULL, GL_STREAM_DRAW );
+        // Instance data comes from whichever buffer is bound to INSTANCE_BINDING at draw time
         glEnableVertexAttribArray( 3 );
-        glVertexAttribPointer( 3, 3, GL_FLOAT, GL_FALSE, INSTANCE_STRIDE * sizeof( float ), ( void* )0 );
-        glVertexAttribDivisor( 3, 1 );
-
-        // Velocity
-        glGenBuffers( 1, &( mesh->velocity_VBO ) );
-        glBindBuffer( GL_ARRAY_BUFFER, mesh->velocity_VBO );
-        glBufferData( GL_ARRAY_BUFFER, sizeof( float ) * MAX_INSTANCES, NULL, GL_STREAM_DRAW );
         glEnableVertexAttribArray( 4 );
-        glVertexAttribPointer( 4, 1, GL_FLOAT, GL_FALSE, sizeof( float ), ( void* )0 );
-        glVertexAttribDivisor( 4, 1 );
+
+        switch ( Format ) {
+        case InstanceFormat::Float32:
+            // Position
+            glVertexAttribFormat( 3, 3, GL_FLOAT, GL_FALSE, offsetof( InstanceData, position ) );
+            // Velocity
+            glVertexAttribFormat( 4, 1, GL_FLOAT, GL_FALSE, offsetof( InstanceData, speed ) );
+            break;
+        case InstanceFormat::Packed16:
+            // Normalized to [-1, 1] and [0, 1], the shader scales them back
+            glVertexAttribFormat( 3, 3, GL_SHORT, GL_TRUE, offsetof( PackedInstanceData, position ) );
+            glVertexAttribFormat( 4, 1, GL_UNSIGNED_BYTE, GL_TRUE,
+                                  offsetof( PackedInstanceData, speed ) );
+            break;
+        }
+
+        glVertexAttribBinding( 3, INSTANCE_BINDING );
+        glVertexAttribBinding( 4, INSTANCE_BINDING );
+
+        glVertexBindingDivisor( INSTANCE_BINDING, 1 );
     }
 
     glBindBuffer( GL_ARRAY_BUFFER, 0 );
 
     glBindVertexArray( 0 );
 
+    mesh->gpu_bytes = sizeof( float ) * STRIDE * mesh->num_vertices +
+                      sizeof( unsigned ) * mesh->num_indices;
+
     return mesh;
 }
 
-void ModelManager::InsertData( std::vector< float >& vertices, char* data[3],
-                               std::array< glm::vec3, VERTEX_LIMIT >& v,
-                               std::array< glm::vec3, VERTEX_LIMIT >& vt,
-                               std::array< glm::vec3, VERTEX_LIMIT >& vn ) {
-    vertices.push_back( v[atoi( data[0] ) - 1].x );
-    vertices.push_back( v[atoi( data[0] ) - 1].y );
-    vertices.push_back( v[atoi( data[0] ) - 1].z );
+void ModelManager::InsertData( std::vector< float >& Vertices, const ObjCorner& Corner,
+                               const ObjData& Data ) {
+    const glm::vec3 position = Corner.v >= 0 ? Data.positions[Corner.v] : glm::vec3( 0.f );
+    const glm::vec3 normal = Corner.vn >= 0 ? Data.normals[Corner.vn] : glm::vec3( 0.f );
+    const glm::vec2 texCoord = Corner.vt >= 0 ? Data.tex_coords[Corner.vt] : glm::vec2( 0.f );
 
-    vertices.push_back( vn[atoi( data[2] ) - 1].x );
-    vertices.push_back( vn[atoi( data[2] ) - 1].y );
-    vertices.push_back( vn[atoi( data[2] ) - 1].z );
+    Vertices.push_back( position.x );
+    Vertices.push_back( position.y );
+    Vertices.push_back( position.z );
+
+    Vertices.push_back( normal.x );
+    Vertices.push_back( normal.y );
+    Vertices.push_back( normal.z );
+
+    Vertices.push_back( texCoord.x );
+    Vertices.push_back( texCoord.y );
+}
+
+bool ModelManager::GetTriangles( const std::string& ModelFileName,
+                                 std::vector< glm::vec3 >& Positions,
+                                 std::vector< unsigned >& Indices ) {
+    MeshCache cache;
+    const float* vertices = nullptr;
+    size_t vertexCount = 0;
+
+    if ( cache.Open( ModelFileName, CacheFlags() ) ) {
+        vertices = cache.Vertices();
+        vertexCount = cache.VertexCount();
+        Indices.assign( cache.Indices(), cache.Indices() + cache.IndexCount() );
+    } else {
+        MeshData* meshData = LoadObj( ModelFileName );
+        if ( !meshData ) {
+            return false;
+        }
+
+        vertices = meshData->vertices.data();
+        vertexCount = meshData->vertices.size() / STRIDE;
+        Indices = meshData->indices;
+    }
+
+    Positions.resize( vertexCount );
+    for ( size_t i = 0; i < vertexCount; ++i ) {
+        Positions[i] = { vertices[i * STRIDE], vertices[i * STRIDE + 1], vertices[i * STRIDE + 2] };
+    }
+
+    return true;
+}
+
+bool ModelManager::BuildMeshCaches( std::vector< std::string > ModelFileNames ) {
+    if ( ModelFileNames.empty() ) {
+        std::error_code error;
+        for ( const auto& entry : std::filesystem::directory_iterator( "models", error ) ) {
+            if ( entry.path().extension() == ".obj" ) {
+                ModelFileNames.push_back( entry.path().generic_string() );
+            }
+        }
+    }
+
+    bool result = true;
+    for ( const std::string& fileName : ModelFileNames ) {
+        MeshData* meshData = LoadObj( fileName );
+        if ( !meshData || !MeshCache::Write( fileName, *meshData, CacheFlags() ) ) {
+            result = false;
+            continue;
+        }
+
+        Trace::Message( fmt::format( "Built {}", MeshCache::CachePath( fileName ) ) );
+    }
+
+    return result;
+}
+
+const char* ModelManager::InstanceLabel( const MeshKey& Key ) {
+    if ( !Key.instanced ) {
+        return "";
+    }
+
+    return Key.format == InstanceFormat::Packed16 ? " (instanced, packed)" : " (instanced)";
+}
+
+void ModelManager::ReleaseUnused() {
+    for ( auto it = mesh_list.begin(); it != mesh_list.end(); ) {
+        // Only the cache itself still holds the mesh
+        if ( it->second.use_count() == 1 ) {
+            Trace::Message( fmt::format( "Releasing {}{}", it->first.model_file_name,
+                                         InstanceLabel( it->first ) ) );
+            it = mesh_list.erase( it );
+        } else {
+            ++it;
+        }
+    }
+
+    for ( auto it = vertices_list.begin(); it != vertices_list.end(); ) {
+        bool used = std::any_of( mesh_list.begin(), mesh_list.end(), [&]( const auto& Entry ) {
+            return Entry.first.model_file_name == it->first;
+        } );
+        it = used ? std::next( it ) : vertices_list.erase( it );
+    }
+}
+
+void ModelManager::Shutdown() {
+    // Models that outlive this only keep a mesh without GL objects
+    for ( auto& [key, mesh] : mesh_list ) {
+        mesh->Release();
+    }
+
+    mesh_list.clear();
+    vertices_list.clear();
+}
+
+size_t ModelManager::GetGpuMemory() const {
+    size_t total = 0;
+    for ( const auto& [key, mesh] : mesh_list ) {
+        total += mesh->gpu_bytes;
+    }
+    return total;
+}
+
+size_t ModelManager::GetCpuMemory() const {
+    size_t total = 0;
+    for ( const auto& [key, meshData] : vertices_list ) {
+        total += sizeof( float ) * meshData.vertices.capacity() +
+                 sizeof( unsigned ) * meshData.indices.capacity();
+    }
+    return total;
+}
+
+void ModelManager::DisplayMenu() {
+    ImGui::Begin( "Resources##1" );
+
+    ImGui::Text( fmt::format( "Meshes: {}", mesh_list.size() ).c_str() );
+    ImGui::Text( fmt::format( "GPU memory: {:.1f} KB", GetGpuMemory() / 1024.f ).c_str() );
+    ImGui::Text( fmt::format( "Parsed geometry: {:.1f} KB", GetCpuMemory() / 1024.f ).c_str() );
+
+    ImGui::Separator();
+
+    for ( const auto& [key, mesh] : mesh_list ) {
+        ImGui::Text( fmt::format( "{}{} | users {} | {} verts | {} tris | {:.1f} KB",
+                                  key.model_file_name, InstanceLabel( key ),
+                                  mesh.use_count() - 1, mesh->num_vertices, mesh->num_indices / 3,
+                                  mesh->gpu_bytes / 1024.f )
+                         .c_str() );
+    }
+
+    ImGui::Separator();
+
+    if ( ImGui::Button( "Release unused##1" ) ) {
+        ReleaseUnused();
+    }
+
+    ImGui::End();
+}
+
+uint32_t ModelManager::CacheFlags() const {
+    return optimize_vertex_cache ? MeshCache::FLAG_VERTEX_CACHE_OPTIMIZED : 0;
+}
 
-    vertices.push_back( vt[atoi( data[1] ) - 1].x );
-    vertices.push_back( vt[atoi( data[1] ) - 1].y );
+void ModelManager::SetOptimizeVertexCache( bool OptimizeVertexCache ) {
+    optimize_vertex_cache = OptimizeVertexCache;
 }
 
 ModelManager& ModelManager::Instance() {
@@ -4,38 +4,81 @@
 #pragma once
 
 // std includes
+#include <cstdint>
+#include <memory>
 #include <unordered_map>
 #include <string>
+#include <vector>
 
 // System includes
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
-constexpr unsigned VERTEX_LIMIT = 2000;
+struct ObjCorner;
+struct ObjData;
+
 constexpr unsigned STRIDE = 8;
-constexpr unsigned INSTANCE_STRIDE = 3;
-constexpr unsigned MAX_INSTANCES = 80000;
+
+//! Per-instance attributes read through INSTANCE_BINDING
+struct InstanceData {
+    float position[3];
+    float speed;
+};
+
+/*! Packed instance attributes. The position is normalized to the extent of
+ *  the container and the speed to PACKED_SPEED_RANGE, instance_vertex.glsl
+ *  scales both back with the instanceExtent and speedScale uniforms. */
+struct PackedInstanceData {
+    int16_t position[3];
+    uint8_t speed;
+    uint8_t padding;
+};
+
+static_assert( sizeof( PackedInstanceData ) == 8, "Packed instances must stay 8 bytes" );
+
+constexpr float PACKED_SPEED_RANGE = 2.f;
+
+enum class InstanceFormat {
+    Float32, //!< InstanceData
+    Packed16, //!< PackedInstanceData
+};
+
+size_t InstanceStride( InstanceFormat Format );
+
+struct MeshData {
+    std::vector< float > vertices; //!< interleaved position, normal and texture coordinates
+    std::vector< unsigned > indices;
+};
 
 struct Mesh {
     Mesh();
     Mesh( std::string ModelFileName );
+    ~Mesh();
+
+    Mesh( const Mesh& ) = delete;
+    Mesh& operator=( const Mesh& ) = delete;
+
+    //! Deletes the GL objects, safe to call more than once
+    void Release();
 
     std::string model_file_name;
-    int num_vertices;
-    unsigned VAO;
-    unsigned VBO;
-    unsigned position_VBO;
-    unsigned velocity_VBO;
-    bool instanced;
+    int num_vertices = 0;
+    int num_indices = 0;
+    unsigned VAO = 0;
+    unsigned VBO = 0;
+    unsigned EBO = 0;
+    size_t gpu_bytes = 0; //!< size of every buffer owned by the mesh
+    bool instanced = false;
+    InstanceFormat instance_format = InstanceFormat::Float32;
 };
 
 class Model {
 public:
-    Model( Mesh* NewMesh, unsigned Shader );
-    Model( Mesh* NewMesh, unsigned RenderMethod, unsigned Shader );
+    Model( std::shared_ptr< Mesh > NewMesh, unsigned Shader );
+    Model( std::shared_ptr< Mesh > NewMesh, unsigned RenderMethod, unsigned Shader );
     void Draw();
 
-    void SetMesh( Mesh* NewMesh );
+    void SetMesh( std::shared_ptr< Mesh > NewMesh );
     Mesh* GetMesh() const;
 
     void SetRenderMethod( unsigned RenderMethod );
@@ -46,32 +89,86 @@ public:
 
 private:
     Model();
-    Mesh* mesh;
+    std::shared_ptr< Mesh > mesh;
     unsigned render_method;
     unsigned shader;
 };
 
 class ModelManager {
 public:
-    Model* GetModel( const std::string& ModelFileName, unsigned Shader, bool Instanced );
-    Model* GetModel( const std::string& ModelFileName, unsigned RenderMethod,
-                     unsigned Shader, bool Instanced );
+    std::unique_ptr< Model > GetModel( const std::string& ModelFileName, unsigned Shader,
+                                       bool Instanced,
+                                       InstanceFormat Format = InstanceFormat::Float32 );
+    std::unique_ptr< Model > GetModel( const std::string& ModelFileName, unsigned RenderMethod,
+                                       unsigned Shader, bool Instanced,
+                                       InstanceFormat Format = InstanceFormat::Float32 );
+
+    /**
+     * @brief Parses the given OBJ files (every .obj in models/ when empty) and
+     *        writes their compiled mesh caches. Does not need a GL context.
+     *
+     * @return true when every cache was written
+     */
+    bool BuildMeshCaches( std::vector< std::string > ModelFileNames );
+
+    /**
+     * @brief Positions and triangle indices of an OBJ, read from its mesh cache
+     *        when it is up to date. Does not need a GL context.
+     */
+    bool GetTriangles( const std::string& ModelFileName, std::vector< glm::vec3 >& Positions,
+                       std::vector< unsigned >& Indices );
+
+    //! Evicts meshes and parsed geometry no Model is using anymore
+    void ReleaseUnused();
+
+    //! Releases every GL object, must run while the context is still alive
+    void Shutdown();
+
+    size_t GetGpuMemory() const;
+    size_t GetCpuMemory() const;
+
+    void DisplayMenu();
+
+    void SetOptimizeVertexCache( bool OptimizeVertexCache );
 
     static ModelManager& Instance();
 
 private:
     ModelManager();
 
-    Mesh* GetMesh( const std::string& ModelFileName, bool Instanced );
+    struct MeshKey {
+        std::string model_file_name;
+        bool instanced;
+        InstanceFormat format; //!< always Float32 for meshes that are not instanced
+
+        bool operator==( const MeshKey& Rhs ) const = default;
+    };
+
+    struct MeshKeyHash {
+        size_t operator()( const MeshKey& Key ) const noexcept {
+            return std::hash< std::string >{}( Key.model_file_name ) ^
+                   ( static_cast< size_t >( Key.instanced ) | static_cast< size_t >( Key.format ) << 1 );
+        }
+    };
+
+    static const char* InstanceLabel( const MeshKey& Key );
+
+    std::shared_ptr< Mesh > GetMesh( const std::string& ModelFileName, bool Instanced,
+                                     InstanceFormat Format );
+    std::shared_ptr< Mesh > CreateMesh( const std::string& ModelFileName, bool Instanced,
+                                        InstanceFormat Format );
+
+    MeshData* LoadObj( const std::string& ModelFileName );
+
+    void InsertData( std::vector< float >& Vertices, const ObjCorner& Corner,
+                     const ObjData& Data );
 
-    std::vector< float >* LoadObj( const std::string& ModelFileName );
+    std::unordered_map< std::string, MeshData > vertices_list;
+    std::unordered_map< MeshKey, std::shared_ptr< Mesh >, MeshKeyHash > mesh_list;
 
-    void InsertData( std::vector< float >& vertices, char* data[3],
-                     std::array< glm::vec3, VERTEX_LIMIT >& v,
-                     std::array< glm::vec3, VERTEX_LIMIT >& vt,
-                     std::array< glm::vec3, VERTEX_LIMIT >& vn );
+    uint32_t CacheFlags() const;
 
-    std::unordered_map< std::string, std::vector< float > > vertices_list;
+    bool optimize_vertex_cache = true;
 };
 
 #endif
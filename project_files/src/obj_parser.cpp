@@ -0,0 +1,251 @@
+
+// std includes
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <thread>
+
+// Local includes
+#include "obj_parser.hpp"
+
+static constexpr int MISSING_INDEX = std::numeric_limits< int >::min();
+
+static inline bool IsSpace( char C ) {
+    return C == ' ' || C == '\t' || C == '\r';
+}
+
+static inline const char* SkipSpace( const char* Curr, const char* End ) {
+    while ( Curr < End && IsSpace( *Curr ) ) {
+        ++Curr;
+    }
+    return Curr;
+}
+
+static inline const char* SkipToken( const char* Curr, const char* End ) {
+    while ( Curr < End && !IsSpace( *Curr ) ) {
+        ++Curr;
+    }
+    return Curr;
+}
+
+static inline const char* ParseFloat( const char* Curr, const char* End, float& Value ) {
+    Curr = SkipSpace( Curr, End );
+    if ( Curr < End && *Curr == '+' ) {
+        ++Curr;
+    }
+
+    auto [ptr, ec] = std::from_chars( Curr, End, Value );
+    if ( ec != std::errc() ) {
+        Value = 0.f;
+        return SkipToken( Curr, End );
+    }
+
+    return ptr;
+}
+
+void ObjParser::ParseChunk( Chunk& CurrChunk ) {
+    const char* curr = CurrChunk.begin;
+    const char* end = CurrChunk.end;
+
+    RawCorner first{};
+    RawCorner prev{};
+
+    while ( curr < end ) {
+        const char* lineEnd = static_cast< const char* >( memchr( curr, '\n', end - curr ) );
+        if ( !lineEnd ) {
+            lineEnd = end;
+        }
+
+        curr = SkipSpace( curr, lineEnd );
+        const ptrdiff_t length = lineEnd - curr;
+
+        if ( length >= 2 && curr[0] == 'v' && IsSpace( curr[1] ) ) {
+            glm::vec3& position = CurrChunk.positions.emplace_back();
+            const char* token = curr + 1;
+            for ( int i = 0; i < 3; ++i ) {
+                token = ParseFloat( token, lineEnd, position[i] );
+            }
+        } else if ( length >= 3 && curr[0] == 'v' && curr[1] == 't' && IsSpace( curr[2] ) ) {
+            glm::vec2& texCoord = CurrChunk.tex_coords.emplace_back();
+            const char* token = curr + 2;
+            for ( int i = 0; i < 2; ++i ) {
+                token = ParseFloat( token, lineEnd, texCoord[i] );
+            }
+        } else if ( length >= 3 && curr[0] == 'v' && curr[1] == 'n' && IsSpace( curr[2] ) ) {
+            glm::vec3& normal = CurrChunk.normals.emplace_back();
+            const char* token = curr + 2;
+            for ( int i = 0; i < 3; ++i ) {
+                token = ParseFloat( token, lineEnd, normal[i] );
+            }
+        } else if ( length >= 2 && curr[0] == 'f' && IsSpace( curr[1] ) ) {
+            const int counts[3] = { static_cast< int >( CurrChunk.positions.size() ),
+                                    static_cast< int >( CurrChunk.tex_coords.size() ),
+                                    static_cast< int >( CurrChunk.normals.size() ) };
+
+            const char* token = SkipSpace( curr + 1, lineEnd );
+            int cornerCount = 0;
+
+            while ( token < lineEnd ) {
+                RawCorner corner{ { MISSING_INDEX, MISSING_INDEX, MISSING_INDEX }, 0 };
+
+                // v, v/vt, v//vn or v/vt/vn
+                for ( int n = 0; n < 3 && token < lineEnd && !IsSpace( *token ); ++n ) {
+                    if ( *token != '/' ) {
+                        int value = 0;
+                        auto [ptr, ec] = std::from_chars( token, lineEnd, value );
+                        token = ptr;
+
+                        if ( ec == std::errc() && value > 0 ) {
+                            corner.index[n] = value - 1;
+                        } else if ( ec == std::errc() && value < 0 ) {
+                            corner.index[n] = counts[n] + value;
+                            corner.relative |= static_cast< unsigned char >( 1 << n );
+                        }
+                    }
+
+                    if ( token < lineEnd && *token == '/' ) {
+                        ++token;
+                    } else {
+                        break;
+                    }
+                }
+
+                token = SkipSpace( SkipToken( token, lineEnd ), lineEnd );
+
+                // Fan triangulation around the first corner
+                if ( cornerCount == 0 ) {
+                    first = corner;
+                } else if ( cornerCount >= 2 ) {
+                    CurrChunk.corners.push_back( first );
+                    CurrChunk.corners.push_back( prev );
+                    CurrChunk.corners.push_back( corner );
+                }
+
+                prev = corner;
+                ++cornerCount;
+            }
+        }
+
+        curr = lineEnd < end ? lineEnd + 1 : end;
+    }
+}
+
+void ObjParser::ResolveChunk( Chunk& CurrChunk, ObjData& Result ) {
+    std::copy( CurrChunk.positions.begin(), CurrChunk.positions.end(),
+               Result.positions.begin() + CurrChunk.base[0] );
+    std::copy( CurrChunk.tex_coords.begin(), CurrChunk.tex_coords.end(),
+               Result.tex_coords.begin() + CurrChunk.base[1] );
+    std::copy( CurrChunk.normals.begin(), CurrChunk.normals.end(),
+               Result.normals.begin() + CurrChunk.base[2] );
+
+    const int totals[3] = { static_cast< int >( Result.positions.size() ),
+                            static_cast< int >( Result.tex_coords.size() ),
+                            static_cast< int >( Result.normals.size() ) };
+
+    CurrChunk.invalid = 0;
+
+    for ( size_t i = 0; i < CurrChunk.corners.size(); ++i ) {
+        const RawCorner& raw = CurrChunk.corners[i];
+        int resolved[3];
+
+        for ( int n = 0; n < 3; ++n ) {
+            if ( raw.index[n] == MISSING_INDEX ) {
+                resolved[n] = -1;
+                continue;
+            }
+
+            resolved[n] = raw.index[n];
+            if ( raw.relative & ( 1 << n ) ) {
+                resolved[n] += CurrChunk.base[n];
+            }
+
+            if ( resolved[n] < 0 || resolved[n] >= totals[n] ) {
+                resolved[n] = -1;
+                ++CurrChunk.invalid;
+            }
+        }
+
+        Result.corners[CurrChunk.corner_offset + i] = { resolved[0], resolved[1], resolved[2] };
+    }
+}
+
+bool ObjParser::Parse( const char* Data, size_t Size, ObjData& Result ) {
+    Result = ObjData{};
+
+    if ( !Data || Size == 0 ) {
+        return true;
+    }
+
+    const size_t threadLimit = std::max( 1u, std::thread::hardware_concurrency() );
+    const size_t chunkCount = std::clamp< size_t >( Size / CHUNK_SIZE, 1, threadLimit );
+
+    // Split on line boundaries
+    std::vector< Chunk > chunks( chunkCount );
+    const char* end = Data + Size;
+    const char* curr = Data;
+    for ( size_t i = 0; i < chunkCount; ++i ) {
+        const char* split = ( i == chunkCount - 1 ) ? end : Data + ( i + 1 ) * ( Size / chunkCount );
+        split = std::max( split, curr );
+
+        if ( split < end ) {
+            const char* newLine = static_cast< const char* >( memchr( split, '\n', end - split ) );
+            split = newLine ? newLine + 1 : end;
+        }
+
+        chunks[i].begin = curr;
+        chunks[i].end = split;
+        curr = split;
+    }
+
+    std::vector< std::thread > threads;
+
+    if ( chunkCount == 1 ) {
+        ParseChunk( chunks[0] );
+    } else {
+        for ( Chunk& chunk : chunks ) {
+            threads.emplace_back( &ObjParser::ParseChunk, std::ref( chunk ) );
+        }
+        for ( std::thread& thd : threads ) {
+            thd.join();
+        }
+        threads.clear();
+    }
+
+    // Offsets of each chunk in the merged attribute lists
+    int base[3] = { 0, 0, 0 };
+    size_t cornerCount = 0;
+    for ( Chunk& chunk : chunks ) {
+        std::copy( base, base + 3, chunk.base );
+        chunk.corner_offset = cornerCount;
+
+        base[0] += static_cast< int >( chunk.positions.size() );
+        base[1] += static_cast< int >( chunk.tex_coords.size() );
+        base[2] += static_cast< int >( chunk.normals.size() );
+        cornerCount += chunk.corners.size();
+    }
+
+    Result.positions.resize( base[0] );
+    Result.tex_coords.resize( base[1] );
+    Result.normals.resize( base[2] );
+    Result.corners.resize( cornerCount );
+
+    if ( chunkCount == 1 ) {
+        ResolveChunk( chunks[0], Result );
+    } else {
+        for ( Chunk& chunk : chunks ) {
+            threads.emplace_back( &ObjParser::ResolveChunk, std::ref( chunk ), std::ref( Result ) );
+        }
+        for ( std::thread& thd : threads ) {
+            thd.join();
+        }
+    }
+
+    unsigned invalid = 0;
+    for ( const Chunk& chunk : chunks ) {
+        invalid += chunk.invalid;
+    }
+
+    return invalid == 0;
+}
@@ -0,0 +1,81 @@
+#ifndef OBJ_PARSER_HPP
+#define OBJ_PARSER_HPP
+#pragma once
+
+// std includes
+#include <cstddef>
+#include <vector>
+
+// System includes
+#include <glm/glm.hpp>
+
+//! Attribute indices of one triangle corner (zero based, -1 when absent)
+struct ObjCorner {
+    int v = -1;
+    int vt = -1;
+    int vn = -1;
+};
+
+inline bool operator==( const ObjCorner& Lhs, const ObjCorner& Rhs ) noexcept {
+    return Lhs.v == Rhs.v && Lhs.vt == Rhs.vt && Lhs.vn == Rhs.vn;
+}
+
+struct ObjCornerHash {
+    size_t operator()( const ObjCorner& Corner ) const noexcept {
+        size_t hash = static_cast< size_t >( Corner.v ) * 73856093u;
+        hash ^= static_cast< size_t >( Corner.vt ) * 19349663u;
+        hash ^= static_cast< size_t >( Corner.vn ) * 83492791u;
+        return hash;
+    }
+};
+
+struct ObjData {
+    std::vector< glm::vec3 > positions;
+    std::vector< glm::vec2 > tex_coords;
+    std::vector< glm::vec3 > normals;
+    std::vector< ObjCorner > corners; //!< three corners per triangle
+};
+
+/*! Parses Wavefront OBJ text that is already in memory (e.g. a MappedFile) */
+class ObjParser {
+public:
+    /**
+     * @brief Parses v/vt/vn/f records. Polygons are fan triangulated and
+     *        negative (relative) indices are resolved. Large inputs are split
+     *        on line boundaries and parsed on multiple threads.
+     *
+     * @param Data   Start of the OBJ text
+     * @param Size   Size of the text in bytes
+     * @param Result Parsed attributes and triangle corners
+     * @return true  Every face index referenced an existing attribute
+     * @return false At least one index was out of range (it was set to -1)
+     */
+    static bool Parse( const char* Data, size_t Size, ObjData& Result );
+
+    static constexpr size_t CHUNK_SIZE = 1 << 20; //!< minimum bytes per parsing thread
+
+private:
+    struct RawCorner {
+        int index[3];
+        unsigned char relative; //!< bit n set when index[n] is relative to the chunk
+    };
+
+    struct Chunk {
+        const char* begin;
+        const char* end;
+
+        std::vector< glm::vec3 > positions;
+        std::vector< glm::vec2 > tex_coords;
+        std::vector< glm::vec3 > normals;
+        std::vector< RawCorner > corners;
+
+        int base[3]; //!< attribute counts of all previous chunks
+        size_t corner_offset;
+        unsigned invalid;
+    };
+
+    static void ParseChunk( Chunk& CurrChunk );
+    static void ResolveChunk( Chunk& CurrChunk, ObjData& Result );
+};
+
+#endif
@@ -1,90 +1,502 @@
 
 // std includes
 #include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
 
 // Local includes
 #include "octree.hpp"
+#include "thread_pool.hpp"
 #include "math.hpp"
 
 Octree::Octree() {
     THREAD_COUNT = std::thread::hardware_concurrency();
-    for ( int i = 0; i < THREAD_COUNT; ++i ) {
-        threads.emplace_back();
+    thread_columns.resize( THREAD_COUNT + 1 );
+    thread_busy.resize( THREAD_COUNT );
+    thread_moves.resize( THREAD_COUNT );
+    thread_sleeping_cells.resize( THREAD_COUNT );
+    thread_penetration.resize( THREAD_COUNT );
+}
+
+void Octree::SetThreadPool( ThreadPool* Pool ) noexcept {
+    thread_pool = Pool;
+}
+
+void Octree::SetBounds( float Extent, float Radius ) {
+    const int halfDim = static_cast< int >( std::ceil( Extent / ( Radius * 2 ) ) ) + 2;
+    if ( halfDim * 2 == dim ) {
+        return;
     }
+
+    dim = halfDim * 2;
+    PlaceGrid();
 }
 
-void Octree::FillTree( std::array< std::unique_ptr< Verlet >, VerletManager::MAX >& Verlets,
-                       float Radius, unsigned CurrCount ) noexcept {
+void Octree::SetThreadNodes( const std::vector< int >& Nodes ) {
+    thread_nodes = Nodes;
+    dim = 0;
+}
+
+void Octree::PlaceGrid() {
+    grid_size = static_cast< size_t >( dim ) * dim * dim * CELL_MAX;
+    collision_grid.reset();
+    collision_grid = std::make_unique_for_overwrite< Verlet*[] >( grid_size );
+    column_counts.assign( static_cast< size_t >( dim ) * dim, 0 );
+    cell_counts.assign( static_cast< size_t >( dim ) * dim * dim, 0 );
+    cell_awake.assign( static_cast< size_t >( dim ) * dim * dim, 0 );
+    cell_woken.assign( static_cast< size_t >( dim ) * dim * dim, 0 );
+    woken_cells.clear();
+    spill.clear();
+    tracked_count = 0;
+    tracking = false;
+
+    // With no particles yet every thread gets an even share of its block
+    PartitionColumns();
+
+    thread_pool->Run( THREAD_COUNT, [this]( unsigned ThreadId ) {
+        const size_t columnSize = static_cast< size_t >( dim ) * CELL_MAX;
+        Verlet** first = collision_grid.get() + thread_columns[ThreadId] * columnSize;
+        Verlet** last = collision_grid.get() + thread_columns[ThreadId + 1] * columnSize;
+        std::fill( first, last, nullptr );
+    } );
+}
+
+int Octree::CellIndex( const vec4& Position, float InverseCellSize ) const noexcept {
+    int x = static_cast< int >( Position.x * InverseCellSize + dim / 2 );
+    int y = static_cast< int >( Position.y * InverseCellSize + dim / 2 );
+    int z = static_cast< int >( Position.z * InverseCellSize + dim / 2 );
+
+    x = std::clamp< int >( x, 0, dim - 1 );
+    y = std::clamp< int >( y, 0, dim - 1 );
+    z = std::clamp< int >( z, 0, dim - 1 );
+
+    return z + y * dim + x * dim * dim;
+}
+
+void Octree::FillTree( VerletArray& Verlets, float Radius, unsigned CurrCount, const uint8_t* Alive,
+                       const uint8_t* Sleeping ) noexcept {
+    // Cells the last fill had particles in are compared against, leaving one wakes its neighbours
+    for ( unsigned i = CurrCount; i < tracked_count; ++i ) {
+        if ( particle_cells[i] >= 0 ) {
+            WakeAround( particle_cells[i] );
+        }
+    }
+
+    const unsigned tracked = std::min( CurrCount, tracked_count );
+    particle_cells.resize( CurrCount );
+    particle_spill.assign( CurrCount, -1 );
+    particle_sleeping.resize( CurrCount );
+    const float inverseCellSize = 1.f / ( Radius * 2 );
+
     for ( unsigned i = 0; i < CurrCount; ++i ) {
-        Verlet* verlet = Verlets[i].get();
+        const int cell = Alive[i] ? CellIndex( Verlets[i].position, inverseCellSize ) : -1;
+        if ( i < tracked && particle_cells[i] >= 0 && particle_cells[i] != cell &&
+             ( cell < 0 || IsMoving( Verlets[i] ) ) ) {
+            WakeAround( particle_cells[i] );
+        }
 
-        int x = static_cast< int >( verlet->position.x / ( Radius * 2 ) + DIM / 2 );
-        int y = static_cast< int >( verlet->position.y / ( Radius * 2 ) + DIM / 2 );
-        int z = static_cast< int >( verlet->position.z / ( Radius * 2 ) + DIM / 2 );
+        particle_cells[i] = cell;
+        particle_sleeping[i] = cell >= 0 ? Sleeping[i] : 0;
+        if ( cell < 0 ) {
+            continue;
+        }
 
-        x = std::clamp< int >( x, 0, DIM - 1 );
-        y = std::clamp< int >( y, 0, DIM - 1 );
-        z = std::clamp< int >( z, 0, DIM - 1 );
+        InsertNode( cell, &Verlets[i], i );
+        ++column_counts[cell / dim];
+        cell_awake[cell] += particle_sleeping[i] ? 0 : 1;
+    }
+
+    tracked_count = CurrCount;
+    tracking = true;
+    churn = 1.f;
+    rebuilt = true;
+}
+
+void Octree::UpdateTree( VerletArray& Verlets, float Radius, unsigned CurrCount, const uint8_t* Alive,
+                         const uint8_t* Sleeping ) {
+    if ( !tracking ) {
+        ClearTree();
+        FillTree( Verlets, Radius, CurrCount, Alive, Sleeping );
+        return;
+    }
 
-        InsertNode( x, y, z, verlet );
+    for ( const int cell : woken_cells ) {
+        cell_woken[cell] = 0;
     }
+    woken_cells.clear();
+
+    // Slots dropped since the last fill leave the grid like dead ones
+    const unsigned count = std::max( CurrCount, tracked_count );
+    particle_cells.resize( count, -1 );
+    particle_spill.resize( count, -1 );
+    particle_sleeping.resize( count, 0 );
+    const float inverseCellSize = 1.f / ( Radius * 2 );
+
+    thread_pool->Run( THREAD_COUNT, [&]( unsigned ThreadId ) {
+        const unsigned start = ThreadId * ( count / THREAD_COUNT );
+        const unsigned end = static_cast< int >( ThreadId ) == THREAD_COUNT - 1
+                                 ? count
+                                 : ( ThreadId + 1 ) * ( count / THREAD_COUNT );
+
+        std::vector< CellMove >& moves = thread_moves[ThreadId];
+        moves.clear();
+
+        for ( unsigned i = start; i < end; ++i ) {
+            const bool alive = i < CurrCount && Alive[i];
+            const uint8_t sleeping = alive ? Sleeping[i] : 0;
+
+            // Sleeping particles are frozen, one that slept through the last step is where it was
+            if ( sleeping && particle_sleeping[i] ) {
+                continue;
+            }
+
+            const int cell = alive ? CellIndex( Verlets[i].position, inverseCellSize ) : -1;
+            if ( cell != particle_cells[i] || sleeping != particle_sleeping[i] ) {
+                moves.push_back( { i, cell, sleeping } );
+            }
+        }
+    } );
+
+    // Only changed cells count as churn, falling asleep or waking up costs no grid work
+    size_t moveCount = 0;
+    size_t inserted = 0;
+    for ( const std::vector< CellMove >& moves : thread_moves ) {
+        for ( const CellMove& move : moves ) {
+            moveCount += move.cell != particle_cells[move.index] ? 1 : 0;
+        }
+    }
+    for ( const unsigned columnCount : column_counts ) {
+        inserted += columnCount;
+    }
+    const float moved = static_cast< float >( moveCount ) /
+                        static_cast< float >( std::max< size_t >( inserted, 1 ) );
+
+    if ( moved > REBUILD_CHURN ) {
+        ClearTree();
+        FillTree( Verlets, Radius, CurrCount, Alive, Sleeping );
+        churn = moved;
+        return;
+    }
+
+    // Few movers, a serial pass keeps the cells free of locks
+    for ( const std::vector< CellMove >& moves : thread_moves ) {
+        for ( const CellMove& move : moves ) {
+            Verlet* verlet = &Verlets[move.index];
+            const int from = particle_cells[move.index];
+
+            if ( from >= 0 ) {
+                if ( from != move.cell ) {
+                    RemoveNode( from, verlet, move.index );
+                    --column_counts[from / dim];
+                    if ( move.cell < 0 || IsMoving( *verlet ) ) {
+                        WakeAround( from );
+                    }
+                }
+                cell_awake[from] -= particle_sleeping[move.index] ? 0 : 1;
+            }
+            if ( move.cell >= 0 ) {
+                if ( from != move.cell ) {
+                    InsertNode( move.cell, verlet, move.index );
+                    ++column_counts[move.cell / dim];
+                }
+                cell_awake[move.cell] += move.sleeping ? 0 : 1;
+            }
+            particle_cells[move.index] = move.cell;
+            particle_sleeping[move.index] = move.sleeping;
+        }
+    }
+
+    tracked_count = CurrCount;
+    particle_cells.resize( CurrCount );
+    particle_spill.resize( CurrCount );
+    particle_sleeping.resize( CurrCount );
+    churn = moved;
+    rebuilt = false;
 }
 
-void Octree::InsertNode( int x, int y, int z, Verlet* obj ) noexcept {
-    int index = ( z + y * DIM + x * DIM * DIM ) * CELL_MAX;
-    while ( collision_grid[index] ) {
-        index = ( index + 1 ) % ( DIM * DIM * DIM * CELL_MAX );
+void Octree::WakeAround( int Cell ) noexcept {
+    const int x = Cell / ( dim * dim );
+    const int y = Cell / dim % dim;
+    const int z = Cell % dim;
+
+    for ( int nx = std::max( x - 1, 0 ); nx <= std::min( x + 1, dim - 1 ); ++nx ) {
+        for ( int ny = std::max( y - 1, 0 ); ny <= std::min( y + 1, dim - 1 ); ++ny ) {
+            for ( int nz = std::max( z - 1, 0 ); nz <= std::min( z + 1, dim - 1 ); ++nz ) {
+                const int neighbour = nz + ny * dim + nx * dim * dim;
+                if ( !cell_woken[neighbour] ) {
+                    cell_woken[neighbour] = 1;
+                    woken_cells.push_back( neighbour );
+                }
+            }
+        }
     }
-    collision_grid[index] = obj;
 }
 
-void Octree::CheckCollisions() noexcept {
-    for ( int i = 0; i < THREAD_COUNT; ++i ) {
-        threads[i] = std::thread( &Octree::GridCollisionThread, this, i );
+void Octree::SetSleepDistance( float Distance ) noexcept {
+    sleep_distance_squared = Distance * Distance;
+}
+
+bool Octree::IsMoving( const Verlet& Particle ) const noexcept {
+    return vec_distance_squared( Particle.position, Particle.old_position ) >= sleep_distance_squared;
+}
+
+bool Octree::IsWoken( unsigned Index ) const noexcept {
+    const int cell = Index < particle_cells.size() ? particle_cells[Index] : -1;
+    return cell >= 0 && cell_woken[cell];
+}
+
+unsigned Octree::GetSleepingCells() const noexcept {
+    unsigned total = 0;
+    for ( const unsigned cells : thread_sleeping_cells ) {
+        total += cells;
     }
-    for ( std::thread& thd : threads ) {
-        thd.join();
+    return total;
+}
+
+float Octree::GetPenetration() const noexcept {
+    float penetration = spill_penetration;
+    for ( const float threadPenetration : thread_penetration ) {
+        penetration = std::max( penetration, threadPenetration );
     }
+    return penetration;
 }
 
-void Octree::GridCollisionThread( int ThreadId ) noexcept {
-    unsigned start = 1 + ThreadId * ( ( DIM ) / THREAD_COUNT );
-    unsigned end = 1 + ( ThreadId + 1 ) * ( ( DIM ) / THREAD_COUNT );
+void Octree::InsertNode( int Cell, Verlet* Obj, unsigned Index ) noexcept {
+    uint8_t& count = cell_counts[Cell];
+    if ( count < CELL_MAX ) {
+        collision_grid[static_cast< size_t >( Cell ) * CELL_MAX + count++] = Obj;
+    } else {
+        particle_spill[Index] = static_cast< int >( spill.size() );
+        spill.push_back( { Obj, Cell, Index } );
+    }
+}
 
-    if ( ThreadId == THREAD_COUNT - 1 ) {
-        end += DIM % THREAD_COUNT - 2;
+void Octree::RemoveNode( int Cell, Verlet* Obj, unsigned Index ) noexcept {
+    const int spilled = particle_spill[Index];
+    if ( spilled >= 0 ) {
+        spill[spilled] = spill.back();
+        particle_spill[spill[spilled].index] = spilled;
+        spill.pop_back();
+        particle_spill[Index] = -1;
+        return;
     }
 
-    for ( unsigned x = start; x < end; ++x ) {
-        for ( unsigned y = 1; y < DIM - 1; ++y ) {
-            for ( unsigned z = 1; z < DIM - 1; ++z ) {
-                Verlet** currentCell = GetNode( x, y, z );
+    Verlet** slots = &collision_grid[static_cast< size_t >( Cell ) * CELL_MAX];
+    uint8_t& count = cell_counts[Cell];
+    for ( int k = 0; k < count; ++k ) {
+        if ( slots[k] == Obj ) {
+            // Last slot fills the gap, used slots stay in front of the null ones
+            slots[k] = slots[count - 1];
+            slots[--count] = nullptr;
+            return;
+        }
+    }
+}
+
+float Octree::GetChurn() const noexcept {
+    return churn;
+}
+
+bool Octree::WasRebuilt() const noexcept {
+    return rebuilt;
+}
+
+const std::vector< Octree::SpilledParticle >& Octree::GetSpill() const noexcept {
+    return spill;
+}
+
+size_t Octree::GetMemory() const noexcept {
+    return grid_size * sizeof( Verlet* ) + column_counts.capacity() * sizeof( unsigned ) +
+           cell_counts.capacity() + cell_awake.capacity() * sizeof( uint16_t ) + cell_woken.capacity() +
+           particle_cells.capacity() * sizeof( int ) + particle_spill.capacity() * sizeof( int ) +
+           particle_sleeping.capacity() + spill.capacity() * sizeof( SpilledParticle );
+}
+
+int Octree::GetDim() const noexcept {
+    return dim;
+}
+
+void Octree::GetThreadColumns( int ThreadId, int& First, int& Last ) const noexcept {
+    First = thread_columns[ThreadId];
+    Last = thread_columns[ThreadId + 1];
+}
+
+void Octree::PartitionColumns() noexcept {
+    const int columnCount = dim * dim;
+
+    if ( static_cast< int >( thread_nodes.size() ) != THREAD_COUNT ) {
+        BalanceColumns( 0, THREAD_COUNT, 0, columnCount );
+        return;
+    }
+
+    // Every node gets a fixed block of columns sized by its thread count
+    int firstThread = 0;
+    while ( firstThread < THREAD_COUNT ) {
+        int lastThread = firstThread + 1;
+        while ( lastThread < THREAD_COUNT && thread_nodes[lastThread] == thread_nodes[firstThread] ) {
+            ++lastThread;
+        }
+
+        BalanceColumns( firstThread, lastThread, columnCount * firstThread / THREAD_COUNT,
+                        columnCount * lastThread / THREAD_COUNT );
+        firstThread = lastThread;
+    }
+}
+
+void Octree::BalanceColumns( int FirstThread, int LastThread, int FirstColumn,
+                             int LastColumn ) noexcept {
+    // Scanning the cells of a column costs about as much as one particle
+    uint64_t total = 0;
+    for ( int column = FirstColumn; column < LastColumn; ++column ) {
+        total += column_counts[column] + 1;
+    }
+
+    // Walk the prefix sum once, cutting whenever it passes the next thread's share
+    const int threadCount = LastThread - FirstThread;
+    int column = FirstColumn;
+    uint64_t prefix = 0;
+    thread_columns[FirstThread] = FirstColumn;
+    for ( int i = 1; i < threadCount; ++i ) {
+        const uint64_t target = total * i / threadCount;
+        while ( column < LastColumn && prefix + column_counts[column] + 1 <= target ) {
+            prefix += column_counts[column++] + 1;
+        }
+        thread_columns[FirstThread + i] = column;
+    }
+    thread_columns[LastThread] = LastColumn;
+}
+
+void Octree::CheckCollisions() noexcept {
+    PartitionColumns();
+
+    thread_pool->Run( THREAD_COUNT, [this]( unsigned ThreadId ) {
+        GridCollisionThread( ThreadId );
+    } );
+
+    spill_penetration = SpillCollisions();
+}
+
+float Octree::SpillCollisions() noexcept {
+    if ( spill.empty() ) {
+        return 0.f;
+    }
+
+    std::sort( spill.begin(), spill.end(), []( const SpilledParticle& A, const SpilledParticle& B ) {
+        return A.cell < B.cell;
+    } );
+    for ( size_t s = 0; s < spill.size(); ++s ) {
+        particle_spill[spill[s].index] = static_cast< int >( s );
+    }
+
+    const auto byCell = []( const SpilledParticle& Spilled, int Cell ) {
+        return Spilled.cell < Cell;
+    };
+
+    // Same pairs as if the cells had room, border cells are only ever the other cell
+    const auto interior = [this]( int X, int Y, int Z ) {
+        return X >= 1 && X < dim - 1 && Y >= 1 && Y < dim - 1 && Z >= 1 && Z < dim - 1;
+    };
+
+    float penetration = 0.f;
+    const auto collide = [this, &penetration]( Verlet* A, Verlet* B ) {
+        penetration = std::max( penetration, verlet_collision_callback( A, B ) );
+    };
+
+    for ( const SpilledParticle& spilled : spill ) {
+        const int x = spilled.cell / ( dim * dim );
+        const int y = spilled.cell / dim % dim;
+        const int z = spilled.cell % dim;
+        const bool current = interior( x, y, z );
 
-                if ( !currentCell[0] ) {
-                    continue;
+        for ( int nx = std::max( x - 1, 0 ); nx <= std::min( x + 1, dim - 1 ); ++nx ) {
+            for ( int ny = std::max( y - 1, 0 ); ny <= std::min( y + 1, dim - 1 ); ++ny ) {
+                for ( int nz = std::max( z - 1, 0 ); nz <= std::min( z + 1, dim - 1 ); ++nz ) {
+                    const bool other = interior( nx, ny, nz );
+
+                    Verlet** cell = GetNode( nx, ny, nz );
+                    for ( int k = 0; k < CELL_MAX && cell[k]; ++k ) {
+                        if ( current ) {
+                            collide( spilled.verlet, cell[k] );
+                        }
+                        if ( other ) {
+                            collide( cell[k], spilled.verlet );
+                        }
+                    }
+
+                    // The reverse pair comes from the other spilled particle's own pass
+                    if ( current ) {
+                        const int neighbour = nz + ny * dim + nx * dim * dim;
+                        auto it = std::lower_bound( spill.begin(), spill.end(), neighbour, byCell );
+                        for ( ; it != spill.end() && it->cell == neighbour; ++it ) {
+                            collide( spilled.verlet, it->verlet );
+                        }
+                    }
                 }
+            }
+        }
+    }
+
+    return penetration;
+}
+
+const std::vector< float >& Octree::GetThreadBusy() const noexcept {
+    return thread_busy;
+}
+
+void Octree::GridCollisionThread( int ThreadId ) noexcept {
+    const auto begin = std::chrono::steady_clock::now();
+    unsigned sleepingCells = 0;
+    float penetration = 0.f;
 
-                for ( int dx = -1; dx <= 1; ++dx ) {
-                    for ( int dy = -1; dy <= 1; ++dy ) {
-                        for ( int dz = -1; dz <= 1; ++dz ) {
-                            Verlet** otherCell = GetNode( x + dx, y + dy, z + dz );
+    for ( int column = thread_columns[ThreadId]; column < thread_columns[ThreadId + 1]; ++column ) {
+        const int x = column / dim;
+        const int y = column % dim;
 
-                            if ( !otherCell[0] ) {
-                                continue;
-                            }
-                            VerletCollision( currentCell, otherCell );
+        // Border cells only hold clamped strays, they are reached as neighbours
+        if ( x < 1 || x >= dim - 1 || y < 1 || y >= dim - 1 ) {
+            continue;
+        }
+
+        for ( int z = 1; z < dim - 1; ++z ) {
+            Verlet** currentCell = GetNode( x, y, z );
+
+            if ( !currentCell[0] ) {
+                continue;
+            }
+
+            // Two sleeping cells stay apart, only awake neighbours are checked against them
+            const bool awake = IsAwake( x, y, z );
+            sleepingCells += awake ? 0 : 1;
+
+            for ( int dx = -1; dx <= 1; ++dx ) {
+                for ( int dy = -1; dy <= 1; ++dy ) {
+                    for ( int dz = -1; dz <= 1; ++dz ) {
+                        Verlet** otherCell = GetNode( x + dx, y + dy, z + dz );
+
+                        if ( !otherCell[0] || ( !awake && !IsAwake( x + dx, y + dy, z + dz ) ) ) {
+                            continue;
                         }
+                        penetration = std::max( penetration, VerletCollision( currentCell, otherCell ) );
                     }
                 }
             }
         }
     }
+
+    thread_sleeping_cells[ThreadId] = sleepingCells;
+    thread_penetration[ThreadId] = penetration;
+    thread_busy[ThreadId] = std::chrono::duration< float, std::milli >(
+                                std::chrono::steady_clock::now() - begin )
+                                .count();
 }
 
-void Octree::VerletCollision( Verlet** CurrentCell, Verlet** OtherCell ) noexcept {
-    for ( int a = 0; CurrentCell[a]; ++a ) {
-        for ( int b = 0; OtherCell[b]; ++b ) {
-            verlet_collision_callback( CurrentCell[a], OtherCell[b] );
+float Octree::VerletCollision( Verlet** CurrentCell, Verlet** OtherCell ) noexcept {
+    float penetration = 0.f;
+    for ( int a = 0; a < CELL_MAX && CurrentCell[a]; ++a ) {
+        for ( int b = 0; b < CELL_MAX && OtherCell[b]; ++b ) {
+            penetration = std::max( penetration, verlet_collision_callback( CurrentCell[a], OtherCell[b] ) );
         }
     }
+    return penetration;
 }
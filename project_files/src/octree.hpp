@@ -4,7 +4,7 @@
 #pragma once
 
 // std includes
-#include <array>
+#include <algorithm>
 #include <memory>
 #include <vector>
 #include <thread>
@@ -12,7 +12,7 @@
 // Local includes
 #include "verlet.hpp"
 
-// typedef std::array< std::unique_ptr< Verlet >, VerletManager::MAX > VerletArray;
+class ThreadPool;
 
 class Octree {
 public:
@@ -23,33 +23,195 @@ public:
         verlet_collision_callback = Callback;
     }
 
-    void FillTree( std::array< std::unique_ptr< Verlet >, VerletManager::MAX >& Verlets,
-                   const float Radius, const unsigned CurrCount ) noexcept;
+    //! Pool CheckCollisions runs on, owned by the caller
+    void SetThreadPool( ThreadPool* Pool ) noexcept;
+
+    /**
+     * @brief Sizes the grid so cells of 2 * Radius cover [-Extent, Extent] on
+     *        every axis. Only reallocates when the dimension changes.
+     */
+    void SetBounds( float Extent, float Radius );
+
+    /**
+     * @brief Node of every thread, see CpuTopology::ThreadNodes(). Threads of a
+     *        node share one fixed block of columns and only balance inside it,
+     *        so the grid memory they work on stays on their node. Empty makes
+     *        the whole grid one block. The grid is placed again on the next SetBounds.
+     */
+    void SetThreadNodes( const std::vector< int >& Nodes );
+
+    /**
+     * @brief Inserts the first CurrCount particles, slots with a 0 in Alive are
+     *        holes and skipped. Cells with no awake particle by Sleeping are
+     *        skipped against each other in CheckCollisions.
+     */
+    void FillTree( VerletArray& Verlets, const float Radius, const unsigned CurrCount,
+                   const uint8_t* Alive, const uint8_t* Sleeping ) noexcept;
+
+    //! Empties the cells, the particle cells of the last fill are kept to wake the ones left by the next
     inline void ClearTree() {
-        collision_grid.fill( nullptr );
+        std::fill( collision_grid.get(), collision_grid.get() + grid_size, nullptr );
+        std::fill( column_counts.begin(), column_counts.end(), 0 );
+        std::fill( cell_counts.begin(), cell_counts.end(), 0 );
+        std::fill( cell_awake.begin(), cell_awake.end(), 0 );
+        std::fill( cell_woken.begin(), cell_woken.end(), 0 );
+        woken_cells.clear();
+        spill.clear();
+        tracking = false;
     }
 
+    /**
+     * @brief Brings the grid up to date with the current positions, moving
+     *        only the particles whose cell changed since the last fill. Falls
+     *        back to ClearTree() and FillTree() when the grid was not filled
+     *        before or more than REBUILD_CHURN of the particles moved.
+     */
+    void UpdateTree( VerletArray& Verlets, const float Radius, const unsigned CurrCount,
+                     const uint8_t* Alive, const uint8_t* Sleeping );
+
+    /**
+     * @brief Particles moving less than Distance per step only jitter across
+     *        cell borders and do not wake the cells they leave.
+     */
+    void SetSleepDistance( float Distance ) noexcept;
+
+    /**
+     * @brief A moving particle left, or a particle was removed from, a cell
+     *        next to the one particle Index is in during the last fill or
+     *        update. Sleeping particles there may have lost their support
+     *        and should wake up.
+     */
+    bool IsWoken( unsigned Index ) const noexcept;
+
+    //! The cell holds at least one awake particle
+    inline bool IsAwake( int x, int y, int z ) const noexcept {
+        return cell_awake[z + y * dim + x * dim * dim] > 0;
+    }
+
+    //! Occupied cells the last CheckCollisions skipped against their sleeping neighbours
+    unsigned GetSleepingCells() const noexcept;
+
+    //! Deepest overlap the collision callback reported in the last CheckCollisions
+    float GetPenetration() const noexcept;
+
+    //! Fraction of the particles that changed cell in the last UpdateTree, 1 after a fill
+    float GetChurn() const noexcept;
+
+    //! The last UpdateTree rebuilt the grid instead of moving particles
+    bool WasRebuilt() const noexcept;
+
     inline Verlet** GetNode( int x, int y, int z ) {
-        return &collision_grid[( z + y * DIM + x * DIM * DIM ) * CELL_MAX];
+        return &collision_grid[( z + y * dim + x * dim * dim ) * CELL_MAX];
     }
 
+    size_t GetMemory() const noexcept;
+
+    //! Cells per axis of the current grid
+    int GetDim() const noexcept;
+
+    //! Columns [First, Last) ThreadId worked on in the last CheckCollisions
+    void GetThreadColumns( int ThreadId, int& First, int& Last ) const noexcept;
+
     void CheckCollisions() noexcept;
 
+    //! Milliseconds every thread spent on its columns in the last CheckCollisions
+    const std::vector< float >& GetThreadBusy() const noexcept;
+
     void GridCollisionThread( int ThreadId ) noexcept;
-    inline void VerletCollision( Verlet** CurrentCell, Verlet** OtherCell ) noexcept;
+    //! @return deepest overlap of the pairs
+    inline float VerletCollision( Verlet** CurrentCell, Verlet** OtherCell ) noexcept;
+
+    static constexpr int CELL_MAX = 4;
+    static constexpr float REBUILD_CHURN = 0.25f; //!< moving a particle costs about four inserts of a fill
+
+    //! Particle that did not fit into the CELL_MAX slots of its cell
+    struct SpilledParticle {
+        Verlet* verlet;
+        int cell;
+        unsigned index; //!< particle slot
+    };
+
+    //! Particles of full cells, CheckCollisions handles them after the columns
+    const std::vector< SpilledParticle >& GetSpill() const noexcept;
 
 private:
-    inline void InsertNode( int x, int y, int z, Verlet* obj ) noexcept;
+    //! Cell of Position, positions outside the grid are clamped to the border cells
+    inline int CellIndex( const vec4& Position, float InverseCellSize ) const noexcept;
 
-    static constexpr int DIM = 58;
-    static constexpr int CELL_MAX = 4;
+    //! Appends particle Index to the slots of Cell, or to the spill list when the cell is full
+    inline void InsertNode( int Cell, Verlet* Obj, unsigned Index ) noexcept;
 
-    std::function< void( Verlet*, Verlet* ) > verlet_collision_callback;
+    /**
+     * @brief Takes particle Index out of Cell. Spilled particles stay spilled
+     *        when a slot frees up, they are collided the same either way.
+     */
+    void RemoveNode( int Cell, Verlet* Obj, unsigned Index ) noexcept;
 
-    int THREAD_COUNT = 24;
-    std::vector< std::thread > threads;
+    //! Flags Cell and its neighbours for IsWoken() until the next update
+    void WakeAround( int Cell ) noexcept;
+
+    //! Moved at least the sleep distance in the last step
+    bool IsMoving( const Verlet& Particle ) const noexcept;
+
+    /**
+     * @brief Spilled particles against their neighbour cells and each other,
+     *        serial. The spill is sorted by cell so spilled neighbours are
+     *        found by binary search.
+     *
+     * @return deepest overlap of the pairs
+     */
+    float SpillCollisions() noexcept;
 
-    std::array< Verlet*, DIM * DIM * DIM * CELL_MAX > collision_grid{ nullptr };
+    /**
+     * @brief Splits the (x, y) columns into THREAD_COUNT contiguous ranges
+     *        holding about the same number of particles, so threads stay
+     *        balanced when particles pile up in a few columns.
+     */
+    void PartitionColumns() noexcept;
+
+    //! Prefix sum split of [FirstColumn, LastColumn) over [FirstThread, LastThread)
+    void BalanceColumns( int FirstThread, int LastThread, int FirstColumn, int LastColumn ) noexcept;
+
+    //! Allocates the grid and lets every thread first touch the columns it starts out with
+    void PlaceGrid();
+
+    int dim = 0; //!< cells per axis, including an empty border cell on each side
+
+    std::function< float( Verlet*, Verlet* ) > verlet_collision_callback; //!< returns the overlap it resolved
+
+    int THREAD_COUNT = 24;
+    ThreadPool* thread_pool = nullptr;
+
+    std::unique_ptr< Verlet*[] > collision_grid; //!< dim^3 cells of CELL_MAX slots, one column after another
+    size_t grid_size = 0;
+    std::vector< unsigned > column_counts; //!< particles per (x, y) column, filled with the grid
+    std::vector< uint8_t > cell_counts;    //!< used slots of every cell, at most CELL_MAX
+    std::vector< uint16_t > cell_awake;    //!< awake particles of every cell, spilled ones included
+    std::vector< uint8_t > cell_woken;     //!< set by WakeAround() for the current step
+    std::vector< int > woken_cells;        //!< cells set in cell_woken, cleared by the next update
+    std::vector< unsigned > thread_sleeping_cells;
+    std::vector< float > thread_penetration;
+    float spill_penetration = 0.f;
+    std::vector< SpilledParticle > spill;
+
+    struct CellMove {
+        unsigned index;
+        int cell;         //!< -1 leaves the grid
+        uint8_t sleeping; //!< new sleep state
+    };
+
+    std::vector< int > particle_cells; //!< cell every particle slot was inserted into, -1 for none
+    std::vector< int > particle_spill; //!< entry of every particle slot in spill, -1 for none
+    std::vector< uint8_t > particle_sleeping; //!< sleep state every particle slot was counted with
+    std::vector< std::vector< CellMove > > thread_moves;
+    unsigned tracked_count = 0; //!< slots particle_cells covers, 0 once the grid is placed again
+    bool tracking = false;      //!< particle_cells matches the grid
+    float sleep_distance_squared = 0.f;
+    float churn = 1.f;
+    bool rebuilt = true;
+    std::vector< int > thread_columns;     //!< first column of every thread, THREAD_COUNT + 1 entries
+    std::vector< float > thread_busy;
+    std::vector< int > thread_nodes;
 };
 
 #endif
@@ -106,11 +106,9 @@ void Profiler::Record() {
         if ( exit )
             return;
 
-        // Checking time since last recorded
+        // Sleeping until the next sample instead of spinning on the clock
+        std::this_thread::sleep_until( start + std::chrono::milliseconds( 1 ) );
         current = std::chrono::steady_clock::now();
-        long long duration = std::chrono::duration_cast< std::chrono::milliseconds >( current - start ).count();
-        if ( duration < 1 )
-            continue;
 
         SuspendThread( main_thread );
 
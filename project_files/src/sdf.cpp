@@ -0,0 +1,479 @@
+
+// std includes
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+
+// System includes
+#include <fmt/core.h>
+#include <glm/ext/matrix_transform.hpp>
+
+// Local includes
+#include "sdf.hpp"
+#include "mapped_file.hpp"
+#include "mesh_cache.hpp"
+#include "model_manager.hpp"
+#include "trace.hpp"
+
+static constexpr char SDF_MAGIC[4] = { 'S', 'W', 'S', 'D' };
+static constexpr const char* SDF_EXTENSION = ".swsdf";
+
+glm::vec3 ClosestPointOnTriangle( const glm::vec3& P, const glm::vec3& A, const glm::vec3& B,
+                                  const glm::vec3& C ) noexcept {
+    const glm::vec3 ab = B - A;
+    const glm::vec3 ac = C - A;
+
+    const glm::vec3 ap = P - A;
+    const float d1 = glm::dot( ab, ap );
+    const float d2 = glm::dot( ac, ap );
+    if ( d1 <= 0.f && d2 <= 0.f ) {
+        return A;
+    }
+
+    const glm::vec3 bp = P - B;
+    const float d3 = glm::dot( ab, bp );
+    const float d4 = glm::dot( ac, bp );
+    if ( d3 >= 0.f && d4 <= d3 ) {
+        return B;
+    }
+
+    const float vc = d1 * d4 - d3 * d2;
+    if ( vc <= 0.f && d1 >= 0.f && d3 <= 0.f ) {
+        return A + ab * ( d1 / ( d1 - d3 ) );
+    }
+
+    const glm::vec3 cp = P - C;
+    const float d5 = glm::dot( ab, cp );
+    const float d6 = glm::dot( ac, cp );
+    if ( d6 >= 0.f && d5 <= d6 ) {
+        return C;
+    }
+
+    const float vb = d5 * d2 - d1 * d6;
+    if ( vb <= 0.f && d2 >= 0.f && d6 <= 0.f ) {
+        return A + ac * ( d2 / ( d2 - d6 ) );
+    }
+
+    const float va = d3 * d6 - d5 * d4;
+    if ( va <= 0.f && ( d4 - d3 ) >= 0.f && ( d5 - d6 ) >= 0.f ) {
+        return B + ( C - B ) * ( ( d4 - d3 ) / ( ( d4 - d3 ) + ( d5 - d6 ) ) );
+    }
+
+    const float denominator = 1.f / ( va + vb + vc );
+    return A + ab * ( vb * denominator ) + ac * ( vc * denominator );
+}
+
+static float Cross2( float Ax, float Ay, float Bx, float By ) noexcept {
+    return Ax * By - Ay * Bx;
+}
+
+std::string SignedDistanceField::CachePath( const std::string& SourceFile ) {
+    return SourceFile + SDF_EXTENSION;
+}
+
+bool SignedDistanceField::Load( const std::string& ModelFileName, unsigned Resolution ) {
+    if ( ReadCache( ModelFileName, Resolution ) ) {
+        return true;
+    }
+
+    std::vector< glm::vec3 > positions;
+    std::vector< unsigned > indices;
+    if ( !ModelManager::Instance().GetTriangles( ModelFileName, positions, indices ) ||
+         indices.size() < 3 ) {
+        Trace::Message( fmt::format( "Unable to bake a distance field from {}.", ModelFileName ) );
+        return false;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    Bake( positions, indices, Resolution );
+    const float bakeMs = std::chrono::duration< float, std::milli >(
+                             std::chrono::steady_clock::now() - start )
+                             .count();
+
+    Trace::Message( fmt::format( "{}: {} triangles baked into a {}^3 distance field in {:.1f} ms",
+                                 ModelFileName, indices.size() / 3, resolution, bakeMs ) );
+
+    WriteCache( ModelFileName );
+    return true;
+}
+
+void SignedDistanceField::Bake( const std::vector< glm::vec3 >& Positions,
+                                const std::vector< unsigned >& Indices, unsigned Resolution ) {
+    resolution = std::max( Resolution, PADDING * 2 + 2 );
+    const int res = static_cast< int >( resolution );
+
+    glm::vec3 minBound( std::numeric_limits< float >::max() );
+    glm::vec3 maxBound( std::numeric_limits< float >::lowest() );
+    for ( const glm::vec3& position : Positions ) {
+        minBound = glm::min( minBound, position );
+        maxBound = glm::max( maxBound, position );
+    }
+
+    center = ( minBound + maxBound ) * 0.5f;
+    const glm::vec3 halfExtent = ( maxBound - minBound ) * 0.5f;
+    scale = 1.f / std::max( { halfExtent.x, halfExtent.y, halfExtent.z, 1e-6f } );
+    voxel_size = 2.f / static_cast< float >( res - 1 - static_cast< int >( PADDING ) * 2 );
+    origin = -1.f - static_cast< float >( PADDING ) * voxel_size;
+
+    // Triangle corners in normalized space
+    const int triangleCount = static_cast< int >( Indices.size() / 3 );
+    std::vector< glm::vec3 > corners( static_cast< size_t >( triangleCount ) * 3 );
+    for ( size_t i = 0; i < corners.size(); ++i ) {
+        corners[i] = ( Positions[Indices[i]] - center ) * scale;
+    }
+
+    const size_t voxelCount = static_cast< size_t >( res ) * res * res;
+    std::vector< float > distance( voxelCount, std::numeric_limits< float >::max() );
+    std::vector< int > closest( voxelCount, -1 );
+
+    auto voxelIndex = [res]( int X, int Y, int Z ) {
+        return ( static_cast< size_t >( Z ) * res + Y ) * res + X;
+    };
+    auto voxelCentre = [this]( int X, int Y, int Z ) {
+        return glm::vec3( origin + X * voxel_size, origin + Y * voxel_size, origin + Z * voxel_size );
+    };
+    auto triangleDistance = [&corners]( const glm::vec3& Point, int Triangle ) {
+        const glm::vec3* triangle = &corners[static_cast< size_t >( Triangle ) * 3];
+        return glm::length( Point - ClosestPointOnTriangle( Point, triangle[0], triangle[1],
+                                                            triangle[2] ) );
+    };
+    auto toVoxel = [this, res]( float Coordinate, float Offset ) {
+        const float voxel = std::floor( ( Coordinate - origin ) / voxel_size + Offset );
+        return std::clamp( static_cast< int >( voxel ), 0, res - 1 );
+    };
+
+    // Exact distances to the voxels within one voxel of every triangle
+    for ( int t = 0; t < triangleCount; ++t ) {
+        const glm::vec3* triangle = &corners[static_cast< size_t >( t ) * 3];
+        const glm::vec3 low = glm::min( triangle[0], glm::min( triangle[1], triangle[2] ) );
+        const glm::vec3 high = glm::max( triangle[0], glm::max( triangle[1], triangle[2] ) );
+
+        for ( int z = toVoxel( low.z, -1.f ); z <= toVoxel( high.z, 2.f ); ++z ) {
+            for ( int y = toVoxel( low.y, -1.f ); y <= toVoxel( high.y, 2.f ); ++y ) {
+                for ( int x = toVoxel( low.x, -1.f ); x <= toVoxel( high.x, 2.f ); ++x ) {
+                    const size_t index = voxelIndex( x, y, z );
+                    const float d = triangleDistance( voxelCentre( x, y, z ), t );
+                    if ( d < distance[index] ) {
+                        distance[index] = d;
+                        closest[index] = t;
+                    }
+                }
+            }
+        }
+    }
+
+    // Every voxel tries the closest triangles of the neighbours it is swept from,
+    // two passes over the eight diagonal directions reach the whole grid
+    auto sweep = [&]( int Dx, int Dy, int Dz ) {
+        const int xBegin = Dx > 0 ? 1 : res - 2;
+        const int yBegin = Dy > 0 ? 1 : res - 2;
+        const int zBegin = Dz > 0 ? 1 : res - 2;
+        const int xEnd = Dx > 0 ? res : -1;
+        const int yEnd = Dy > 0 ? res : -1;
+        const int zEnd = Dz > 0 ? res : -1;
+
+        for ( int z = zBegin; z != zEnd; z += Dz ) {
+            for ( int y = yBegin; y != yEnd; y += Dy ) {
+                for ( int x = xBegin; x != xEnd; x += Dx ) {
+                    const size_t index = voxelIndex( x, y, z );
+                    const glm::vec3 centre = voxelCentre( x, y, z );
+
+                    const size_t neighbours[7] = {
+                        voxelIndex( x - Dx, y, z ),      voxelIndex( x, y - Dy, z ),
+                        voxelIndex( x - Dx, y - Dy, z ), voxelIndex( x, y, z - Dz ),
+                        voxelIndex( x - Dx, y, z - Dz ), voxelIndex( x, y - Dy, z - Dz ),
+                        voxelIndex( x - Dx, y - Dy, z - Dz ) };
+
+                    for ( size_t neighbour : neighbours ) {
+                        const int t = closest[neighbour];
+                        if ( t < 0 || t == closest[index] ) {
+                            continue;
+                        }
+
+                        const float d = triangleDistance( centre, t );
+                        if ( d < distance[index] ) {
+                            distance[index] = d;
+                            closest[index] = t;
+                        }
+                    }
+                }
+            }
+        }
+    };
+
+    for ( int pass = 0; pass < 2; ++pass ) {
+        for ( int direction = 0; direction < 8; ++direction ) {
+            sweep( direction & 1 ? -1 : 1, direction & 2 ? -1 : 1, direction & 4 ? -1 : 1 );
+        }
+    }
+
+    // Inside when rays along at least two of the three axes cross the surface an odd number of times
+    std::vector< uint8_t > insideVotes( voxelCount, 0 );
+
+    // Keeps rows from passing exactly through shared edges and vertices, which would count twice
+    const float jitterB = voxel_size * 1.37e-3f;
+    const float jitterC = voxel_size * 2.71e-3f;
+
+    for ( int axis = 0; axis < 3; ++axis ) {
+        const int axisB = ( axis + 1 ) % 3;
+        const int axisC = ( axis + 2 ) % 3;
+
+        // Crossings of every row along axis, in voxel units
+        std::vector< std::vector< float > > rows( static_cast< size_t >( res ) * res );
+
+        for ( int t = 0; t < triangleCount; ++t ) {
+            const glm::vec3* triangle = &corners[static_cast< size_t >( t ) * 3];
+
+            const float area = Cross2( triangle[1][axisB] - triangle[0][axisB],
+                                       triangle[1][axisC] - triangle[0][axisC],
+                                       triangle[2][axisB] - triangle[0][axisB],
+                                       triangle[2][axisC] - triangle[0][axisC] );
+            if ( std::abs( area ) < 1e-12f ) {
+                continue;
+            }
+
+            const float lowB = std::min( { triangle[0][axisB], triangle[1][axisB], triangle[2][axisB] } );
+            const float highB = std::max( { triangle[0][axisB], triangle[1][axisB], triangle[2][axisB] } );
+            const float lowC = std::min( { triangle[0][axisC], triangle[1][axisC], triangle[2][axisC] } );
+            const float highC = std::max( { triangle[0][axisC], triangle[1][axisC], triangle[2][axisC] } );
+
+            for ( int c = toVoxel( lowC, 0.f ); c <= toVoxel( highC, 1.f ); ++c ) {
+                for ( int b = toVoxel( lowB, 0.f ); b <= toVoxel( highB, 1.f ); ++b ) {
+                    const float qb = origin + b * voxel_size + jitterB;
+                    const float qc = origin + c * voxel_size + jitterC;
+
+                    const float w0 = Cross2( triangle[1][axisB] - qb, triangle[1][axisC] - qc,
+                                             triangle[2][axisB] - qb, triangle[2][axisC] - qc ) / area;
+                    const float w1 = Cross2( triangle[2][axisB] - qb, triangle[2][axisC] - qc,
+                                             triangle[0][axisB] - qb, triangle[0][axisC] - qc ) / area;
+                    const float w2 = 1.f - w0 - w1;
+                    if ( w0 < 0.f || w1 < 0.f || w2 < 0.f ) {
+                        continue;
+                    }
+
+                    const float hit = w0 * triangle[0][axis] + w1 * triangle[1][axis] +
+                                      w2 * triangle[2][axis];
+                    rows[static_cast< size_t >( c ) * res + b].push_back( ( hit - origin ) / voxel_size );
+                }
+            }
+        }
+
+        for ( int c = 0; c < res; ++c ) {
+            for ( int b = 0; b < res; ++b ) {
+                std::vector< float >& crossings = rows[static_cast< size_t >( c ) * res + b];
+                std::sort( crossings.begin(), crossings.end() );
+
+                // Duplicated faces (e.g. a mesh exported twice) would otherwise cancel out
+                crossings.erase( std::unique( crossings.begin(), crossings.end(),
+                                              []( float A, float B ) {
+                                                  return B - A < 1e-4f;
+                                              } ),
+                                 crossings.end() );
+
+                size_t crossed = 0;
+                for ( int a = 0; a < res; ++a ) {
+                    while ( crossed < crossings.size() && crossings[crossed] < static_cast< float >( a ) ) {
+                        ++crossed;
+                    }
+
+                    if ( crossed & 1 ) {
+                        int voxel[3];
+                        voxel[axis] = a;
+                        voxel[axisB] = b;
+                        voxel[axisC] = c;
+                        ++insideVotes[voxelIndex( voxel[0], voxel[1], voxel[2] )];
+                    }
+                }
+            }
+        }
+    }
+
+    for ( size_t i = 0; i < voxelCount; ++i ) {
+        if ( insideVotes[i] >= 2 ) {
+            distance[i] = -distance[i];
+        }
+    }
+
+    // Central differences, one sided on the border
+    voxels.assign( voxelCount, vec4( 0.f ) );
+    for ( int z = 0; z < res; ++z ) {
+        for ( int y = 0; y < res; ++y ) {
+            for ( int x = 0; x < res; ++x ) {
+                const glm::vec3 gradient(
+                    distance[voxelIndex( std::min( x + 1, res - 1 ), y, z )] -
+                        distance[voxelIndex( std::max( x - 1, 0 ), y, z )],
+                    distance[voxelIndex( x, std::min( y + 1, res - 1 ), z )] -
+                        distance[voxelIndex( x, std::max( y - 1, 0 ), z )],
+                    distance[voxelIndex( x, y, std::min( z + 1, res - 1 ) )] -
+                        distance[voxelIndex( x, y, std::max( z - 1, 0 ) )] );
+
+                const float length = glm::length( gradient );
+                const glm::vec3 normal = length > 0.f ? gradient / length : glm::vec3( 0.f );
+
+                const size_t index = voxelIndex( x, y, z );
+                voxels[index] = vec4( normal.x, normal.y, normal.z, distance[index] );
+            }
+        }
+    }
+}
+
+static inline __m128 Lerp( __m128 A, __m128 B, __m128 T ) noexcept {
+    return _mm_add_ps( A, _mm_mul_ps( _mm_sub_ps( B, A ), T ) );
+}
+
+vec4 SignedDistanceField::Sample( const vec4& Position ) const noexcept {
+    const float maxCoordinate = static_cast< float >( resolution - 1 ) - 1e-3f;
+
+    float outside = 0.f;
+    int cell[3];
+    float fraction[3];
+    for ( int j = 0; j < 3; ++j ) {
+        const float coordinate = ( Position[j] - origin ) / voxel_size;
+        const float clamped = std::clamp( coordinate, 0.f, maxCoordinate );
+        outside += ( coordinate - clamped ) * ( coordinate - clamped );
+
+        cell[j] = static_cast< int >( clamped );
+        fraction[j] = clamped - static_cast< float >( cell[j] );
+    }
+
+    // Gradient and distance are interpolated together, one SSE lane each
+    const size_t strideY = resolution;
+    const size_t strideZ = static_cast< size_t >( resolution ) * resolution;
+    const vec4* base = &voxels[cell[2] * strideZ + cell[1] * strideY + cell[0]];
+
+    const __m128 tx = _mm_set1_ps( fraction[0] );
+    const __m128 ty = _mm_set1_ps( fraction[1] );
+    const __m128 tz = _mm_set1_ps( fraction[2] );
+
+    const __m128 c00 = Lerp( _mm_loadu_ps( base[0].a ), _mm_loadu_ps( base[1].a ), tx );
+    const __m128 c10 = Lerp( _mm_loadu_ps( base[strideY].a ), _mm_loadu_ps( base[strideY + 1].a ), tx );
+    const __m128 c01 = Lerp( _mm_loadu_ps( base[strideZ].a ), _mm_loadu_ps( base[strideZ + 1].a ), tx );
+    const __m128 c11 = Lerp( _mm_loadu_ps( base[strideZ + strideY].a ),
+                             _mm_loadu_ps( base[strideZ + strideY + 1].a ), tx );
+
+    const __m128 sample = Lerp( Lerp( c00, c10, ty ), Lerp( c01, c11, ty ), tz );
+
+    vec4 result( 0.f );
+    _mm_storeu_ps( result.a, sample );
+
+    if ( outside > 0.f ) {
+        result.w += std::sqrt( outside ) * voxel_size;
+    }
+
+    return result;
+}
+
+glm::mat4 SignedDistanceField::GetNormalization() const {
+    return glm::translate( glm::scale( glm::mat4( 1.f ), glm::vec3( scale ) ), -center );
+}
+
+bool SignedDistanceField::IsLoaded() const {
+    return !voxels.empty();
+}
+
+size_t SignedDistanceField::GetMemory() const {
+    return voxels.capacity() * sizeof( vec4 );
+}
+
+bool SignedDistanceField::ReadCache( const std::string& SourceFile, unsigned Resolution ) {
+    const std::string cachePath = CachePath( SourceFile );
+    if ( !std::filesystem::exists( cachePath ) ) {
+        return false;
+    }
+
+    uint64_t mtime = 0;
+    uint64_t size = 0;
+    MappedFile file;
+    if ( !MeshCache::SourceInfo( SourceFile, mtime, size ) || !file.Open( cachePath ) ||
+         file.Size() < sizeof( SdfCacheHeader ) ) {
+        return false;
+    }
+
+    const SdfCacheHeader* header = reinterpret_cast< const SdfCacheHeader* >( file.Data() );
+    const size_t voxelCount = static_cast< size_t >( header->resolution ) * header->resolution *
+                              header->resolution;
+
+    if ( memcmp( header->magic, SDF_MAGIC, sizeof( SDF_MAGIC ) ) != 0 || header->version != VERSION ||
+         header->resolution != Resolution || header->source_size != size ||
+         file.Size() != sizeof( SdfCacheHeader ) + voxelCount * sizeof( vec4 ) ) {
+        return false;
+    }
+
+    const bool touched = header->source_mtime != mtime;
+    if ( touched ) {
+        uint64_t hash = 0;
+        if ( !MeshCache::HashSource( SourceFile, hash ) || hash != header->source_hash ) {
+            return false;
+        }
+    }
+
+    resolution = header->resolution;
+    origin = header->origin;
+    voxel_size = header->voxel_size;
+    center = { header->center[0], header->center[1], header->center[2] };
+    scale = header->scale;
+
+    voxels.assign( voxelCount, vec4( 0.f ) );
+    memcpy( voxels.data(), file.Data() + sizeof( SdfCacheHeader ), voxelCount * sizeof( vec4 ) );
+
+    // Unchanged source, the new mtime spares the next load the hash
+    if ( touched ) {
+        file.Close();
+        MeshCache::UpdateSourceTime( cachePath, offsetof( SdfCacheHeader, source_mtime ), mtime );
+    }
+
+    return true;
+}
+
+bool SignedDistanceField::WriteCache( const std::string& SourceFile ) const {
+    SdfCacheHeader header{};
+    memcpy( header.magic, SDF_MAGIC, sizeof( SDF_MAGIC ) );
+    header.version = VERSION;
+    header.resolution = resolution;
+    header.origin = origin;
+    header.voxel_size = voxel_size;
+    header.center[0] = center.x;
+    header.center[1] = center.y;
+    header.center[2] = center.z;
+    header.scale = scale;
+
+    if ( !MeshCache::SourceInfo( SourceFile, header.source_mtime, header.source_size ) ||
+         !MeshCache::HashSource( SourceFile, header.source_hash ) ) {
+        Trace::Message( fmt::format( "Unable to read {} for distance field cache.", SourceFile ) );
+        return false;
+    }
+
+    const std::string cachePath = CachePath( SourceFile );
+    const std::string tempPath = cachePath + ".tmp";
+
+    std::ofstream output( tempPath, std::ios::binary | std::ios::trunc );
+    if ( !output.is_open() ) {
+        Trace::Message( fmt::format( "Unable to write distance field cache {}.", cachePath ) );
+        return false;
+    }
+
+    output.write( reinterpret_cast< const char* >( &header ), sizeof( header ) );
+    output.write( reinterpret_cast< const char* >( voxels.data() ), sizeof( vec4 ) * voxels.size() );
+    output.close();
+
+    if ( !output ) {
+        Trace::Message( fmt::format( "Unable to write distance field cache {}.", cachePath ) );
+        return false;
+    }
+
+    std::error_code error;
+    std::filesystem::rename( tempPath, cachePath, error );
+    if ( error ) {
+        Trace::Message( fmt::format( "Unable to replace distance field cache {}: {}", cachePath,
+                                     error.message() ) );
+        std::filesystem::remove( tempPath, error );
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,92 @@
+#ifndef SDF_HPP
+#define SDF_HPP
+#pragma once
+
+// std includes
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// System includes
+#include <glm/glm.hpp>
+
+// Local includes
+#include "math.hpp"
+
+//! Closest point on triangle ABC to P, Ericson's Real-Time Collision Detection 5.1.5
+glm::vec3 ClosestPointOnTriangle( const glm::vec3& P, const glm::vec3& A, const glm::vec3& B,
+                                  const glm::vec3& C ) noexcept;
+
+struct SdfCacheHeader {
+    char magic[4];         //!< "SWSD"
+    uint32_t version;      //!< SignedDistanceField::VERSION
+    uint64_t source_mtime; //!< last write time of the OBJ when the field was baked
+    uint64_t source_size;  //!< size of the OBJ in bytes
+    uint64_t source_hash;  //!< FNV-1a hash of the OBJ contents
+    uint32_t resolution;   //!< voxels per axis, resolution^3 voxels follow the header
+    float origin;          //!< normalized coordinate of the first voxel centre on every axis
+    float voxel_size;
+    float center[3];       //!< mesh bounds centre
+    float scale;           //!< model to normalized scale
+    uint32_t padding;
+};
+
+/*! Signed distance to a closed mesh on a regular voxel grid, with the
+ *  normalized gradient stored next to the distance so a single trilinear
+ *  sample gives both. The mesh is normalized to [-1, 1] on its largest axis,
+ *  distances are negative inside. Baked fields are cached next to the OBJ
+ *  as <file>.swsdf. */
+class SignedDistanceField {
+public:
+    /**
+     * @brief Maps the cached field of ModelFileName, or bakes it from the mesh
+     *        and writes the cache when the cache is missing or out of date.
+     */
+    bool Load( const std::string& ModelFileName, unsigned Resolution = DEFAULT_RESOLUTION );
+
+    /**
+     * @brief Exact distances in a band around every triangle, propagated to
+     *        the rest of the grid by sweeping closest triangles. The sign is a
+     *        vote of ray parity along the three axes, which tolerates small
+     *        holes in the mesh.
+     */
+    void Bake( const std::vector< glm::vec3 >& Positions, const std::vector< unsigned >& Indices,
+               unsigned Resolution );
+
+    /**
+     * @brief Trilinear sample at a normalized Position. Outside the grid the
+     *        distance to the grid is added.
+     *
+     * @return vec4 Gradient in xyz, signed distance in w
+     */
+    vec4 Sample( const vec4& Position ) const noexcept;
+
+    //! Model space to normalized space, for drawing the mesh the field was baked from
+    glm::mat4 GetNormalization() const;
+
+    bool IsLoaded() const;
+    size_t GetMemory() const;
+
+    static std::string CachePath( const std::string& SourceFile );
+
+    static constexpr uint32_t VERSION = 1;
+    static constexpr unsigned DEFAULT_RESOLUTION = 64;
+    static constexpr unsigned PADDING = 3; //!< voxels around the normalized bounds
+
+private:
+    bool ReadCache( const std::string& SourceFile, unsigned Resolution );
+    bool WriteCache( const std::string& SourceFile ) const;
+
+    unsigned resolution = 0;
+    float origin = 0.f;
+    float voxel_size = 1.f;
+    glm::vec3 center{ 0.f };
+    float scale = 1.f;
+
+    std::vector< vec4 > voxels; //!< x fastest, then y, then z
+};
+
+static_assert( sizeof( SdfCacheHeader ) % 16 == 0, "Voxels following the header must stay aligned" );
+static_assert( sizeof( vec4 ) == 4 * sizeof( float ), "Voxels are read and written as raw floats" );
+
+#endif
@@ -66,11 +66,37 @@ unsigned ShaderManager::GetShader( const std::string& VertexFile, const std::str
     glDeleteShader( fragmentShader );
 
     shader_list[VertexFile + FragmentFile] = shaderProgram;
-    program_list[shaderProgram] = VertexFile + FragmentFile;
+    SetupProgram( shaderProgram, VertexFile + FragmentFile );
 
     return shaderProgram;
 }
 
+void ShaderManager::SetupProgram( unsigned ShaderID, const std::string& Name ) {
+    static constexpr std::array< const char*, UNIFORM_COUNT > uniformNames = {
+        "model",
+        "scale",
+        "instanceExtent",
+        "speedScale",
+    };
+
+    Program& program = program_list[ShaderID];
+    program.name = Name;
+    program.id = ShaderID;
+
+    for ( int i = 0; i < UNIFORM_COUNT; ++i ) {
+        program.uniforms[i] = glGetUniformLocation( ShaderID, uniformNames[i] );
+    }
+
+    unsigned cameraBlock = glGetUniformBlockIndex( ShaderID, "Camera" );
+    if ( cameraBlock != GL_INVALID_INDEX ) {
+        glUniformBlockBinding( ShaderID, cameraBlock, CAMERA_BLOCK_BINDING );
+    }
+}
+
+Program& ShaderManager::GetProgram( unsigned ShaderID ) {
+    return program_list[ShaderID];
+}
+
 void ShaderManager::DetachShader() {
     glUseProgram( 0 );
 }
@@ -79,7 +105,7 @@ void ShaderManager::DestroyShader( unsigned ShaderID ) {
     glDeleteProgram( ShaderID );
 
     auto iter = program_list.find( ShaderID );
-    shader_list.erase( iter->second );
+    shader_list.erase( iter->second.name );
 
     program_list.erase( ShaderID );
 }
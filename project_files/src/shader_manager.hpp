@@ -4,12 +4,34 @@
 #pragma once
 
 // std includes
+#include <array>
 #include <unordered_map>
 #include <string>
 
+//! Uniforms set on every draw, their locations are looked up once at link time
+enum UniformName {
+    UNIFORM_MODEL,
+    UNIFORM_SCALE,
+    UNIFORM_INSTANCE_EXTENT,
+    UNIFORM_SPEED_SCALE,
+    UNIFORM_COUNT,
+};
+
+//! Uniform block binding points shared by every program
+enum UniformBlockBinding {
+    CAMERA_BLOCK_BINDING = 0,
+};
+
+struct Program {
+    std::string name;
+    unsigned id = 0;
+    std::array< int, UNIFORM_COUNT > uniforms; //!< -1 when not used by the program
+};
+
 class ShaderManager {
 public:
     unsigned GetShader( const std::string& VertexFile, const std::string& FragmentFile );
+    Program& GetProgram( unsigned ShaderID );
     void DetachShader();
     void DestroyShader( unsigned ShaderID );
 
@@ -21,7 +43,9 @@ public:
 
 private:
     std::unordered_map< std::string, unsigned > shader_list;
-    std::unordered_map< unsigned, std::string > program_list;
+    void SetupProgram( unsigned ShaderID, const std::string& Name );
+
+    std::unordered_map< unsigned, Program > program_list;
     std::unordered_map< std::string, std::string > source_list;
 };
 
@@ -0,0 +1,48 @@
+#ifndef SPSC_QUEUE_HPP
+#define SPSC_QUEUE_HPP
+#pragma once
+
+// std includes
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+/*! Bounded lock-free queue for exactly one producer and one consumer thread */
+template < typename T, size_t Capacity >
+class SpscQueue {
+public:
+    static_assert( ( Capacity & ( Capacity - 1 ) ) == 0, "Capacity must be a power of two" );
+
+    //! Producer only, false when the queue is full
+    bool Push( T&& Value ) {
+        const size_t currTail = tail.load( std::memory_order_relaxed );
+        if ( currTail - head.load( std::memory_order_acquire ) == Capacity ) {
+            return false;
+        }
+
+        slots[currTail & ( Capacity - 1 )] = std::move( Value );
+        tail.store( currTail + 1, std::memory_order_release );
+        return true;
+    }
+
+    //! Consumer only, false when the queue is empty
+    bool Pop( T& Value ) {
+        const size_t currHead = head.load( std::memory_order_relaxed );
+        if ( currHead == tail.load( std::memory_order_acquire ) ) {
+            return false;
+        }
+
+        Value = std::move( slots[currHead & ( Capacity - 1 )] );
+        head.store( currHead + 1, std::memory_order_release );
+        return true;
+    }
+
+private:
+    std::array< T, Capacity > slots;
+
+    alignas( 64 ) std::atomic< size_t > head{ 0 }; //!< next slot to pop
+    alignas( 64 ) std::atomic< size_t > tail{ 0 }; //!< next slot to push
+};
+
+#endif
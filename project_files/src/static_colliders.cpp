@@ -0,0 +1,290 @@
+
+// std includes
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// System includes
+#include <fmt/core.h>
+
+// Local includes
+#include "static_colliders.hpp"
+#include "model_manager.hpp"
+#include "sdf.hpp"
+#include "trace.hpp"
+
+static float SurfaceArea( const glm::vec3& Min, const glm::vec3& Max ) noexcept {
+    const glm::vec3 extent = Max - Min;
+    return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+}
+
+static bool Overlaps( const BvhNode& Node, const glm::vec3& Min, const glm::vec3& Max ) noexcept {
+    return Node.min.x <= Max.x && Node.max.x >= Min.x && Node.min.y <= Max.y && Node.max.y >= Min.y &&
+           Node.min.z <= Max.z && Node.max.z >= Min.z;
+}
+
+bool StaticColliders::Add( const std::string& ModelFileName, const glm::mat4& Transform ) {
+    std::vector< glm::vec3 > positions;
+    std::vector< unsigned > indices;
+    if ( !ModelManager::Instance().GetTriangles( ModelFileName, positions, indices ) ) {
+        Trace::Message( fmt::format( "Static collider {} could not be loaded", ModelFileName ) );
+        return false;
+    }
+
+    AddTriangles( positions, indices, Transform );
+    return true;
+}
+
+void StaticColliders::AddTriangles( const std::vector< glm::vec3 >& Positions,
+                                    const std::vector< unsigned >& Indices, const glm::mat4& Transform ) {
+    triangles.reserve( triangles.size() + Indices.size() / 3 );
+
+    for ( size_t i = 0; i + 2 < Indices.size(); i += 3 ) {
+        ColliderTriangle triangle;
+        triangle.a = glm::vec3( Transform * glm::vec4( Positions[Indices[i]], 1.f ) );
+        triangle.b = glm::vec3( Transform * glm::vec4( Positions[Indices[i + 1]], 1.f ) );
+        triangle.c = glm::vec3( Transform * glm::vec4( Positions[Indices[i + 2]], 1.f ) );
+
+        const glm::vec3 normal = glm::cross( triangle.b - triangle.a, triangle.c - triangle.a );
+        const float length = glm::length( normal );
+        if ( length <= FLT_EPSILON ) {
+            continue;
+        }
+
+        triangle.normal = normal / length;
+        triangles.push_back( triangle );
+    }
+}
+
+void StaticColliders::Build() {
+    nodes.clear();
+    if ( triangles.empty() ) {
+        return;
+    }
+
+    centroids.resize( triangles.size() );
+    for ( size_t i = 0; i < triangles.size(); ++i ) {
+        centroids[i] = ( triangles[i].a + triangles[i].b + triangles[i].c ) * ( 1.f / 3.f );
+    }
+
+    // A binary tree with leaves of at least one triangle never needs more nodes
+    nodes.reserve( triangles.size() * 2 );
+    nodes.push_back( { glm::vec3( 0.f ), 0, glm::vec3( 0.f ), static_cast< unsigned >( triangles.size() ) } );
+    UpdateBounds( nodes[0] );
+    Subdivide( 0, 0 );
+
+    centroids.clear();
+    centroids.shrink_to_fit();
+    nodes.shrink_to_fit();
+}
+
+void StaticColliders::UpdateBounds( BvhNode& Node ) const {
+    Node.min = glm::vec3( FLT_MAX );
+    Node.max = glm::vec3( -FLT_MAX );
+
+    for ( unsigned i = Node.first; i < Node.first + Node.count; ++i ) {
+        const ColliderTriangle& triangle = triangles[i];
+        Node.min = glm::min( Node.min, glm::min( triangle.a, glm::min( triangle.b, triangle.c ) ) );
+        Node.max = glm::max( Node.max, glm::max( triangle.a, glm::max( triangle.b, triangle.c ) ) );
+    }
+}
+
+void StaticColliders::Subdivide( unsigned NodeIndex, unsigned Depth ) {
+    const unsigned first = nodes[NodeIndex].first;
+    const unsigned count = nodes[NodeIndex].count;
+    if ( count <= LEAF_SIZE || Depth + 2 >= MAX_DEPTH ) {
+        return;
+    }
+
+    glm::vec3 centroidMin( FLT_MAX );
+    glm::vec3 centroidMax( -FLT_MAX );
+    for ( unsigned i = first; i < first + count; ++i ) {
+        centroidMin = glm::min( centroidMin, centroids[i] );
+        centroidMax = glm::max( centroidMax, centroids[i] );
+    }
+
+    struct Bin {
+        glm::vec3 min{ FLT_MAX };
+        glm::vec3 max{ -FLT_MAX };
+        unsigned count = 0;
+    };
+
+    // Splitting between two bins costs the area of each side times its triangles
+    int bestAxis = -1;
+    unsigned bestSplit = 0;
+    float bestCost = FLT_MAX;
+    for ( int axis = 0; axis < 3; ++axis ) {
+        const float extent = centroidMax[axis] - centroidMin[axis];
+        if ( extent <= 0.f ) {
+            continue;
+        }
+
+        Bin bins[SAH_BINS];
+        const float binScale = SAH_BINS / extent;
+        for ( unsigned i = first; i < first + count; ++i ) {
+            const unsigned bin = std::min( static_cast< unsigned >( ( centroids[i][axis] - centroidMin[axis] ) *
+                                                                    binScale ),
+                                           SAH_BINS - 1 );
+            const ColliderTriangle& triangle = triangles[i];
+            bins[bin].min = glm::min( bins[bin].min, glm::min( triangle.a, glm::min( triangle.b, triangle.c ) ) );
+            bins[bin].max = glm::max( bins[bin].max, glm::max( triangle.a, glm::max( triangle.b, triangle.c ) ) );
+            ++bins[bin].count;
+        }
+
+        float leftArea[SAH_BINS - 1];
+        unsigned leftCount[SAH_BINS - 1];
+        Bin left;
+        for ( unsigned split = 0; split < SAH_BINS - 1; ++split ) {
+            left.min = glm::min( left.min, bins[split].min );
+            left.max = glm::max( left.max, bins[split].max );
+            left.count += bins[split].count;
+            leftArea[split] = left.count ? SurfaceArea( left.min, left.max ) : 0.f;
+            leftCount[split] = left.count;
+        }
+
+        Bin right;
+        for ( unsigned split = SAH_BINS - 1; split > 0; --split ) {
+            right.min = glm::min( right.min, bins[split].min );
+            right.max = glm::max( right.max, bins[split].max );
+            right.count += bins[split].count;
+
+            const float rightArea = right.count ? SurfaceArea( right.min, right.max ) : 0.f;
+            const float cost = leftCount[split - 1] * leftArea[split - 1] + right.count * rightArea;
+            if ( cost < bestCost ) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = split - 1;
+            }
+        }
+    }
+
+    const float leafCost = count * SurfaceArea( nodes[NodeIndex].min, nodes[NodeIndex].max );
+    if ( bestAxis < 0 || bestCost >= leafCost ) {
+        return;
+    }
+
+    // Partition with the same binning the costs were computed with
+    const float binScale = SAH_BINS / ( centroidMax[bestAxis] - centroidMin[bestAxis] );
+    unsigned i = first;
+    unsigned j = first + count;
+    while ( i < j ) {
+        const unsigned bin = std::min(
+            static_cast< unsigned >( ( centroids[i][bestAxis] - centroidMin[bestAxis] ) * binScale ),
+            SAH_BINS - 1 );
+        if ( bin <= bestSplit ) {
+            ++i;
+        } else {
+            --j;
+            std::swap( triangles[i], triangles[j] );
+            std::swap( centroids[i], centroids[j] );
+        }
+    }
+
+    const unsigned leftCount = i - first;
+    if ( leftCount == 0 || leftCount == count ) {
+        return;
+    }
+
+    const unsigned leftChild = static_cast< unsigned >( nodes.size() );
+    nodes.push_back( { glm::vec3( 0.f ), first, glm::vec3( 0.f ), leftCount } );
+    nodes.push_back( { glm::vec3( 0.f ), i, glm::vec3( 0.f ), count - leftCount } );
+    UpdateBounds( nodes[leftChild] );
+    UpdateBounds( nodes[leftChild + 1] );
+
+    nodes[NodeIndex].first = leftChild;
+    nodes[NodeIndex].count = 0;
+
+    Subdivide( leftChild, Depth + 1 );
+    Subdivide( leftChild + 1, Depth + 1 );
+}
+
+void StaticColliders::Query( const glm::vec3& Min, const glm::vec3& Max,
+                             std::vector< unsigned >& Triangles ) const {
+    if ( nodes.empty() ) {
+        return;
+    }
+
+    unsigned stack[MAX_DEPTH];
+    unsigned top = 0;
+    stack[top++] = 0;
+
+    while ( top > 0 ) {
+        const BvhNode& node = nodes[stack[--top]];
+        if ( !Overlaps( node, Min, Max ) ) {
+            continue;
+        }
+
+        if ( node.count > 0 ) {
+            for ( unsigned i = node.first; i < node.first + node.count; ++i ) {
+                Triangles.push_back( i );
+            }
+        } else {
+            stack[top++] = node.first;
+            stack[top++] = node.first + 1;
+        }
+    }
+}
+
+size_t StaticColliders::Collide( Verlet** Cell, int Count, float Radius,
+                                 std::vector< unsigned >& Candidates ) const {
+    glm::vec3 cellMin( FLT_MAX );
+    glm::vec3 cellMax( -FLT_MAX );
+    for ( int a = 0; a < Count; ++a ) {
+        const glm::vec3 position( Cell[a]->position.x, Cell[a]->position.y, Cell[a]->position.z );
+        cellMin = glm::min( cellMin, position );
+        cellMax = glm::max( cellMax, position );
+    }
+
+    Candidates.clear();
+    Query( cellMin - glm::vec3( Radius ), cellMax + glm::vec3( Radius ), Candidates );
+    if ( Candidates.empty() ) {
+        return 0;
+    }
+
+    const float radiusSquared = Radius * Radius;
+    for ( int a = 0; a < Count; ++a ) {
+        Verlet* verlet = Cell[a];
+        glm::vec3 position( verlet->position.x, verlet->position.y, verlet->position.z );
+
+        // Contacts are resolved one after another, later triangles see the corrected position
+        bool moved = false;
+        for ( unsigned index : Candidates ) {
+            const ColliderTriangle& triangle = triangles[index];
+            const glm::vec3 offset = position - ClosestPointOnTriangle( position, triangle.a, triangle.b,
+                                                                        triangle.c );
+            const float distanceSquared = glm::dot( offset, offset );
+            if ( distanceSquared >= radiusSquared ) {
+                continue;
+            }
+
+            const float distance = std::sqrt( distanceSquared );
+            const glm::vec3 normal = distance > FLT_EPSILON ? offset / distance : triangle.normal;
+            position += normal * ( Radius - distance );
+            moved = true;
+        }
+
+        if ( moved ) {
+            verlet->position.x = position.x;
+            verlet->position.y = position.y;
+            verlet->position.z = position.z;
+        }
+    }
+
+    return static_cast< size_t >( Count ) * Candidates.size();
+}
+
+bool StaticColliders::IsEmpty() const {
+    return triangles.empty();
+}
+
+size_t StaticColliders::GetTriangleCount() const {
+    return triangles.size();
+}
+
+size_t StaticColliders::GetNodeCount() const {
+    return nodes.size();
+}
+
+size_t StaticColliders::GetMemory() const {
+    return triangles.capacity() * sizeof( ColliderTriangle ) + nodes.capacity() * sizeof( BvhNode );
+}
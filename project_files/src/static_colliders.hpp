@@ -0,0 +1,78 @@
+#ifndef STATIC_COLLIDERS_HPP
+#define STATIC_COLLIDERS_HPP
+#pragma once
+
+// std includes
+#include <string>
+#include <vector>
+
+// System includes
+#include <glm/glm.hpp>
+
+// Local includes
+#include "verlet.hpp"
+
+struct ColliderTriangle {
+    glm::vec3 a;
+    glm::vec3 b;
+    glm::vec3 c;
+    glm::vec3 normal; //!< unit, pushes out particles whose centre lies on the triangle
+};
+
+//! 32 byte BVH node, the two children of an inner node are stored next to each other
+struct BvhNode {
+    glm::vec3 min;
+    unsigned first; //!< first child of an inner node, first triangle of a leaf
+    glm::vec3 max;
+    unsigned count; //!< triangles of a leaf, 0 for inner nodes
+};
+
+/*! Static triangle meshes particles collide with, such as ramps and pillars.
+ *  Triangles are added in world space and a BVH is built over them once,
+ *  after that the set is only read, so the solver threads share it. */
+class StaticColliders {
+public:
+    //! Adds the triangles of a model loaded through ModelManager, placed by Transform
+    bool Add( const std::string& ModelFileName, const glm::mat4& Transform );
+
+    void AddTriangles( const std::vector< glm::vec3 >& Positions, const std::vector< unsigned >& Indices,
+                       const glm::mat4& Transform );
+
+    /**
+     * @brief Builds the BVH with a binned surface area heuristic. Has to be
+     *        called after the last Add and before the first Collide.
+     */
+    void Build();
+
+    /**
+     * @brief Resolves the contacts of the Count particles of one grid cell.
+     *        The BVH is walked once for the bounds of the whole cell, every
+     *        particle is then tested against the triangles found.
+     *
+     * @param Candidates Scratch list of the calling thread
+     * @return           Particle-triangle tests made
+     */
+    size_t Collide( Verlet** Cell, int Count, float Radius, std::vector< unsigned >& Candidates ) const;
+
+    //! Appends the triangles whose node bounds overlap [Min, Max] to Triangles
+    void Query( const glm::vec3& Min, const glm::vec3& Max, std::vector< unsigned >& Triangles ) const;
+
+    bool IsEmpty() const;
+    size_t GetTriangleCount() const;
+    size_t GetNodeCount() const;
+    size_t GetMemory() const;
+
+    static constexpr unsigned LEAF_SIZE = 4;
+    static constexpr unsigned SAH_BINS = 12;
+    static constexpr unsigned MAX_DEPTH = 64; //!< traversal stack size
+
+private:
+    void Subdivide( unsigned NodeIndex, unsigned Depth );
+    void UpdateBounds( BvhNode& Node ) const;
+
+    std::vector< ColliderTriangle > triangles; //!< reordered by Build so leaves are contiguous
+    std::vector< glm::vec3 > centroids;        //!< build only
+    std::vector< BvhNode > nodes;
+};
+
+#endif
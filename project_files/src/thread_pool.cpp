@@ -0,0 +1,142 @@
+
+// Local includes
+#include "thread_pool.hpp"
+#include "cpu_topology.hpp"
+
+ThreadPool::ThreadPool( unsigned ThreadCount ) {
+    for ( unsigned i = 1; i < ThreadCount; ++i ) {
+        workers.emplace_back( &ThreadPool::WorkerLoop, this, i );
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard< std::mutex > lock( mutex );
+        stopping = true;
+    }
+    work_ready.notify_all();
+
+    for ( std::thread& worker : workers ) {
+        worker.join();
+    }
+}
+
+void ThreadPool::Run( unsigned TaskCount, const std::function< void( unsigned ) >& Task ) {
+    if ( TaskCount == 0 ) {
+        return;
+    }
+
+    if ( !cpus.empty() && pinned_caller != std::this_thread::get_id() ) {
+        CpuTopology::PinCurrentThread( cpus[0] );
+        pinned_caller = std::this_thread::get_id();
+    }
+
+    if ( workers.empty() || TaskCount == 1 ) {
+        for ( unsigned i = 0; i < TaskCount; ++i ) {
+            Task( i );
+        }
+        return;
+    }
+
+    {
+        std::unique_lock< std::mutex > lock( mutex );
+
+        // A worker that woke up late for the previous dispatch may still be leaving it
+        work_done.wait( lock, [this]() {
+            return active == 0;
+        } );
+
+        task = &Task;
+        task_count = TaskCount;
+        fixed_tasks = !cpus.empty() && TaskCount == GetThreadCount();
+        next_task.store( 0, std::memory_order_relaxed );
+        pending = TaskCount;
+        ++generation;
+    }
+    work_ready.notify_all();
+
+    RunTasks( 0 );
+
+    std::unique_lock< std::mutex > lock( mutex );
+    work_done.wait( lock, [this]() {
+        return pending == 0 && active == 0;
+    } );
+    task = nullptr;
+}
+
+unsigned ThreadPool::GetThreadCount() const {
+    return static_cast< unsigned >( workers.size() ) + 1;
+}
+
+void ThreadPool::SetAffinity( const std::vector< int >& Cpus ) {
+    // Unpinning restores every thread, including the last calling thread
+    const bool unpin = Cpus.empty();
+
+    for ( size_t i = 0; i < workers.size(); ++i ) {
+        CpuTopology::PinThread( workers[i], unpin ? -1 : Cpus[( i + 1 ) % Cpus.size()] );
+    }
+
+    if ( unpin && pinned_caller == std::this_thread::get_id() ) {
+        CpuTopology::PinCurrentThread( -1 );
+    }
+
+    cpus = Cpus;
+    pinned_caller = std::thread::id();
+}
+
+bool ThreadPool::IsPinned() const {
+    return !cpus.empty();
+}
+
+void ThreadPool::WorkerLoop( unsigned ThreadIndex ) {
+    uint64_t seenGeneration = 0;
+
+    std::unique_lock< std::mutex > lock( mutex );
+    while ( true ) {
+        work_ready.wait( lock, [this, &seenGeneration]() {
+            return stopping || generation != seenGeneration;
+        } );
+
+        if ( stopping ) {
+            return;
+        }
+
+        seenGeneration = generation;
+        ++active;
+
+        lock.unlock();
+        RunTasks( ThreadIndex );
+        lock.lock();
+
+        if ( --active == 0 ) {
+            work_done.notify_all();
+        }
+    }
+}
+
+void ThreadPool::RunTasks( unsigned ThreadIndex ) {
+    unsigned finished = 0;
+
+    if ( fixed_tasks ) {
+        ( *task )( ThreadIndex );
+        ++finished;
+    }
+
+    while ( !fixed_tasks ) {
+        unsigned index = next_task.fetch_add( 1, std::memory_order_relaxed );
+        if ( index >= task_count ) {
+            break;
+        }
+
+        ( *task )( index );
+        ++finished;
+    }
+
+    if ( finished > 0 ) {
+        std::lock_guard< std::mutex > lock( mutex );
+        pending -= finished;
+        if ( pending == 0 ) {
+            work_done.notify_all();
+        }
+    }
+}
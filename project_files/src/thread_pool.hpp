@@ -0,0 +1,71 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+#pragma once
+
+// std includes
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*! Persistent workers for fork/join style work. Idle workers sleep on a
+ *  condition variable instead of spinning, and no threads are created per
+ *  dispatch. Run() is meant to be called from one thread at a time. */
+class ThreadPool {
+public:
+    /**
+     * @brief Starts ThreadCount - 1 workers, the thread calling Run() is the last one.
+     */
+    explicit ThreadPool( unsigned ThreadCount );
+    ~ThreadPool();
+
+    ThreadPool( const ThreadPool& ) = delete;
+    ThreadPool& operator=( const ThreadPool& ) = delete;
+
+    /**
+     * @brief Calls Task( i ) for every i in [0, TaskCount) on the workers and
+     *        the calling thread, returns once all of them have finished.
+     */
+    void Run( unsigned TaskCount, const std::function< void( unsigned ) >& Task );
+
+    //! Workers plus the calling thread
+    unsigned GetThreadCount() const;
+
+    /**
+     * @brief Pins thread i to Cpus[i], thread 0 being whichever thread calls
+     *        Run(). While pinned, a dispatch of GetThreadCount() tasks runs
+     *        task i on thread i, so memory a task first touches stays local to
+     *        the thread that keeps working on it. An empty list unpins.
+     *        Called between dispatches from the thread that calls Run().
+     */
+    void SetAffinity( const std::vector< int >& Cpus );
+    bool IsPinned() const;
+
+private:
+    void WorkerLoop( unsigned ThreadIndex );
+    void RunTasks( unsigned ThreadIndex );
+
+    std::vector< std::thread > workers;
+
+    std::mutex mutex;
+    std::condition_variable work_ready;
+    std::condition_variable work_done;
+
+    const std::function< void( unsigned ) >* task = nullptr;
+    unsigned task_count = 0;
+    std::atomic< unsigned > next_task{ 0 };
+
+    unsigned pending = 0;    //!< tasks of the current dispatch not finished yet
+    unsigned active = 0;     //!< workers inside RunTasks
+    uint64_t generation = 0; //!< incremented for every dispatch
+    bool stopping = false;
+
+    std::vector< int > cpus;       //!< per thread, empty when not pinned
+    bool fixed_tasks = false;      //!< the current dispatch maps task i to thread i
+    std::thread::id pinned_caller; //!< calling thread cpus[0] was applied to
+};
+
+#endif
@@ -27,6 +27,14 @@ struct Timer {
     void Start() {
         start = std::chrono::steady_clock::now();
     }
+    //! Milliseconds since Start() or the previous Lap(), restarts the measurement
+    float Lap() {
+        end = std::chrono::steady_clock::now();
+        float milliseconds = std::chrono::duration< float, std::milli >( end - start ).count();
+        start = end;
+        return milliseconds;
+    }
+
     void End( std::string message ) {
         end = std::chrono::steady_clock::now();
         duration = end - start;
@@ -0,0 +1,54 @@
+#ifndef TRIPLE_BUFFER_HPP
+#define TRIPLE_BUFFER_HPP
+#pragma once
+
+// std includes
+#include <array>
+#include <atomic>
+
+/*! Lock-free hand over of whole states from one writer to one reader. The
+ *  writer fills Back() and publishes it, the reader always sees the most
+ *  recently published state and never waits for the writer. */
+template < typename T >
+class TripleBuffer {
+public:
+    //! Buffers are set up before either side starts (e.g. sized for the maximum)
+    template < typename TFunction >
+    void ForEach( TFunction&& Function ) {
+        for ( T& buffer : buffers ) {
+            Function( buffer );
+        }
+    }
+
+    //! Writer only, contents are whatever was written there two publishes ago
+    T& Back() {
+        return buffers[back];
+    }
+
+    //! Writer only, hands Back() to the reader and takes over the unused buffer
+    void Publish() {
+        unsigned previous = middle.exchange( back | FRESH_BIT, std::memory_order_acq_rel );
+        back = previous & INDEX_MASK;
+    }
+
+    //! Reader only, latest published state (stays valid until the next call)
+    const T& Front() {
+        if ( middle.load( std::memory_order_relaxed ) & FRESH_BIT ) {
+            unsigned previous = middle.exchange( front, std::memory_order_acq_rel );
+            front = previous & INDEX_MASK;
+        }
+        return buffers[front];
+    }
+
+private:
+    static constexpr unsigned INDEX_MASK = 0x3;
+    static constexpr unsigned FRESH_BIT = 0x4; //!< middle was published but not read yet
+
+    std::array< T, 3 > buffers;
+
+    unsigned back = 0;
+    std::atomic< unsigned > middle{ 1 };
+    unsigned front = 2;
+};
+
+#endif
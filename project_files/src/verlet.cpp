@@ -1,7 +1,10 @@
 
 // std includes
 #include <functional>
+#include <cmath>
 #include <algorithm>
+#include <cfloat>
+#include <numeric>
 
 // System headers
 #include <GLFW/glfw3.h>
@@ -21,47 +24,97 @@
 #include "editor.hpp"
 #include "octree.hpp"
 #include "kdtree.hpp"
+#include "instance_buffer.hpp"
+#include "camera.hpp"
+#include "thread_pool.hpp"
 #include "timer.hpp"
+#include "benchmark.hpp"
+#include "cpu_topology.hpp"
+#include "sdf.hpp"
+#include "static_colliders.hpp"
+#include "barnes_hut.hpp"
 
 void VerletManager::CreateVerlets( ContainerShape CShape ) {
     THREAD_COUNT = std::thread::hardware_concurrency();
     Trace::Message( fmt::format( "Thread count: {}", std::thread::hardware_concurrency() ) );
-    for ( int i = 0; i < THREAD_COUNT; ++i ) {
-        threads.emplace_back();
-    }
 
-    projection = Graphics::Instance().GetProjection();
+    // Both run on all cores, they are mostly parked and only one is busy at a time
+    solver_pool = std::make_unique< ThreadPool >( THREAD_COUNT );
+    render_pool = std::make_unique< ThreadPool >( THREAD_COUNT );
+    thread_lod_counts.resize( THREAD_COUNT );
+    collider_candidates.resize( THREAD_COUNT );
+    thread_collider_tests.resize( THREAD_COUNT );
+    thread_killed.resize( THREAD_COUNT );
+    thread_sleeping.resize( THREAD_COUNT );
+    thread_travel.resize( THREAD_COUNT );
 
     Graphics::Instance().AddRenderCallback( std::bind( &VerletManager::DrawVerlets, this ) );
     Engine::Instance().AddFixedUpdateCallback( std::bind( &VerletManager::Update, this ) );
+    Engine::Instance().AddUpdateCallback( std::bind( &VerletManager::FrameUpdate, this ) );
     Editor::Instance().AddDisplayMenuCallback( std::bind( &VerletManager::DisplayMenu, this ) );
 
     Input::Instance().AddCallback( GLFW_KEY_V, std::bind( &VerletManager::AddVerlet, this ) );
     Input::Instance().AddCallback( GLFW_KEY_G, std::bind( &VerletManager::ApplyForce, this ) );
     Input::Instance().AddCallback( GLFW_KEY_H, std::bind( &VerletManager::ToggleForce, this ) );
 
-    unsigned instance_shader = ShaderManager::Instance().GetShader( "shaders/instance_vertex.glsl",
-                                                                    "shaders/instance_fragment.glsl" );
-
-    model = ModelManager::Instance().GetModel( "models/sphere.obj", instance_shader, true );
+    SetupInstances();
 
     dt = Engine::Instance().GetFixedTimeStep();
+    step_dt = dt;
 
     octree = std::make_unique< Octree >();
+    octree->SetThreadPool( solver_pool.get() );
     octree->SetVerletCollisionCallback( std::bind(
         &VerletManager::CheckCollisionBetweenVerlets, this,
         std::placeholders::_1, std::placeholders::_2 ) );
 
+    barnes_hut = std::make_unique< BarnesHutTree >();
+    barnes_hut->SetThreadPool( solver_pool.get() );
+
     SetupContainer( CShape );
+    settings = menu_settings;
+    force_set.Compile( settings.force_fields );
     SetupVerlets();
 }
 
+void VerletManager::Shutdown() {
+    if ( instance_buffer ) {
+        instance_buffer->Shutdown();
+    }
+
+    solver_pool.reset();
+    render_pool.reset();
+}
+
+void VerletManager::SetupInstances() {
+    unsigned instance_shader = ShaderManager::Instance().GetShader( "shaders/instance_vertex.glsl",
+                                                                    "shaders/instance_fragment.glsl" );
+
+    const InstanceFormat format = packed_instances ? InstanceFormat::Packed16
+                                                   : InstanceFormat::Float32;
+
+    static constexpr const char* lodFiles[LOD_COUNT] = { "models/sphere.obj",
+                                                         "models/ico_sphere.obj" };
+    for ( unsigned i = 0; i < LOD_COUNT; ++i ) {
+        lod_models[i] = ModelManager::Instance().GetModel( lodFiles[i], instance_shader, true, format );
+    }
+
+    impostor_shader = ShaderManager::Instance().GetShader( "shaders/impostor_vertex.glsl",
+                                                           "shaders/impostor_fragment.glsl" );
+
+    if ( !instance_buffer ) {
+        instance_buffer = std::make_unique< InstanceBuffer >();
+    }
+    instance_buffer->Initialize( InstanceStride( format ),
+                                 std::max( drawn_count, INITIAL_INSTANCES ) );
+}
+
 void VerletManager::SetupVerletPosition( Verlet* verlet, int i ) {
     float x = static_cast< float >( glm::sin( i ) *
-                                    ( container.collision_radius * ( 2.f / 3.f ) ) );
+                                    ( settings.container_radius * ( 2.f / 3.f ) ) );
     float y = static_cast< float >( rand() % ( 2 ) + 1 );
     float z = static_cast< float >( glm::cos( i ) *
-                                    ( container.collision_radius * ( 2.f / 3.f ) ) );
+                                    ( settings.container_radius * ( 2.f / 3.f ) ) );
 
     vec_set_f( verlet->position, x, y, z );
     vec_set_f( verlet->old_position, x * 0.999f, y, z * 0.999f );
@@ -70,41 +123,149 @@ void VerletManager::SetupVerletPosition( Verlet* verlet, int i ) {
 
 void VerletManager::SetupVerlets() {
     curr_count = 0;
+    free_slots.clear();
+    std::fill( alive.begin(), alive.end(), 0 );
+    WakeAll();
 
-    for ( unsigned i = 0; i < MAX; ++i ) {
-        if ( !verlet_list[i] ) {
-            verlet_list[i] = std::make_unique< Verlet >();
-        }
-
-        SetupVerletPosition( verlet_list[i].get(), i );
+    for ( unsigned i = 0; i < verlet_list.GetCapacity(); ++i ) {
+        SetupVerletPosition( &verlet_list[i], i );
     }
 }
 
-void VerletManager::SetupContainer( ContainerShape CShape ) {
+void VerletManager::SetupContainer( ContainerShape CShape, const std::string& FieldFile ) {
     unsigned cShader = ShaderManager::Instance().GetShader( "shaders/base_vertex.glsl",
                                                             "shaders/base_fragment.glsl" );
 
+    std::shared_ptr< const SignedDistanceField > field;
+    if ( CShape == MeshField ) {
+        auto loaded = std::make_shared< SignedDistanceField >();
+        if ( !loaded->Load( FieldFile ) ) {
+            Trace::Message( fmt::format( "Keeping the current container, no field for {}", FieldFile ) );
+            return;
+        }
+        field = std::move( loaded );
+    }
+
     container.shape = CShape;
+    container.field_file = FieldFile;
+    container.field = field;
+    menu_settings.container_shape = CShape;
+    menu_settings.container_radius = container.collision_radius;
+
+    // Commands run in order, the field is in place before the settings selecting it
+    PushCommand( [this, field]() {
+        container_field = field;
+    } );
+    PushSettings();
+
     switch ( container.shape ) {
     case Sphere:
         container.model = ModelManager::Instance().GetModel( "models/sphere.obj", GL_POINTS,
                                                              cShader, false );
-        container.model_radius = container.collision_radius * 1.02f;
         break;
     case Cube:
         container.model = ModelManager::Instance().GetModel( "models/cube.obj", GL_TRIANGLES,
                                                              cShader, false );
+        break;
+    case MeshField:
+        container.model = ModelManager::Instance().GetModel( FieldFile, GL_POINTS, cShader, false );
+        break;
+    }
+
+    UpdateContainerMatrix();
+}
+
+void VerletManager::UpdateContainerMatrix() {
+    switch ( container.shape ) {
+    case Sphere:
+        container.model_radius = container.collision_radius * 1.02f;
+        break;
+    case Cube:
         container.model_radius = container.collision_radius * 2.f + 0.15f * 3.f;
         break;
+    case MeshField:
+        container.model_radius = container.collision_radius;
+        break;
     }
 
     container.matrix = glm::scale( glm::mat4( 1.f ), { container.model_radius,
                                                        container.model_radius,
                                                        container.model_radius } );
+
+    if ( container.shape == MeshField && container.field ) {
+        container.matrix = container.matrix * container.field->GetNormalization();
+    }
+}
+
+void VerletManager::SetupObstacles( int Preset ) {
+    unsigned cShader = ShaderManager::Instance().GetShader( "shaders/base_vertex.glsl",
+                                                            "shaders/base_fragment.glsl" );
+
+    struct Placement {
+        const char* file;
+        glm::mat4 matrix;
+    };
+    std::vector< Placement > placements;
+
+    const glm::mat4 identity( 1.f );
+    switch ( Preset ) {
+    case 1: // Two ramps crossing the container, the unit cube spans [-0.5, 0.5]
+        placements.push_back( { "models/cube.obj",
+                                glm::scale( glm::rotate( glm::translate( identity, { -1.5f, 1.5f, 0.f } ),
+                                                         glm::radians( -20.f ), { 0.f, 0.f, 1.f } ),
+                                            { 6.f, 0.3f, 4.f } ) } );
+        placements.push_back( { "models/cube.obj",
+                                glm::scale( glm::rotate( glm::translate( identity, { 1.5f, -1.5f, 0.f } ),
+                                                         glm::radians( 20.f ), { 0.f, 0.f, 1.f } ),
+                                            { 6.f, 0.3f, 4.f } ) } );
+        break;
+    case 2: // Four pillars, the cylinder has radius 0.25 along z in [-1, 1]
+        for ( float x : { -2.5f, 2.5f } ) {
+            for ( float z : { -2.5f, 2.5f } ) {
+                placements.push_back( { "models/cylinder.obj",
+                                        glm::scale( glm::rotate( glm::translate( identity, { x, 0.f, z } ),
+                                                                 glm::radians( 90.f ), { 1.f, 0.f, 0.f } ),
+                                                    { 2.f, 2.f, 4.f } ) } );
+            }
+        }
+        break;
+    case 3:
+        placements.push_back( { "models/monkey.obj", glm::scale( identity, { 1.2f, 1.2f, 1.2f } ) } );
+        break;
+    default:
+        break;
+    }
+
+    auto set = std::make_shared< StaticColliders >();
+    obstacles.clear();
+    for ( const Placement& placement : placements ) {
+        if ( set->Add( placement.file, placement.matrix ) ) {
+            obstacles.push_back( { ModelManager::Instance().GetModel( placement.file, GL_TRIANGLES, cShader,
+                                                                      false ),
+                                   placement.matrix } );
+        }
+    }
+
+    Timer buildTimer;
+    buildTimer.Start();
+    set->Build();
+    Trace::Message( fmt::format( "Static colliders: {} triangles, {} BVH nodes in {:.2f} ms",
+                                 set->GetTriangleCount(), set->GetNodeCount(), buildTimer.Lap() ) );
+
+    obstacle_preset = Preset;
+
+    std::shared_ptr< const StaticColliders > shared;
+    if ( !set->IsEmpty() ) {
+        shared = std::move( set );
+    }
+    PushCommand( [this, shared]() {
+        colliders = shared;
+        WakeAll();
+    } );
 }
 
 void VerletManager::AddVerlet() {
-    if ( add_timer < add_cooldown || curr_count >= MAX ) {
+    if ( add_timer < add_cooldown || drawn_count >= menu_settings.max_count ) {
         return;
     }
 
@@ -112,40 +273,68 @@ void VerletManager::AddVerlet() {
         return;
     }
 
-    curr_count = std::clamp( curr_count + amount_to_add, static_cast< unsigned >( 0 ), MAX );
+    const unsigned amount = amount_to_add;
+    PushCommand( [this, amount]() {
+        SetCount( std::min( AliveCount() + amount, settings.max_count ) );
+    } );
     add_timer = 0.f;
 }
 
 void VerletManager::RemoveVerlet() {
-    if ( add_timer < add_cooldown || curr_count <= 0 ) {
+    if ( add_timer < add_cooldown || drawn_count <= 0 ) {
         return;
     }
 
-    unsigned lastCount = curr_count;
-    curr_count = std::clamp( curr_count - amount_to_add, static_cast< unsigned >( 0 ), MAX );
+    const unsigned amount = amount_to_add;
+    PushCommand( [this, amount]() {
+        const unsigned count = AliveCount();
+        SetCount( count > amount ? count - amount : 0 );
+    } );
     add_timer = 0.f;
-
-    for ( unsigned i = lastCount; i > curr_count; --i ) {
-        SetupVerletPosition( verlet_list[i].get(), i );
-    }
 }
 
 void VerletManager::ApplyForce() {
-    if ( force_toggle ) {
+    if ( menu_settings.force_toggle ) {
         return;
     }
 
-    for ( unsigned i = 0; i < curr_count; ++i ) {
-        Verlet* verlet = verlet_list[i].get();
+    PushCommand( [this]() {
+        AddFieldForces();
+    } );
+}
+
+void VerletManager::AddFieldForces() noexcept {
+    // A single push is no steady force, sleeping particles have to feel it
+    WakeAll();
+    ApplyFields( 0, curr_count );
+
+    // Integrated in the first substep only, scaled so the push is worth a whole step
+    if ( substep_count > 1 ) {
+        for ( unsigned i = 0; i < curr_count; ++i ) {
+            verlet_list[i].acceleration = vec_mul_f( verlet_list[i].acceleration,
+                                                     static_cast< float >( substep_count ) );
+        }
+    }
+}
 
-        vec4 disp = vec_sub( verlet->position, force_position );
-        float dist = vec_length( disp );
+void VerletManager::WakeAll() noexcept {
+    std::fill( sleeping.begin(), sleeping.end(), 0 );
+    std::fill( rest_steps.begin(), rest_steps.end(), 0 );
+}
 
-        if ( dist > 0 ) {
-            vec4 norm = vec_divide_f( disp, dist );
-            norm = vec_mul_f( norm, -30.f );
-            verlet->acceleration = vec_add( verlet->acceleration, norm );
+void VerletManager::ApplyFields( unsigned Start, unsigned End ) noexcept {
+    if ( force_set.IsEmpty() ) {
+        return;
+    }
+
+    const float inverseDt = 1.f / step_dt;
+    Verlet* group[ForceFieldSet::WIDTH];
+    for ( unsigned i = Start; i < End; i += ForceFieldSet::WIDTH ) {
+        const unsigned groupCount = std::min( ForceFieldSet::WIDTH, End - i );
+        for ( unsigned j = 0; j < groupCount; ++j ) {
+            group[j] = &verlet_list[i + j];
         }
+        force_set.Apply( group, groupCount, inverseDt );
     }
 }
 
@@ -154,10 +343,46 @@ void VerletManager::ToggleForce() {
         return;
     }
 
-    force_toggle = !force_toggle;
+    menu_settings.force_toggle = !menu_settings.force_toggle;
+    PushSettings();
     toggle_timer = 0.f;
 }
 
+void VerletManager::PushCommand( std::function< void() > Command ) {
+    if ( !commands.Push( std::move( Command ) ) ) {
+        Trace::Message( "Simulation command queue is full, command dropped." );
+    }
+}
+
+bool VerletManager::ProcessCommands() {
+    bool processed = false;
+
+    std::function< void() > command;
+    while ( commands.Pop( command ) ) {
+        command();
+        processed = true;
+    }
+
+    return processed;
+}
+
+void VerletManager::PushSettings() {
+    PushCommand( [this, newSettings = menu_settings]() {
+        settings = newSettings;
+        force_set.Compile( settings.force_fields );
+        // Moved fields, a new container or gravity reach resting particles without a push
+        WakeAll();
+        if ( AliveCount() > settings.max_count ) {
+            SetCount( settings.max_count );
+        }
+    } );
+}
+
+void VerletManager::FrameUpdate() {
+    add_timer += Engine::Instance().GetDeltaTime();
+    toggle_timer += Engine::Instance().GetDeltaTime();
+}
+
 void VerletManager::CheckCollisionsWithKDTree( int ThreadId ) {
     unsigned start = ThreadId * ( curr_count / THREAD_COUNT );
     unsigned end = ( ThreadId + 1 ) * ( curr_count / THREAD_COUNT );
@@ -167,230 +392,1349 @@ void VerletManager::CheckCollisionsWithKDTree( int ThreadId ) {
     }
 
     for ( unsigned i = start; i < end; ++i ) {
-        auto possibleCollisions = kdtree->SphereSearchTree( verlet_list[i]->position, verlet_radius * 4.f );
+        auto possibleCollisions = kdtree->SphereSearchTree( verlet_list[i].position,
+                                                            settings.verlet_radius * 4.f );
         for ( unsigned j = 0; j < possibleCollisions.size(); ++j ) {
             unsigned id = possibleCollisions[j];
             if ( id == i ) {
                 continue;
             }
 
-            CheckCollisionBetweenVerlets( verlet_list[i].get(), verlet_list[id].get() );
+            CheckCollisionBetweenVerlets( &verlet_list[i], &verlet_list[id] );
         }
     }
 }
 
 static Timer timer;
 void VerletManager::Update() {
-    add_timer += Engine::Instance().GetDeltaTime();
-    toggle_timer += Engine::Instance().GetDeltaTime();
+    const bool changed = ProcessCommands();
+
+    if ( settings.auto_count && settings.should_simulate ) {
+        UpdateCountController();
+    } else {
+        controller.count = static_cast< float >( AliveCount() );
+        controller.integral = 0.f;
+        controller.last_error = 0.f;
+    }
+
+    if ( settings.should_simulate ) {
+        UpdateLifecycle();
+    }
 
-    if ( !should_simulate ) {
+    SimulationState& state = states.Back();
+    state.particles.Reserve( curr_count, [this]( size_t First, size_t Last, const auto& Construct ) {
+        FirstTouch( First, Last, curr_count, Construct );
+    } );
+    state.count = curr_count;
+    state.alive_count = AliveCount();
+    state.compactions = compactions;
+    state.capacity = static_cast< unsigned >( verlet_list.GetCapacity() );
+    // All three states grow alike, the others are owned by the reader right now
+    state.solver_memory = verlet_list.GetMemory() + octree->GetMemory() + barnes_hut->GetMemory() +
+                          state.particles.GetMemory() * 3;
+    state.step_time = Engine::Instance().GetStepTime();
+    state.grid_churn = octree->GetChurn();
+    state.grid_rebuilt = octree->WasRebuilt();
+    state.substeps = substep_count;
+    state.time_step = dt;
+    state.penetration = penetration;
+
+    if ( !settings.should_simulate || curr_count <= 0 ) {
+        // Only republish when something changed, a paused step is otherwise free
+        if ( changed || !published_paused ) {
+            WriteState( 0, curr_count, false );
+            state.timings = timings;
+            state.thread_busy = thread_busy;
+            states.Publish();
+            published_paused = true;
+        }
         return;
     }
+    published_paused = false;
+
+    const StepTimings step = SolverStep();
+    UpdateTimeStep();
+
+    // Single steps are noisy (scheduling, other threads), the controller wants the trend
+    static constexpr float SMOOTHING = 0.05f;
+    timings.broadphase += ( step.broadphase - timings.broadphase ) * SMOOTHING;
+    timings.collision += ( step.collision - timings.collision ) * SMOOTHING;
+    timings.colliders += ( step.colliders - timings.colliders ) * SMOOTHING;
+    timings.container += ( step.container - timings.container ) * SMOOTHING;
+    timings.forces += ( step.forces - timings.forces ) * SMOOTHING;
+    timings.integrate += ( step.integrate - timings.integrate ) * SMOOTHING;
+    timings.total += ( step.total - timings.total ) * SMOOTHING;
+
+    const std::vector< float >& busy = octree->GetThreadBusy();
+    thread_busy.resize( busy.size() );
+    for ( size_t i = 0; i < busy.size(); ++i ) {
+        thread_busy[i] += ( busy[i] - thread_busy[i] ) * SMOOTHING;
+    }
+
+    state.grid_churn = octree->GetChurn();
+    state.grid_rebuilt = octree->WasRebuilt();
+    state.substeps = substep_count;
+    state.time_step = dt;
+    state.penetration = penetration;
+    state.sleeping_count = std::accumulate( thread_sleeping.begin(), thread_sleeping.end(), 0u );
+    state.sleeping_cells = octree->GetSleepingCells();
+    state.timings = timings;
+    state.thread_busy = thread_busy;
+    states.Publish();
+}
+
+StepTimings VerletManager::SolverStep() {
+    StepTimings step;
+    timer.Start();
+
+    UpdateSubsteps();
+
+    // Pairs are found once per step. Two particles that touch during the substeps were at most a
+    // diameter plus both their travels apart, the margin covers travels adding up to grid_margin radii.
+    const bool substepping = settings.auto_substeps || settings.substeps > 1;
+    const float gridRadius = settings.verlet_radius * ( substepping ? 1.f + settings.grid_margin * 0.5f : 1.f );
+
+    octree->SetBounds( settings.container_radius, gridRadius );
+    octree->SetSleepDistance( settings.sleep_speed * step_dt );
+    if ( settings.incremental_grid ) {
+        octree->UpdateTree( verlet_list, gridRadius, curr_count, alive.data(), sleeping.data() );
+    } else {
+        octree->ClearTree();
+        octree->FillTree( verlet_list, gridRadius, curr_count, alive.data(), sleeping.data() );
+    }
+    step.broadphase = timer.Lap();
+
+    if ( settings.long_range ) {
+        // Softened by a particle diameter, touching pairs are the grid's job. The tree only has the
+        // positions of the step's start, so the whole step's pull is given as one first substep kick.
+        barnes_hut->Build( verlet_list, curr_count, settings.verlet_radius * 2.f );
+        barnes_hut->ApplyForces( verlet_list, settings.long_range_strength * static_cast< float >( substep_count ),
+                                 settings.opening_angle );
+    }
+    step.forces = timer.Lap();
+
+    for ( unsigned substep = 0; substep < substep_count; ++substep ) {
+        octree->CheckCollisions();
+        if ( substep == 0 ) {
+            // Later passes only see what the earlier ones left, the first shows what one substep leaves
+            penetration = octree->GetPenetration() / settings.verlet_radius;
+        }
+        step.collision += timer.Lap();
+
+        ColliderCollision();
+        step.colliders += timer.Lap();
+
+        ContainerCollision();
+        step.container += timer.Lap();
+
+        const bool lastSubstep = substep + 1 == substep_count;
+        solver_pool->Run( THREAD_COUNT, [this, lastSubstep]( unsigned ThreadId ) {
+            PositionUpdateThread( ThreadId, lastSubstep );
+        } );
+        step.integrate += timer.Lap();
+    }
 
-    if ( curr_count <= 0 ) {
+    step.total = step.broadphase + step.collision + step.colliders + step.container + step.forces +
+                 step.integrate;
+
+    return step;
+}
+
+void VerletManager::UpdateSubsteps() {
+    unsigned count = substep_count;
+
+    if ( !settings.auto_substeps ) {
+        count = static_cast< unsigned >( std::clamp( settings.substeps, 1, MAX_SUBSTEPS ) );
+        calm_steps = 0;
+    } else {
+        const unsigned maxCount = static_cast< unsigned >( std::clamp( settings.max_substeps, 1, MAX_SUBSTEPS ) );
+
+        // Overlap grows about with the square of the substep length. One pass more as soon as it is too
+        // deep, one less only once it stayed low enough for a while that one less should still fit.
+        const float fewer = count > 1 ? static_cast< float >( count ) / static_cast< float >( count - 1 ) : 0.f;
+        if ( penetration > settings.max_penetration ) {
+            count = std::min( count + 1, maxCount );
+            calm_steps = 0;
+        } else if ( count > 1 && penetration * fewer * fewer < settings.max_penetration ) {
+            if ( ++calm_steps >= SUBSTEP_CALM_STEPS ) {
+                --count;
+                calm_steps = 0;
+            }
+        } else {
+            calm_steps = 0;
+        }
+        count = std::min( count, maxCount );
+    }
+
+    if ( count == substep_count ) {
+        return;
+    }
+
+    RescaleVelocities( static_cast< float >( substep_count ) / static_cast< float >( count ) );
+    substep_count = count;
+    step_dt = dt / static_cast< float >( count );
+}
+
+void VerletManager::RescaleVelocities( float Ratio ) noexcept {
+    solver_pool->Run( THREAD_COUNT, [this, Ratio]( unsigned ThreadId ) {
+        unsigned start = 0;
+        unsigned end = 0;
+        ThreadRange( ThreadId, start, end );
+
+        for ( unsigned i = start; i < end; ++i ) {
+            Verlet* verlet = &verlet_list[i];
+            vec4 disp = vec_mul_f( vec_sub( verlet->position, verlet->old_position ), Ratio );
+            verlet->old_position = vec_sub( verlet->position, disp );
+        }
+    } );
+}
+
+void VerletManager::UpdateTimeStep() {
+    float next = Engine::BASE_TIME_STEP;
+
+    if ( settings.adaptive_step ) {
+        const float maxStep = std::max( settings.max_step, settings.min_step );
+        const float travel = *std::max_element( thread_travel.begin(), thread_travel.end() );
+
+        // Step the fastest particle of the last one crosses max_travel radii in
+        float target = maxStep;
+        if ( travel > 0.f ) {
+            target = settings.max_travel * settings.verlet_radius * step_dt / travel;
+        }
+        target = std::clamp( target, settings.min_step, maxStep );
+
+        // Violent motion shortens the step at once, calm only lengthens it slowly and never past the target
+        next = dt;
+        if ( target < dt ) {
+            next = target;
+        } else if ( target > dt * TIME_STEP_GROWTH ) {
+            next = dt * TIME_STEP_GROWTH;
+        }
+    }
+
+    if ( next == dt ) {
         return;
     }
 
+    RescaleVelocities( next / dt );
+    dt = next;
+    step_dt = dt / static_cast< float >( substep_count );
+    Engine::Instance().SetFixedTimeStep( dt );
+}
+
+void VerletManager::ApplyAffinity( bool Pin, bool NumaRegions ) {
+    const CpuTopology& topology = CpuTopology::Instance();
+
+    solver_pool->SetAffinity( Pin ? topology.ThreadCpus( THREAD_COUNT ) : std::vector< int >() );
+
+    // Regions only stay on a node while task i keeps running on pinned thread i
+    octree->SetThreadNodes( Pin && NumaRegions ? topology.ThreadNodes( THREAD_COUNT )
+                                               : std::vector< int >() );
+}
+
+void VerletManager::PlaceParticles() {
+    VerletArray placed;
+    placed.Reserve( verlet_list.GetCapacity(), [this]( size_t First, size_t Last, const auto& Construct ) {
+        FirstTouch( First, Last, curr_count, Construct );
+    } );
+    for ( size_t i = 0; i < verlet_list.GetCapacity(); ++i ) {
+        placed[i] = verlet_list[i];
+    }
+    verlet_list = std::move( placed );
+
     octree->ClearTree();
-    octree->FillTree( verlet_list, verlet_radius, curr_count );
-    octree->CheckCollisions();
+}
+
+void VerletManager::RunAffinityBenchmark() {
+    if ( curr_count == 0 ) {
+        Trace::Message( "Affinity benchmark needs particles." );
+        return;
+    }
+
+    // Runs ahead of Update(), SolverStep() writes a state that may not have grown yet
+    states.Back().particles.Reserve( curr_count, [this]( size_t First, size_t Last,
+                                                         const auto& Construct ) {
+        FirstTouch( First, Last, curr_count, Construct );
+    } );
+
+    struct Mode {
+        const char* name;
+        bool pin;
+        bool regions;
+    };
+    static constexpr Mode modes[] = { { "Unpinned", false, false },
+                                      { "Pinned", true, false },
+                                      { "Pinned, node regions", true, true } };
+
+    // Every mode steps the same particles, a pile settling over the runs would favour the later ones
+    const SolverSnapshot snapshot = TakeSnapshot();
+
+    std::string results;
+    for ( const Mode& mode : modes ) {
+        ApplyAffinity( mode.pin, mode.regions );
+        PlaceParticles();
+
+        // Lets the grid be placed and the workers settle on their cpus
+        RestoreSnapshot( snapshot );
+        for ( int i = 0; i < 10; ++i ) {
+            SolverStep();
+        }
+        RestoreSnapshot( snapshot );
+
+        Benchmark benchmark( AFFINITY_BENCHMARK_STEPS );
+        benchmark.Run( mode.name, [this]() {
+            SolverStep();
+        } );
+
+        const double stepMs = benchmark.timer.duration.count() / 1000.0 / AFFINITY_BENCHMARK_STEPS;
+        results += fmt::format( " | {} {:.3f} ms", mode.name, stepMs );
+    }
+
+    RestoreSnapshot( snapshot );
+
+    Trace::Message( fmt::format( "Affinity benchmark, {} particles, {} nodes{}", curr_count,
+                                 CpuTopology::Instance().GetNodes().size(), results ) );
+}
+
+VerletManager::SolverSnapshot VerletManager::TakeSnapshot() const {
+    SolverSnapshot snapshot;
+    snapshot.verlets.reserve( curr_count );
+    for ( unsigned i = 0; i < curr_count; ++i ) {
+        snapshot.verlets.push_back( verlet_list[i] );
+    }
+    snapshot.alive.assign( alive.begin(), alive.begin() + curr_count );
+    snapshot.sleeping.assign( sleeping.begin(), sleeping.begin() + curr_count );
+    snapshot.rest_steps.assign( rest_steps.begin(), rest_steps.begin() + curr_count );
+    snapshot.substep_count = substep_count;
+    snapshot.step_dt = step_dt;
+    snapshot.penetration = penetration;
+    snapshot.calm_steps = calm_steps;
+    return snapshot;
+}
+
+void VerletManager::RestoreSnapshot( const SolverSnapshot& Snapshot ) {
+    // Copied into the existing slots, the grid holds pointers to them
+    for ( unsigned i = 0; i < Snapshot.verlets.size(); ++i ) {
+        verlet_list[i] = Snapshot.verlets[i];
+    }
+    std::copy( Snapshot.alive.begin(), Snapshot.alive.end(), alive.begin() );
+    std::copy( Snapshot.sleeping.begin(), Snapshot.sleeping.end(), sleeping.begin() );
+    std::copy( Snapshot.rest_steps.begin(), Snapshot.rest_steps.end(), rest_steps.begin() );
+    substep_count = Snapshot.substep_count;
+    step_dt = Snapshot.step_dt;
+    penetration = Snapshot.penetration;
+    calm_steps = Snapshot.calm_steps;
+
+    // The grid still has the cells of the benchmark's positions
+    octree->ClearTree();
+}
+
+void VerletManager::UpdateCountController() {
+    const float error = ( settings.target_step_ms - timings.total ) / settings.target_step_ms;
+
+    controller.integral = std::clamp( controller.integral + error * dt, -1.f, 1.f );
+    const float derivative = ( error - controller.last_error ) / dt;
+    controller.last_error = error;
+
+    // Relative change per second, step cost grows roughly linearly with the count
+    float rate = CONTROLLER_KP * error + CONTROLLER_KI * controller.integral +
+                 CONTROLLER_KD * derivative;
+    rate = std::clamp( rate, -0.5f, 0.5f );
+
+    // At zero particles Update() skips the step, timings would stay over the target for good
+    const float minCount = static_cast< float >( std::min( CONTROLLER_MIN_COUNT, settings.max_count ) );
+    const float maxChange = static_cast< float >( CONTROLLER_MAX_CHANGE );
+    controller.count += std::clamp( std::max( controller.count, minCount ) * rate * dt, -maxChange, maxChange );
+    controller.count = std::clamp( controller.count, minCount, static_cast< float >( settings.max_count ) );
+
+    SetCount( static_cast< unsigned >( controller.count ) );
+}
+
+void VerletManager::SetCount( unsigned Count ) {
+    unsigned count = AliveCount();
+
+    if ( Count < count ) {
+        // Removing from the end only keeps the rest in place once the holes are gone
+        Compact();
+        for ( unsigned i = Count; i < curr_count; ++i ) {
+            SetupVerletPosition( &verlet_list[i], i );
+            alive[i] = 0;
+            sleeping[i] = 0;
+            rest_steps[i] = 0;
+        }
+        curr_count = Count;
+        return;
+    }
+
+    while ( count < Count && !free_slots.empty() ) {
+        const unsigned slot = free_slots.back();
+        free_slots.pop_back();
+        SetupVerletPosition( &verlet_list[slot], slot );
+        alive[slot] = 1;
+        ++count;
+    }
+
+    // Slots past curr_count already wait at their spawn position
+    const unsigned newCount = curr_count + ( Count - count );
+    Reserve( newCount );
+    std::fill( alive.begin() + curr_count, alive.begin() + newCount, 1 );
+    curr_count = newCount;
+}
+
+unsigned VerletManager::AliveCount() const noexcept {
+    return curr_count - static_cast< unsigned >( free_slots.size() );
+}
+
+bool VerletManager::Spawn( const glm::vec3& Position, const glm::vec3& Velocity ) {
+    if ( AliveCount() >= settings.max_count ) {
+        return false;
+    }
+
+    unsigned slot = curr_count;
+    if ( !free_slots.empty() ) {
+        slot = free_slots.back();
+        free_slots.pop_back();
+    } else {
+        Reserve( curr_count + 1 );
+        ++curr_count;
+    }
+
+    // Verlet keeps velocity as the substep from old_position
+    const glm::vec3 old = Position - Velocity * step_dt;
+    Verlet* verlet = &verlet_list[slot];
+    vec_set_f( verlet->position, Position.x, Position.y, Position.z );
+    vec_set_f( verlet->old_position, old.x, old.y, old.z );
+    vec_set_f( verlet->acceleration, 0.f, 0.f, 0.f );
+    alive[slot] = 1;
+
+    return true;
+}
+
+void VerletManager::Kill( unsigned Index ) noexcept {
+    alive[Index] = 0;
+    sleeping[Index] = 0;
+    rest_steps[Index] = 0;
+    free_slots.push_back( Index );
+}
+
+void VerletManager::Compact() {
+    if ( free_slots.empty() ) {
+        return;
+    }
+
+    // Lowest hole first, each one takes the last live particle
+    std::sort( free_slots.begin(), free_slots.end() );
+
+    for ( unsigned hole : free_slots ) {
+        while ( curr_count > 0 && !alive[curr_count - 1] ) {
+            --curr_count;
+            SetupVerletPosition( &verlet_list[curr_count], curr_count );
+        }
+        if ( hole >= curr_count ) {
+            break;
+        }
+
+        // Moved particles wake up, Octree::UpdateTree trusts sleeping slots to stay put
+        const unsigned last = curr_count - 1;
+        verlet_list[hole] = verlet_list[last];
+        alive[hole] = 1;
+        alive[last] = 0;
+        sleeping[last] = 0;
+        rest_steps[last] = 0;
+        SetupVerletPosition( &verlet_list[last], last );
+        curr_count = last;
+    }
+
+    free_slots.clear();
+    steps_since_compact = 0;
+    ++compactions;
+}
+
+void VerletManager::UpdateLifecycle() {
+    UpdateEmitters();
+    ApplySinks();
+
+    if ( free_slots.empty() ) {
+        steps_since_compact = 0;
+        return;
+    }
+
+    // The Barnes-Hut tree indexes bodies by slot and needs them dense every step
+    ++steps_since_compact;
+    if ( settings.long_range || free_slots.size() * COMPACT_HOLE_FRACTION > curr_count ||
+         steps_since_compact >= COMPACT_INTERVAL ) {
+        Compact();
+    }
+}
+
+void VerletManager::UpdateEmitters() {
+    emitter_budget.resize( settings.emitters.size(), 0.f );
+
+    std::uniform_real_distribution< float > offset( -1.f, 1.f );
+    for ( size_t e = 0; e < settings.emitters.size(); ++e ) {
+        const Emitter& emitter = settings.emitters[e];
+        if ( !emitter.enabled ) {
+            emitter_budget[e] = 0.f;
+            continue;
+        }
+
+        emitter_budget[e] += emitter.rate * dt;
+        while ( emitter_budget[e] >= 1.f ) {
+            // Rejection sampling keeps the spawn volume a sphere
+            glm::vec3 jitter;
+            do {
+                jitter = glm::vec3( offset( emitter_random ), offset( emitter_random ),
+                                    offset( emitter_random ) );
+            } while ( glm::dot( jitter, jitter ) > 1.f );
+
+            if ( !Spawn( emitter.position + jitter * emitter.spread, emitter.velocity ) ) {
+                // Full, the budget would only pile up into a burst later
+                emitter_budget[e] = 0.f;
+                break;
+            }
+            emitter_budget[e] -= 1.f;
+        }
+    }
+}
+
+void VerletManager::ApplySinks() {
+    const bool anySink = std::any_of( settings.sinks.begin(), settings.sinks.end(),
+                                      []( const Sink& S ) { return S.enabled; } );
+    if ( !anySink || curr_count == 0 ) {
+        return;
+    }
+
+    solver_pool->Run( THREAD_COUNT, [this]( unsigned ThreadId ) {
+        unsigned start = 0;
+        unsigned end = 0;
+        ThreadRange( ThreadId, start, end );
+
+        std::vector< unsigned >& killed = thread_killed[ThreadId];
+        killed.clear();
+
+        for ( unsigned i = start; i < end; ++i ) {
+            if ( !alive[i] ) {
+                continue;
+            }
+
+            const vec4& position = verlet_list[i].position;
+            const glm::vec3 p( position.x, position.y, position.z );
+            for ( const Sink& sink : settings.sinks ) {
+                const glm::vec3 d = p - sink.position;
+                if ( sink.enabled && glm::dot( d, d ) < sink.radius * sink.radius ) {
+                    killed.push_back( i );
+                    break;
+                }
+            }
+        }
+    } );
+
+    // The free list is shared, merging it is serial and only as long as the hits
+    for ( const std::vector< unsigned >& killed : thread_killed ) {
+        for ( unsigned i : killed ) {
+            Kill( i );
+        }
+    }
+}
 
-    ContainerCollision();
+void VerletManager::Reserve( unsigned Count ) {
+    const unsigned oldCapacity = static_cast< unsigned >( verlet_list.GetCapacity() );
+    if ( Count <= oldCapacity ) {
+        return;
+    }
 
-    for ( int i = 0; i < THREAD_COUNT; ++i ) {
-        threads[i] = std::thread( &VerletManager::PositionUpdateThread, this, i );
+    verlet_list.Reserve( Count, [this, Count]( size_t First, size_t Last, const auto& Construct ) {
+        FirstTouch( First, Last, Count, Construct );
+    } );
+
+    const unsigned newCapacity = static_cast< unsigned >( verlet_list.GetCapacity() );
+    for ( unsigned i = oldCapacity; i < newCapacity; ++i ) {
+        SetupVerletPosition( &verlet_list[i], i );
     }
-    for ( std::thread& thd : threads ) {
-        thd.join();
+    alive.resize( newCapacity, 0 );
+    sleeping.resize( newCapacity, 0 );
+    rest_steps.resize( newCapacity, 0 );
+}
+
+void VerletManager::FirstTouch( size_t First, size_t Last, unsigned Count,
+                                const std::function< void( size_t, size_t ) >& Construct ) {
+    solver_pool->Run( THREAD_COUNT, [&]( unsigned ThreadId ) {
+        // Same split as PositionUpdateThread, the last thread also takes the rest of the chunk
+        const size_t share = Count / THREAD_COUNT;
+        const size_t start = std::max< size_t >( ThreadId * share, First );
+        const size_t end = ThreadId == static_cast< unsigned >( THREAD_COUNT - 1 )
+                               ? Last
+                               : std::min< size_t >( ( ThreadId + 1 ) * share, Last );
+
+        if ( start < end ) {
+            Construct( start, end );
+        }
+    } );
+}
+
+void VerletManager::WriteState( unsigned Start, unsigned End, bool Moving ) noexcept {
+    ChunkedArray< ParticleState >& particles = states.Back().particles;
+
+    // old_position is one substep back, a drawn step spans all of them
+    const float substeps = static_cast< float >( substep_count );
+    // Travel of a base length step times 10, what the speed colours were made for
+    const float speedScale = 10.f * Engine::BASE_TIME_STEP / step_dt;
+
+    for ( unsigned i = Start; i < End; ++i ) {
+        const Verlet* verlet = &verlet_list[i];
+        ParticleState& particle = particles[i];
+
+        // A paused state repeats itself, interpolating towards the step's start would jitter
+        const float stepScale = Moving ? substeps : 0.f;
+
+        for ( int j = 0; j < 3; ++j ) {
+            const float step = verlet->position[j] - verlet->old_position[j];
+            particle.previous[j] = verlet->position[j] - step * stepScale;
+            particle.current[j] = verlet->position[j];
+        }
+        particle.speed = vec_distance( verlet->position, verlet->old_position ) * speedScale;
+        particle.alive = alive[i];
     }
 }
 
-void VerletManager::CheckCollisionBetweenVerlets( Verlet* Verlet1, Verlet* Verlet2 ) {
+float VerletManager::CheckCollisionBetweenVerlets( Verlet* Verlet1, Verlet* Verlet2 ) {
     if ( Verlet1 != Verlet2 ) {
         vec4 axis = vec_sub( Verlet1->position, Verlet2->position );
         float dist = vec_length( axis );
-        if ( dist < verlet_radius + verlet_radius ) {
+        if ( dist < settings.verlet_radius + settings.verlet_radius ) {
             vec4 norm = vec_divide_f( axis, dist );
 
-            float delta = verlet_radius + verlet_radius - dist;
+            float delta = settings.verlet_radius + settings.verlet_radius - dist;
             norm = vec_mul_f( norm, 0.5f * delta );
             Verlet1->position = vec_add( Verlet1->position, norm );
             Verlet2->position = vec_sub( Verlet2->position, norm );
+            return delta;
+        }
+    }
+    return 0.f;
+}
+
+size_t VerletManager::ColliderCollision() {
+    if ( !colliders ) {
+        return 0;
+    }
+
+    solver_pool->Run( THREAD_COUNT, [this]( unsigned ThreadId ) {
+        ColliderCollisionThread( ThreadId );
+    } );
+
+    size_t tests = std::accumulate( thread_collider_tests.begin(), thread_collider_tests.end(), size_t( 0 ) );
+
+    // Particles of full cells are not in the columns
+    for ( const Octree::SpilledParticle& spilled : octree->GetSpill() ) {
+        if ( sleeping[spilled.index] ) {
+            continue;
+        }
+
+        Verlet* cell[1] = { spilled.verlet };
+        tests += colliders->Collide( cell, 1, settings.verlet_radius, collider_candidates[0] );
+    }
+
+    return tests;
+}
+
+void VerletManager::ColliderCollisionThread( int ThreadId ) {
+    const StaticColliders& set = *colliders;
+    std::vector< unsigned >& candidates = collider_candidates[ThreadId];
+
+    const int dim = octree->GetDim();
+    int firstColumn = 0;
+    int lastColumn = 0;
+    octree->GetThreadColumns( ThreadId, firstColumn, lastColumn );
+    size_t tests = 0;
+
+    for ( int column = firstColumn; column < lastColumn; ++column ) {
+        const int x = column / dim;
+        const int y = column % dim;
+
+        // Border cells included, the cell bounds come from the particles so clamped strays are handled too
+        for ( int z = 0; z < dim; ++z ) {
+            Verlet** cell = octree->GetNode( x, y, z );
+
+            int count = 0;
+            while ( count < Octree::CELL_MAX && cell[count] ) {
+                ++count;
+            }
+
+            if ( count > 0 && octree->IsAwake( x, y, z ) ) {
+                tests += set.Collide( cell, count, settings.verlet_radius, candidates );
+            }
         }
     }
+
+    thread_collider_tests[ThreadId] = tests;
+}
+
+void VerletManager::RunColliderBenchmark() {
+    if ( curr_count == 0 ) {
+        Trace::Message( "Collider benchmark needs particles." );
+        return;
+    }
+
+    // The floors push the particles around, every floor starts from the same ones and they are put back after
+    const SolverSnapshot snapshot = TakeSnapshot();
+
+    const std::shared_ptr< const StaticColliders > active = colliders;
+    const float extent = settings.container_radius;
+
+    std::string results;
+    for ( int quads : { 4, 16, 64, 256 } ) {
+        // Wavy floor through the container, 2 * quads^2 triangles
+        std::vector< glm::vec3 > positions;
+        std::vector< unsigned > indices;
+        for ( int i = 0; i <= quads; ++i ) {
+            for ( int j = 0; j <= quads; ++j ) {
+                const float x = -extent + 2.f * extent * i / quads;
+                const float z = -extent + 2.f * extent * j / quads;
+                positions.push_back( { x, 0.5f * std::sin( x ) * std::cos( z ), z } );
+            }
+        }
+        for ( int i = 0; i < quads; ++i ) {
+            for ( int j = 0; j < quads; ++j ) {
+                const unsigned corner = i * ( quads + 1 ) + j;
+                indices.insert( indices.end(), { corner, corner + 1, corner + quads + 1,
+                                                 corner + 1, corner + quads + 2, corner + quads + 1 } );
+            }
+        }
+
+        auto set = std::make_shared< StaticColliders >();
+        set->AddTriangles( positions, indices, glm::mat4( 1.f ) );
+        timer.Start();
+        set->Build();
+        const float buildMs = timer.Lap();
+        colliders = set;
+
+        // Sleeping cells would be skipped, every particle is measured
+        RestoreSnapshot( snapshot );
+        WakeAll();
+
+        // ColliderCollision walks the columns CheckCollisions split over the threads
+        octree->SetBounds( settings.container_radius, settings.verlet_radius );
+        octree->FillTree( verlet_list, settings.verlet_radius, curr_count, alive.data(), sleeping.data() );
+        octree->CheckCollisions();
+
+        // The first pass pushes particles out of the floor, later ones measure resting contacts
+        ColliderCollision();
+
+        // Only particles near the floor reach its triangles, the cost is per test made
+        size_t tests = 0;
+        const std::string name = fmt::format( "Colliders, {} triangles", set->GetTriangleCount() );
+        Benchmark benchmark( COLLIDER_BENCHMARK_STEPS );
+        benchmark.Run( name.c_str(), [this, &tests]() {
+            tests += ColliderCollision();
+        } );
+
+        const double nsPerTest = benchmark.timer.duration.count() * 1000.0 / std::max< size_t >( tests, 1 );
+        results += fmt::format( " | {} triangles {:.1f} ns per test, {} tests per pass (build {:.2f} ms)",
+                                set->GetTriangleCount(), nsPerTest, tests / COLLIDER_BENCHMARK_STEPS,
+                                buildMs );
+    }
+
+    colliders = active;
+    RestoreSnapshot( snapshot );
+
+    Trace::Message( fmt::format( "Collider benchmark, {} particles{}", curr_count, results ) );
+}
+
+void VerletManager::RunBarnesHutBenchmark() {
+    if ( curr_count == 0 ) {
+        Trace::Message( "Barnes-Hut benchmark needs particles." );
+        return;
+    }
+
+    // The tree indexes bodies by slot and needs them dense
+    Compact();
+
+    const float softening = settings.verlet_radius * 2.f;
+    Benchmark build( 10 );
+    build.Run( "Barnes-Hut build", [this, softening]() {
+        barnes_hut->Build( verlet_list, curr_count, softening );
+    } );
+
+    // The reference is O(n) per particle, only a spread out sample is compared
+    const unsigned sampleCount = std::min< unsigned >( BARNES_HUT_SAMPLES, curr_count );
+    std::vector< glm::vec3 > samples( sampleCount );
+    std::vector< glm::vec3 > reference( sampleCount );
+
+    timer.Start();
+    for ( unsigned i = 0; i < sampleCount; ++i ) {
+        const vec4& position = verlet_list[static_cast< size_t >( i ) * curr_count / sampleCount].position;
+        samples[i] = { position.x, position.y, position.z };
+        reference[i] = barnes_hut->EvaluateBruteForce( samples[i] );
+    }
+    const float bruteForceMs = timer.Lap() / sampleCount * curr_count;
+
+    std::string results;
+    for ( float theta : { 0.25f, 0.5f, 0.7f, 1.f } ) {
+        double errorSum = 0.0;
+        double errorMax = 0.0;
+        for ( unsigned i = 0; i < sampleCount; ++i ) {
+            const glm::vec3 approximation = barnes_hut->Evaluate( samples[i], theta );
+            const double error = glm::length( approximation - reference[i] ) /
+                                 std::max( glm::length( reference[i] ), FLT_MIN );
+            errorSum += error;
+            errorMax = std::max( errorMax, error );
+        }
+
+        // Zero strength leaves the particles alone, the cost is the same
+        timer.Start();
+        barnes_hut->ApplyForces( verlet_list, 0.f, theta );
+        const float forcesMs = timer.Lap();
+
+        results += fmt::format( " | theta {:.2f}: {:.2f} ms, error mean {:.3f}% max {:.3f}%", theta, forcesMs,
+                                errorSum / sampleCount * 100.0, errorMax * 100.0 );
+    }
+
+    Trace::Message( fmt::format( "Barnes-Hut benchmark, {} particles, {} nodes, build {:.2f} ms, "
+                                 "brute force {:.1f} ms (extrapolated){}",
+                                 curr_count, barnes_hut->GetNodeCount(),
+                                 build.timer.duration.count() / 1000.0 / 10, bruteForceMs, results ) );
 }
 
 void VerletManager::ContainerCollision() {
-    switch ( container.shape ) {
+    solver_pool->Run( THREAD_COUNT, [this]( unsigned ThreadId ) {
+        ContainerCollisionThread( ThreadId );
+    } );
+}
+
+void VerletManager::ContainerCollisionThread( int ThreadId ) noexcept {
+    unsigned start = 0;
+    unsigned end = 0;
+    ThreadRange( ThreadId, start, end );
+
+    switch ( settings.container_shape ) {
     case Sphere:
-        for ( unsigned i = 0; i < curr_count; ++i ) {
-            Verlet* v = verlet_list[i].get();
+        for ( unsigned i = start; i < end; ++i ) {
+            if ( sleeping[i] ) {
+                continue;
+            }
+
+            Verlet* v = &verlet_list[i];
 
             vec4 disp( v->position.x, v->position.y, v->position.z, 0.f );
             float dist = vec_length( disp );
 
-            if ( dist > ( container.collision_radius - verlet_radius ) ) {
+            if ( dist > ( settings.container_radius - settings.verlet_radius ) ) {
                 vec4 norm = vec_divide_f( disp, dist );
-                norm = vec_mul_f( norm, container.collision_radius - verlet_radius );
+                norm = vec_mul_f( norm, settings.container_radius - settings.verlet_radius );
                 vec_set( v->position, norm );
             }
         }
         break;
 
     case Cube:
-        for ( unsigned i = 0; i < curr_count; ++i ) {
-            Verlet* v = verlet_list[i].get();
+        for ( unsigned i = start; i < end; ++i ) {
+            if ( sleeping[i] ) {
+                continue;
+            }
+
+            Verlet* v = &verlet_list[i];
 
             for ( unsigned j = 0; j < 3; ++j ) {
-                if ( v->position[j] < -container.collision_radius ) {
+                if ( v->position[j] < -settings.container_radius ) {
                     float disp = v->position[j] - v->old_position[j];
-                    v->position[j] = -container.collision_radius;
+                    v->position[j] = -settings.container_radius;
                     v->old_position[j] = v->position[j] + disp;
                 }
-                if ( v->position[j] > container.collision_radius ) {
+                if ( v->position[j] > settings.container_radius ) {
                     float disp = v->position[j] - v->old_position[j];
-                    v->position[j] = container.collision_radius;
+                    v->position[j] = settings.container_radius;
                     v->old_position[j] = v->position[j] + disp;
                 }
             }
         }
         break;
 
+    case MeshField: {
+        if ( !container_field ) {
+            break;
+        }
+
+        // Any mesh costs one trilinear sample per particle, same as the analytic shapes
+        const SignedDistanceField& field = *container_field;
+        const float inverseScale = 1.f / settings.container_radius;
+
+        for ( unsigned i = start; i < end; ++i ) {
+            if ( sleeping[i] ) {
+                continue;
+            }
+
+            Verlet* v = &verlet_list[i];
+
+            const vec4 sample = field.Sample( vec_mul_f( v->position, inverseScale ) );
+            const float penetration = sample.w * settings.container_radius + settings.verlet_radius;
+
+            if ( penetration > 0.f ) {
+                vec4 gradient( sample.x, sample.y, sample.z, 0.f );
+                const float length = vec_length( gradient );
+
+                if ( length > 0.f ) {
+                    gradient = vec_mul_f( gradient, penetration / length );
+                    v->position = vec_sub( v->position, gradient );
+                }
+            }
+        }
+        break;
+    }
+
     default:
         break;
     }
 }
 
-void VerletManager::PositionUpdateThread( int ThreadId ) noexcept {
-    unsigned start = ThreadId * ( curr_count / THREAD_COUNT );
-    unsigned end = ( ThreadId + 1 ) * ( curr_count / THREAD_COUNT );
+void VerletManager::ThreadRange( int ThreadId, unsigned& Start, unsigned& End ) const noexcept {
+    Start = ThreadId * ( curr_count / THREAD_COUNT );
+    End = ( ThreadId + 1 ) * ( curr_count / THREAD_COUNT );
 
     if ( ThreadId == THREAD_COUNT - 1 ) {
-        end = curr_count;
+        End = curr_count;
     }
+}
+
+void VerletManager::PositionUpdateThread( int ThreadId, bool LastSubstep ) noexcept {
+    unsigned start = 0;
+    unsigned end = 0;
+    ThreadRange( ThreadId, start, end );
+
+    if ( settings.force_toggle ) {
+        ApplyFields( start, end );
+    }
+
+    // Distances per substep, a sleeping particle has to be pushed further than it moved to fall asleep
+    const float sleepDistance = settings.sleep_speed * step_dt;
+    const float sleepDistanceSq = sleepDistance * sleepDistance;
+    float travelSq = 0.f;
+    const float wakeDistanceSq = sleepDistanceSq * SLEEP_WAKE_FACTOR * SLEEP_WAKE_FACTOR;
+    // Force fields and long range forces that would add the sleep speed within one substep
+    const float wakeAcceleration = settings.sleep_speed / step_dt;
+    const float wakeAccelerationSq = wakeAcceleration * wakeAcceleration;
+    const uint8_t sleepSteps = static_cast< uint8_t >( std::clamp( settings.sleep_steps, 1, 255 ) );
+    unsigned sleepingCount = 0;
 
     for ( unsigned i = start; i < end; ++i ) {
-        Verlet* verlet = verlet_list[i].get();
+        if ( !alive[i] ) {
+            continue;
+        }
 
-        if ( force_toggle ) {
-            vec4 disp = vec_sub( verlet->position, force_position );
-            float dist = vec_length( disp );
+        Verlet* verlet = &verlet_list[i];
 
-            if ( dist > 0 ) {
-                vec4 norm = vec_divide_f( disp, dist );
-                norm = vec_mul_f( norm, -30.f );
-                verlet->acceleration = vec_add( verlet->acceleration, norm );
+        // Gravity is added below, contacts balance it for a resting particle
+        const bool forced = vec_length_squared( verlet->acceleration ) > wakeAccelerationSq;
+
+        if ( sleeping[i] ) {
+            // Resting contacts nudge it a little, those are undone so it stays frozen
+            if ( !forced && vec_distance_squared( verlet->position, verlet->old_position ) < wakeDistanceSq &&
+                 !octree->IsWoken( i ) ) {
+                vec_set( verlet->position, verlet->old_position );
+                vec_zero( verlet->acceleration );
+                ++sleepingCount;
+                continue;
             }
+
+            sleeping[i] = 0;
+            rest_steps[i] = 0;
         }
 
-        verlet->acceleration = vec_add( verlet->acceleration, grav_vec );
+        verlet->acceleration = vec_add( verlet->acceleration, settings.grav_vec );
 
         vec4 temp( verlet->position.x, verlet->position.y, verlet->position.z, 0.f );
         vec4 disp = vec_sub( verlet->position, verlet->old_position );
         vec_set( verlet->old_position, verlet->position );
 
-        vec4 forceReduction = vec_mul_f( disp, vel_damping );
+        // Damping was tuned on the displacement of a base length step
+        vec4 forceReduction = vec_mul_f( disp, settings.vel_damping * ( Engine::BASE_TIME_STEP / step_dt ) );
         verlet->acceleration = vec_sub( verlet->acceleration, forceReduction );
 
-        verlet->acceleration = vec_mul_f( verlet->acceleration, dt * dt );
+        verlet->acceleration = vec_mul_f( verlet->acceleration, step_dt * step_dt );
+
+        if ( LastSubstep ) {
+            if ( settings.sleeping && !forced && vec_length_squared( disp ) < sleepDistanceSq ) {
+                if ( ++rest_steps[i] >= sleepSteps ) {
+                    // Stays at the position the contacts left it, old_position is where it rests
+                    sleeping[i] = 1;
+                    vec_zero( verlet->acceleration );
+                    ++sleepingCount;
+                    continue;
+                }
+            } else {
+                rest_steps[i] = 0;
+            }
+        }
+
         verlet->position = vec_add( verlet->position, disp );
         verlet->position = vec_add( verlet->position, verlet->acceleration );
 
         vec_zero( verlet->acceleration );
+
+        travelSq = std::max( travelSq, vec_distance_squared( verlet->position, verlet->old_position ) );
+    }
+
+    thread_sleeping[ThreadId] = sleepingCount;
+
+    if ( LastSubstep ) {
+        thread_travel[ThreadId] = std::sqrt( travelSq );
+        WriteState( start, end, true );
     }
 }
 
-void VerletManager::PositionUpdate() noexcept {
-    for ( unsigned i = 0; i < curr_count; ++i ) {
-        Verlet* verlet = verlet_list[i].get();
+void VerletManager::DispatchRanges( unsigned Count, unsigned ThreadCount,
+                                    const std::function< void( int, unsigned, unsigned ) >& Function ) {
+    render_pool->Run( ThreadCount, [Count, ThreadCount, &Function]( unsigned ThreadId ) {
+        unsigned start = ThreadId * ( Count / ThreadCount );
+        unsigned end = ( ThreadId == ThreadCount - 1 ) ? Count
+                                                       : ( ThreadId + 1 ) * ( Count / ThreadCount );
+        Function( ThreadId, start, end );
+    } );
+}
 
-        if ( force_toggle ) {
-            vec4 disp = vec_sub( verlet->position, force_position );
-            float dist = vec_length( disp );
+static glm::vec3 InterpolatedPosition( const ParticleState& Particle, float Alpha ) noexcept {
+    return { Particle.previous[0] + ( Particle.current[0] - Particle.previous[0] ) * Alpha,
+             Particle.previous[1] + ( Particle.current[1] - Particle.previous[1] ) * Alpha,
+             Particle.previous[2] + ( Particle.current[2] - Particle.previous[2] ) * Alpha };
+}
 
-            if ( dist > 0 ) {
-                vec4 norm = vec_divide_f( disp, dist );
-                norm = vec_mul_f( norm, -30.f );
-                verlet->acceleration = vec_add( verlet->acceleration, norm );
+void VerletManager::ClassifyInstances( int ThreadId, unsigned Start, unsigned End ) noexcept {
+    std::array< unsigned, LOD_COUNT >& counts = thread_lod_counts[ThreadId];
+    counts.fill( 0 );
+
+    // Impostors cost the same at any distance
+    const bool useLod = render_mode == RenderMesh;
+    const float lodDistanceSq = lod_distance * lod_distance;
+
+    const ChunkedArray< ParticleState >& particles = render_state->particles;
+    const float radius = menu_settings.verlet_radius;
+
+    for ( unsigned i = Start; i < End; ++i ) {
+        if ( !particles[i].alive ) {
+            instance_lod[i] = LOD_CULLED;
+            continue;
+        }
+
+        const glm::vec3 position = InterpolatedPosition( particles[i], render_alpha );
+
+        if ( frustum_culling && !frustum.IntersectsSphere( position, radius ) ) {
+            instance_lod[i] = LOD_CULLED;
+            continue;
+        }
+
+        const glm::vec3 toCamera = position - camera_position;
+        const uint8_t lod = useLod && glm::dot( toCamera, toCamera ) > lodDistanceSq ? 1 : 0;
+
+        instance_lod[i] = lod;
+        ++counts[lod];
+    }
+}
+
+void VerletManager::PackInstances( int ThreadId, unsigned Start, unsigned End, void* Instances,
+                                   float Extent ) noexcept {
+    std::array< unsigned, LOD_COUNT > next = thread_lod_counts[ThreadId];
+    const ChunkedArray< ParticleState >& particles = render_state->particles;
+
+    if ( !packed_instances ) {
+        InstanceData* instances = static_cast< InstanceData* >( Instances );
+
+        for ( unsigned i = Start; i < End; ++i ) {
+            const uint8_t lod = instance_lod[i];
+            if ( lod == LOD_CULLED ) {
+                continue;
             }
+
+            const glm::vec3 position = InterpolatedPosition( particles[i], render_alpha );
+            InstanceData& instance = instances[next[lod]++];
+
+            instance.position[0] = position.x;
+            instance.position[1] = position.y;
+            instance.position[2] = position.z;
+            instance.speed = particles[i].speed;
         }
+        return;
+    }
 
-        verlet->acceleration = vec_add( verlet->acceleration, grav_vec );
+    PackedInstanceData* instances = static_cast< PackedInstanceData* >( Instances );
+    const float positionScale = 32767.f / Extent;
+    const float speedScale = 255.f / PACKED_SPEED_RANGE;
 
-        vec4 temp( verlet->position.x, verlet->position.y, verlet->position.z, 0.f );
-        vec4 disp = vec_sub( verlet->position, verlet->old_position );
-        vec_set( verlet->old_position, verlet->position );
+    for ( unsigned i = Start; i < End; ++i ) {
+        const uint8_t lod = instance_lod[i];
+        if ( lod == LOD_CULLED ) {
+            continue;
+        }
 
-        vec4 forceReduction = vec_mul_f( disp, vel_damping );
-        verlet->acceleration = vec_sub( verlet->acceleration, forceReduction );
+        const glm::vec3 position = InterpolatedPosition( particles[i], render_alpha );
+        PackedInstanceData& instance = instances[next[lod]++];
 
-        verlet->acceleration = vec_mul_f( verlet->acceleration, dt * dt );
-        verlet->position = vec_add( verlet->position, disp );
-        verlet->position = vec_add( verlet->position, verlet->acceleration );
+        for ( int j = 0; j < 3; ++j ) {
+            float packed = std::clamp( position[j] * positionScale, -32767.f, 32767.f );
+            instance.position[j] = static_cast< int16_t >( std::lround( packed ) );
+        }
 
-        vec_zero( verlet->acceleration );
+        float speed = particles[i].speed * speedScale;
+        instance.speed = static_cast< uint8_t >( std::min( speed + 0.5f, 255.f ) );
+        instance.padding = 0;
     }
 }
 
 void VerletManager::DrawVerlets() {
-    if ( curr_count <= 0 ) {
-        Graphics::Instance().DrawNormal( container.model, container.matrix );
+    // Latest completed step, drawn between it and the step before
+    render_state = &states.Front();
+    render_alpha = Engine::Instance().GetInterpolationAlpha( render_state->step_time );
+    drawn_count = render_state->alive_count;
+    drawn_slots = render_state->count;
+    drawn_compactions = render_state->compactions;
+    drawn_churn = render_state->grid_churn;
+    drawn_sleeping = render_state->sleeping_count;
+    drawn_sleeping_cells = render_state->sleeping_cells;
+    drawn_rebuilt = render_state->grid_rebuilt;
+    drawn_substeps = render_state->substeps;
+    drawn_time_step = render_state->time_step;
+    drawn_penetration = render_state->penetration;
+    drawn_timings = render_state->timings;
+    drawn_thread_busy = render_state->thread_busy;
+    drawn_capacity = render_state->capacity;
+    drawn_memory = render_state->solver_memory;
+
+    if ( drawn_count <= 0 ) {
+        lod_visible.fill( 0 );
+        culled_count = 0;
+        DrawStatic();
         return;
     }
 
-    int positionCounter = 0;
-    int velocityCounter = 0;
+    // Holes are classified as culled, only live particles need instances
+    const unsigned count = drawn_slots;
+    if ( instance_lod.size() < count ) {
+        instance_lod.resize( count );
+    }
+    instance_buffer->Reserve( drawn_count );
+
+    // Packed positions are relative to the container, with some room for particles
+    // that have not been pushed back inside yet
+    const float extent = container.collision_radius * 1.25f;
+
+    frustum = Frustum::FromMatrix( Graphics::Instance().GetProjection() *
+                                   Camera::Instance().GetViewMatrix() );
+    camera_position = Camera::Instance().GetPosition();
+
+    const unsigned threadCount = count < PARALLEL_PACK_MIN ? 1 : THREAD_COUNT;
+
+    DispatchRanges( count, threadCount, [this]( int ThreadId, unsigned Start, unsigned End ) {
+        ClassifyInstances( ThreadId, Start, End );
+    } );
+
+    // Prefix sum over LODs then threads, every thread writes its own part of each LOD range
+    unsigned visible = 0;
+    for ( unsigned lod = 0; lod < LOD_COUNT; ++lod ) {
+        lod_first[lod] = visible;
+        for ( unsigned i = 0; i < threadCount; ++i ) {
+            unsigned lodCount = thread_lod_counts[i][lod];
+            thread_lod_counts[i][lod] = visible;
+            visible += lodCount;
+        }
+        lod_visible[lod] = visible - lod_first[lod];
+    }
+    culled_count = drawn_count - visible;
 
-    for ( unsigned i = 0; i < curr_count; ++i ) {
-        Verlet* verlet = verlet_list[i].get();
+    // Written straight into the mapped region the GPU will read this frame
+    void* instances = instance_buffer->BeginWrite();
 
-        positions[positionCounter++] = verlet->position[0];
-        positions[positionCounter++] = verlet->position[1];
-        positions[positionCounter++] = verlet->position[2];
+    DispatchRanges( count, threadCount,
+                    [this, instances, extent]( int ThreadId, unsigned Start, unsigned End ) {
+                        PackInstances( ThreadId, Start, End, instances, extent );
+                    } );
 
-        velocities[velocityCounter++] = vec_distance( verlet->position,
-                                                      verlet->old_position ) *
-                                        10.f;
-    }
+    instance_buffer->EndWrite( visible );
 
-    glBindBuffer( GL_ARRAY_BUFFER, model->GetMesh()->position_VBO );
-    glBufferSubData( GL_ARRAY_BUFFER, 0, sizeof( float ) * 3 * curr_count,
-                     positions.data() );
-    glBindBuffer( GL_ARRAY_BUFFER, 0 );
+    const unsigned shader = render_mode == RenderImpostor ? impostor_shader
+                                                          : lod_models[0]->GetShader();
+    const Program& program = ShaderManager::Instance().GetProgram( shader );
 
-    glBindBuffer( GL_ARRAY_BUFFER, model->GetMesh()->velocity_VBO );
-    glBufferSubData( GL_ARRAY_BUFFER, 0, sizeof( float ) * curr_count, velocities.data() );
-    glBindBuffer( GL_ARRAY_BUFFER, 0 );
+    glUseProgram( program.id );
 
-    glUseProgram( model->GetShader() );
+    glUniform1f( program.uniforms[UNIFORM_SCALE], menu_settings.verlet_radius );
+    glUniform1f( program.uniforms[UNIFORM_INSTANCE_EXTENT], packed_instances ? extent : 1.f );
+    glUniform1f( program.uniforms[UNIFORM_SPEED_SCALE], packed_instances ? PACKED_SPEED_RANGE : 1.f );
 
-    glUniformMatrix4fv( glGetUniformLocation( model->GetShader(), "projection" ),
-                        1, GL_FALSE, &projection[0][0] );
+    // One draw per LOD, the base instance selects its range of the region
+    for ( unsigned lod = 0; lod < LOD_COUNT; ++lod ) {
+        if ( lod_visible[lod] == 0 ) {
+            continue;
+        }
 
-    glUniform1f( glGetUniformLocation( model->GetShader(), "scale" ), verlet_radius );
+        const Model* lodModel = lod_models[lod].get();
 
-    glBindVertexArray( model->GetMesh()->VAO );
+        glBindVertexArray( lodModel->GetMesh()->VAO );
+        instance_buffer->Bind();
 
-    glDrawArraysInstanced( model->GetRenderMethod(), 0, model->GetMesh()->num_vertices,
-                           curr_count );
+        if ( render_mode == RenderImpostor ) {
+            // Four corners per instance, the vertex attributes of the mesh are not read
+            glDrawArraysInstancedBaseInstance( GL_TRIANGLE_STRIP, 0, 4, lod_visible[lod],
+                                               lod_first[lod] );
+        } else {
+            glDrawElementsInstancedBaseInstance( lodModel->GetRenderMethod(),
+                                                 lodModel->GetMesh()->num_indices, GL_UNSIGNED_INT,
+                                                 nullptr, lod_visible[lod], lod_first[lod] );
+        }
+    }
+
+    instance_buffer->Fence();
 
     glUseProgram( 0 );
     glBindVertexArray( 0 );
 
-    Graphics::Instance().DrawNormal( container.model, container.matrix );
+    DrawStatic();
+}
+
+void VerletManager::DrawStatic() {
+    Graphics::Instance().DrawNormal( container.model.get(), container.matrix );
+
+    for ( Obstacle& obstacle : obstacles ) {
+        Graphics::Instance().DrawNormal( obstacle.model.get(), obstacle.matrix );
+    }
 }
 
 unsigned VerletManager::GetCurrCount() const {
-    return curr_count;
+    return drawn_count;
+}
+
+bool VerletManager::IsSimulating() const {
+    return menu_settings.should_simulate;
 }
 
 void VerletManager::DisplayMenu() {
     ImGui::Begin( "VerletIntegration##1" );
 
-    ImGui::Text( fmt::format( "Particle count: {}", curr_count ).c_str() );
+    // Solver parameters are edited here and sent to the simulation thread as a whole
+    bool settingsChanged = false;
+
+    ImGui::Text( fmt::format( "Particle count: {}", drawn_count ).c_str() );
+    ImGui::Text( fmt::format( "Slots: {} | holes: {} | compactions: {}", drawn_slots,
+                              drawn_slots - drawn_count, drawn_compactions )
+                     .c_str() );
+
+    // Everything sized by the particle count, split over the particles that use it
+    const size_t memory = drawn_memory + instance_buffer->GetMemory() + instance_lod.capacity();
+    ImGui::Text( fmt::format( "Capacity: {} | Memory: {:.1f} MB | {} bytes per particle",
+                              drawn_capacity, memory / ( 1024.f * 1024.f ),
+                              memory / std::max( drawn_count, 1u ) )
+                     .c_str() );
+    int maxCount = static_cast< int >( menu_settings.max_count );
+    if ( ImGui::InputInt( "Max particles", &maxCount, 10000, 100000 ) ) {
+        menu_settings.max_count = static_cast< unsigned >( std::clamp( maxCount, 0, 10000000 ) );
+        settingsChanged = true;
+    }
+    ImGui::Text( fmt::format( "Instance buffer: {:.1f} KB ({})", instance_buffer->GetMemory() / 1024.f,
+                              instance_buffer->IsPersistent() ? "persistent" : "staged" )
+                     .c_str() );
+    if ( ImGui::Checkbox( "Packed instances##1", &packed_instances ) ) {
+        SetupInstances();
+    }
+
+    static const char* renderModeList[2] = { "Mesh", "Impostor" };
+    int currRenderMode = render_mode;
+    if ( ImGui::Combo( "Particle rendering", &currRenderMode, renderModeList, 2 ) ) {
+        render_mode = static_cast< ParticleRenderMode >( currRenderMode );
+    }
+
+    ImGui::SeparatorText( "Culling" );
+    ImGui::Text( fmt::format( "Visible: {} | Culled: {}", lod_visible[0] + lod_visible[1],
+                              culled_count )
+                     .c_str() );
+    ImGui::Text( fmt::format( "LOD 0: {} | LOD 1: {}", lod_visible[0], lod_visible[1] ).c_str() );
+    ImGui::Checkbox( "Frustum culling##1", &frustum_culling );
+    ImGui::SliderFloat( "LOD distance", &lod_distance, 5.f, 50.f );
     ImGui::SliderFloat( "FPS Limit", &fps_limit, 30.f, 90.f );
-    ImGui::SliderFloat( "Verlet radius", &verlet_radius, 0.15f, 0.5f );
+    settingsChanged |= ImGui::SliderFloat( "Verlet radius", &menu_settings.verlet_radius, 0.15f, 0.5f );
+
+    ImGui::SeparatorText( "Step cost" );
+    ImGui::Text( fmt::format( "Total {:.2f} ms | broadphase {:.2f} | collision {:.2f} | "
+                              "colliders {:.2f} | container {:.2f} | forces {:.2f} | integrate {:.2f}",
+                              drawn_timings.total, drawn_timings.broadphase,
+                              drawn_timings.collision, drawn_timings.colliders,
+                              drawn_timings.container, drawn_timings.forces, drawn_timings.integrate )
+                     .c_str() );
+    settingsChanged |= ImGui::Checkbox( "Incremental grid##1", &menu_settings.incremental_grid );
+    ImGui::Text( fmt::format( "Grid churn: {:.2f}% ({})", drawn_churn * 100.f,
+                              drawn_rebuilt ? "rebuilt" : "incremental" )
+                     .c_str() );
+    if ( !drawn_thread_busy.empty() ) {
+        // A balanced split keeps the slowest thread close to the mean
+        const float maxBusy = *std::max_element( drawn_thread_busy.begin(), drawn_thread_busy.end() );
+        const float meanBusy = std::accumulate( drawn_thread_busy.begin(), drawn_thread_busy.end(), 0.f ) /
+                               drawn_thread_busy.size();
+        ImGui::Text( fmt::format( "Collision threads: mean {:.2f} ms | max {:.2f} ms | imbalance {:.2f}",
+                                  meanBusy, maxBusy, meanBusy > 0.f ? maxBusy / meanBusy : 1.f )
+                         .c_str() );
+        ImGui::PlotHistogram( "Busy per thread", drawn_thread_busy.data(),
+                              static_cast< int >( drawn_thread_busy.size() ), 0, nullptr, 0.f, maxBusy,
+                              ImVec2( 0.f, 60.f ) );
+    }
+    settingsChanged |= ImGui::Checkbox( "Auto particle count##1", &menu_settings.auto_count );
+    settingsChanged |= ImGui::SliderFloat( "Target step ms", &menu_settings.target_step_ms, 1.f,
+                                           30.f );
+    if ( menu_settings.auto_count ) {
+        ImGui::Text( fmt::format( "Sustainable count: {} ({} threads)", drawn_count, THREAD_COUNT )
+                         .c_str() );
+    }
+
+    ImGui::SeparatorText( "Sleeping" );
+    settingsChanged |= ImGui::Checkbox( "Sleeping particles##1", &menu_settings.sleeping );
+    settingsChanged |= ImGui::SliderFloat( "Sleep speed", &menu_settings.sleep_speed, 0.f, 0.5f, "%.3f" );
+    settingsChanged |= ImGui::SliderInt( "Sleep steps", &menu_settings.sleep_steps, 1, 255 );
+    ImGui::Text( fmt::format( "Asleep: {} particles ({:.1f}%) | {} cells", drawn_sleeping,
+                              100.f * drawn_sleeping / std::max( drawn_count, 1u ), drawn_sleeping_cells )
+                     .c_str() );
+
+    ImGui::SeparatorText( "Substeps" );
+    settingsChanged |= ImGui::Checkbox( "Auto substeps##1", &menu_settings.auto_substeps );
+    if ( menu_settings.auto_substeps ) {
+        settingsChanged |= ImGui::SliderInt( "Max substeps", &menu_settings.max_substeps, 1, MAX_SUBSTEPS );
+        settingsChanged |= ImGui::SliderFloat( "Max penetration", &menu_settings.max_penetration, 0.01f, 1.f,
+                                               "%.2f radii" );
+    } else {
+        settingsChanged |= ImGui::SliderInt( "Substeps", &menu_settings.substeps, 1, MAX_SUBSTEPS );
+    }
+    settingsChanged |= ImGui::SliderFloat( "Grid margin", &menu_settings.grid_margin, 0.f, 1.f, "%.2f radii" );
+    ImGui::Text( fmt::format( "Substeps: {} | penetration {:.3f} radii", drawn_substeps, drawn_penetration )
+                     .c_str() );
+
+    ImGui::SeparatorText( "Time step" );
+    settingsChanged |= ImGui::Checkbox( "Adaptive step##1", &menu_settings.adaptive_step );
+    if ( menu_settings.adaptive_step ) {
+        settingsChanged |= ImGui::SliderFloat( "Max travel", &menu_settings.max_travel, 0.05f, 2.f, "%.2f radii" );
+        settingsChanged |= ImGui::SliderFloat( "Min step", &menu_settings.min_step, 0.001f, 0.01f, "%.4f s" );
+        settingsChanged |= ImGui::SliderFloat( "Max step", &menu_settings.max_step, 0.01f, 0.05f, "%.4f s" );
+    }
+    ImGui::Text( fmt::format( "Step: {:.2f} ms ({:.0f}% of base)", drawn_time_step * 1000.f,
+                              100.f * drawn_time_step / Engine::BASE_TIME_STEP )
+                     .c_str() );
+
+    ImGui::SeparatorText( "Threads" );
+    ImGui::Text( fmt::format( "NUMA nodes: {} | cpus: {} | solver threads: {}",
+                              CpuTopology::Instance().GetNodes().size(),
+                              CpuTopology::Instance().GetCpuCount(), THREAD_COUNT )
+                     .c_str() );
+    bool affinityChanged = ImGui::Checkbox( "Pin solver threads##1", &pin_threads );
+    if ( pin_threads ) {
+        affinityChanged |= ImGui::Checkbox( "Grid block per node##1", &numa_regions );
+    }
+    if ( affinityChanged ) {
+        PushCommand( [this, pin = pin_threads, regions = numa_regions]() {
+            ApplyAffinity( pin, regions );
+            PlaceParticles();
+        } );
+    }
+    if ( ImGui::Button( "Affinity benchmark##1" ) ) {
+        PushCommand( [this, pin = pin_threads, regions = numa_regions]() {
+            RunAffinityBenchmark();
+            ApplyAffinity( pin, regions );
+            PlaceParticles();
+        } );
+    }
 
     ImGui::SeparatorText( "Amount to add" );
     ImGui::SliderInt( "##1", &amount_to_add, 1, 1000 );
@@ -408,42 +1752,181 @@ void VerletManager::DisplayMenu() {
 
     ImGui::Separator();
 
-    ImGui::Checkbox( "Should simulate##1", &should_simulate );
+    settingsChanged |= ImGui::Checkbox( "Should simulate##1", &menu_settings.should_simulate );
 
     ImGui::SeparatorText( "Forces" );
-    ImGui::SliderFloat3( "Force position", force_position.a, -10.f, 10.f );
-    ImGui::Checkbox( "Toggle force##1", &force_toggle );
+    settingsChanged |= ImGui::Checkbox( "Toggle force##1", &menu_settings.force_toggle );
+
+    static const char* fieldTypes[FIELD_TYPE_COUNT] = {
+        ForceFieldSet::TypeName( FieldAttractor ), ForceFieldSet::TypeName( FieldRepulsor ),
+        ForceFieldSet::TypeName( FieldVortex ), ForceFieldSet::TypeName( FieldDrag ),
+        ForceFieldSet::TypeName( FieldWind ) };
+
+    std::vector< ForceField >& fields = menu_settings.force_fields;
+    for ( size_t i = 0; i < fields.size(); ++i ) {
+        ForceField& field = fields[i];
+        bool removed = false;
+
+        // ### keeps the node open while the type in its label changes
+        ImGui::PushID( static_cast< int >( i ) );
+        if ( ImGui::TreeNode( fmt::format( "Field {}: {}###field", i, ForceFieldSet::TypeName( field.type ) )
+                                  .c_str() ) ) {
+            int type = field.type;
+            if ( ImGui::Combo( "Type", &type, fieldTypes, FIELD_TYPE_COUNT ) ) {
+                field.type = static_cast< ForceFieldType >( type );
+                settingsChanged = true;
+            }
+            settingsChanged |= ImGui::Checkbox( "Enabled", &field.enabled );
+            settingsChanged |= ImGui::SliderFloat3( "Position", &field.position[0], -10.f, 10.f );
+            if ( field.type == FieldVortex || field.type == FieldWind ) {
+                settingsChanged |= ImGui::SliderFloat3( "Direction", &field.direction[0], -1.f, 1.f );
+            }
+            settingsChanged |= ImGui::SliderFloat( "Strength", &field.strength, 0.f, 100.f );
+            settingsChanged |= ImGui::SliderFloat( "Radius", &field.radius, 0.f, 20.f, "%.1f (0 = everywhere)" );
+            if ( ImGui::Button( "Remove" ) ) {
+                fields.erase( fields.begin() + i );
+                removed = true;
+                settingsChanged = true;
+            }
+            ImGui::TreePop();
+        }
+        ImGui::PopID();
+
+        if ( removed ) {
+            break;
+        }
+    }
+
+    if ( fields.size() < MAX_FORCE_FIELDS && ImGui::Button( "Add field" ) ) {
+        fields.emplace_back();
+        settingsChanged = true;
+    }
+
+    ImGui::SeparatorText( "Long range forces" );
+    settingsChanged |= ImGui::Checkbox( "Barnes-Hut##1", &menu_settings.long_range );
+    settingsChanged |= ImGui::SliderFloat( "Strength##2", &menu_settings.long_range_strength, -100.f, 100.f );
+    settingsChanged |= ImGui::SliderFloat( "Opening angle", &menu_settings.opening_angle, 0.1f, 1.5f );
+    if ( ImGui::Button( "Barnes-Hut benchmark##1" ) ) {
+        PushCommand( [this]() {
+            RunBarnesHutBenchmark();
+        } );
+    }
+
+    ImGui::SeparatorText( "Emitters and sinks" );
+
+    std::vector< Emitter >& emitters = menu_settings.emitters;
+    for ( size_t i = 0; i < emitters.size(); ++i ) {
+        Emitter& emitter = emitters[i];
+        bool removed = false;
+
+        ImGui::PushID( static_cast< int >( i ) );
+        if ( ImGui::TreeNode( fmt::format( "Emitter {}###emitter", i ).c_str() ) ) {
+            settingsChanged |= ImGui::Checkbox( "Enabled", &emitter.enabled );
+            settingsChanged |= ImGui::SliderFloat3( "Position", &emitter.position[0], -10.f, 10.f );
+            settingsChanged |= ImGui::SliderFloat3( "Velocity", &emitter.velocity[0], -20.f, 20.f );
+            settingsChanged |= ImGui::SliderFloat( "Rate", &emitter.rate, 0.f, 5000.f, "%.0f per second" );
+            settingsChanged |= ImGui::SliderFloat( "Spread", &emitter.spread, 0.f, 3.f );
+            if ( ImGui::Button( "Remove" ) ) {
+                emitters.erase( emitters.begin() + i );
+                removed = true;
+                settingsChanged = true;
+            }
+            ImGui::TreePop();
+        }
+        ImGui::PopID();
+
+        if ( removed ) {
+            break;
+        }
+    }
+
+    std::vector< Sink >& sinks = menu_settings.sinks;
+    for ( size_t i = 0; i < sinks.size(); ++i ) {
+        Sink& sink = sinks[i];
+        bool removed = false;
+
+        ImGui::PushID( static_cast< int >( i ) );
+        if ( ImGui::TreeNode( fmt::format( "Sink {}###sink", i ).c_str() ) ) {
+            settingsChanged |= ImGui::Checkbox( "Enabled", &sink.enabled );
+            settingsChanged |= ImGui::SliderFloat3( "Position", &sink.position[0], -10.f, 10.f );
+            settingsChanged |= ImGui::SliderFloat( "Radius", &sink.radius, 0.1f, 5.f );
+            if ( ImGui::Button( "Remove" ) ) {
+                sinks.erase( sinks.begin() + i );
+                removed = true;
+                settingsChanged = true;
+            }
+            ImGui::TreePop();
+        }
+        ImGui::PopID();
+
+        if ( removed ) {
+            break;
+        }
+    }
+
+    if ( emitters.size() < MAX_EMITTERS && ImGui::Button( "Add emitter" ) ) {
+        emitters.emplace_back();
+        settingsChanged = true;
+    }
+    ImGui::SameLine();
+    if ( sinks.size() < MAX_SINKS && ImGui::Button( "Add sink" ) ) {
+        sinks.emplace_back();
+        settingsChanged = true;
+    }
 
     ImGui::Separator();
 
-    ImGui::SliderFloat3( "Gravity position", grav_vec.a, -5.f, 5.f );
-    ImGui::SliderFloat( "Velocity damping", &vel_damping, 0.f, 1000.f );
+    settingsChanged |= ImGui::SliderFloat3( "Gravity position", menu_settings.grav_vec.a, -5.f, 5.f );
+    settingsChanged |= ImGui::SliderFloat( "Velocity damping", &menu_settings.vel_damping, 0.f,
+                                           1000.f );
 
     ImGui::SeparatorText( "Container shape" );
 
+    // Entries past the analytic shapes are MeshField containers baked from fieldFiles
     static int currShape = container.shape;
-    static const char* shapeList[2] = { "Sphere", "Cube" };
-    if ( ImGui::Combo( "##3", &currShape, shapeList, 2 ) ) {
-        SetupContainer( static_cast< ContainerShape >( currShape ) );
+    static const char* shapeList[4] = { "Sphere", "Cube", "Cylinder (field)", "Monkey (field)" };
+    static const char* fieldFiles[2] = { "models/cylinder.obj", "models/monkey.obj" };
+    if ( ImGui::Combo( "##3", &currShape, shapeList, 4 ) ) {
+        if ( currShape < MeshField ) {
+            SetupContainer( static_cast< ContainerShape >( currShape ) );
+        } else {
+            SetupContainer( MeshField, fieldFiles[currShape - MeshField] );
+        }
+    }
+
+    if ( container.field ) {
+        ImGui::Text( fmt::format( "Field: {} | {:.1f} MB", container.field_file,
+                                  container.field->GetMemory() / ( 1024.f * 1024.f ) )
+                         .c_str() );
     }
 
     if ( ImGui::SliderFloat( "Container size", &container.collision_radius, 2.f, 10.f ) ) {
-        switch ( container.shape ) {
-        case Sphere:
-            container.model_radius = container.collision_radius * 1.02f;
-            break;
-        case Cube:
-            container.model_radius = container.collision_radius * 2.f + 0.15f * 3.f;
-            break;
-        }
+        UpdateContainerMatrix();
 
-        container.matrix = glm::scale( glm::mat4( 1.f ), { container.model_radius,
-                                                           container.model_radius,
-                                                           container.model_radius } );
+        menu_settings.container_radius = container.collision_radius;
+        settingsChanged = true;
+    }
+
+    ImGui::SeparatorText( "Static colliders" );
+
+    static const char* obstacleList[4] = { "None", "Ramps", "Pillars", "Monkey" };
+    if ( ImGui::Combo( "##4", &obstacle_preset, obstacleList, 4 ) ) {
+        SetupObstacles( obstacle_preset );
+    }
+    if ( ImGui::Button( "Collider benchmark##1" ) ) {
+        PushCommand( [this]() {
+            RunColliderBenchmark();
+        } );
     }
 
     if ( ImGui::Button( "Reset" ) ) {
-        SetupVerlets();
+        PushCommand( [this]() {
+            SetupVerlets();
+        } );
+    }
+
+    if ( settingsChanged ) {
+        PushSettings();
     }
 
     ImGui::End();
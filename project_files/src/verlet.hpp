@@ -5,8 +5,13 @@
 
 // std includes
 #include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
 #include <memory>
 #include <queue>
+#include <random>
+#include <string>
 #include <thread>
 #include <vector>
 
@@ -14,23 +19,47 @@
 #include <glm/glm.hpp>
 
 // Local includes
+#include "chunked_array.hpp"
+#include "force_fields.hpp"
+#include "frustum.hpp"
 #include "math.hpp"
+#include "spsc_queue.hpp"
+#include "triple_buffer.hpp"
 
 class KDTree;
 class Octree;
 class Model;
+class InstanceBuffer;
+class ThreadPool;
+class SignedDistanceField;
+class StaticColliders;
+class BarnesHutTree;
 
 enum ContainerShape {
     Sphere,
     Cube,
+    MeshField, //!< signed distance field baked from Container::field_file
+};
+
+enum ParticleRenderMode {
+    RenderMesh,     //!< instanced sphere mesh
+    RenderImpostor, //!< instanced ray traced quads
 };
 
 struct Container {
-    Model* model;
+    std::unique_ptr< Model > model;
     glm::mat4 matrix;
     float model_radius;
     float collision_radius = 6.f;
     ContainerShape shape;
+    std::string field_file;                          //!< OBJ of a MeshField container
+    std::shared_ptr< const SignedDistanceField > field; //!< normalized mesh, scaled by collision_radius
+};
+
+//! Drawn model of a static collider, the triangles live in StaticColliders
+struct Obstacle {
+    std::unique_ptr< Model > model;
+    glm::mat4 matrix;
 };
 
 struct Verlet {
@@ -39,14 +68,110 @@ struct Verlet {
     vec4 acceleration{ 0.f };
 };
 
+//! Particle storage, grows in chunks so Verlet pointers held by the broadphase stay valid
+using VerletArray = ChunkedArray< Verlet >;
+
+//! Spawns particles inside a sphere at a fixed rate
+struct Emitter {
+    glm::vec3 position{ 0.f, 4.f, 0.f };
+    glm::vec3 velocity{ 0.f, 0.f, 0.f }; //!< initial velocity in units per second
+    float rate = 200.f;                  //!< particles per second
+    float spread = 0.5f;                 //!< radius of the spawn sphere
+    bool enabled = true;
+};
+
+//! Kill volume, particles entering the sphere are removed
+struct Sink {
+    glm::vec3 position{ 0.f, -4.f, 0.f };
+    float radius = 1.f;
+    bool enabled = true;
+};
+
+//! Solver parameters, the simulation thread only sees them through commands
+struct SolverSettings {
+    std::vector< ForceField > force_fields = { { FieldAttractor, { 0.f, 4.f, 0.f }, { 0.f, 1.f, 0.f }, 30.f, 0.f, true } };
+    vec4 grav_vec{ 0.f, -4.5f, 0.f, 0.f };
+    float vel_damping = 20.f;
+    float verlet_radius = 0.15f;
+    float container_radius = 6.f;
+    ContainerShape container_shape = Sphere;
+    bool should_simulate = true;
+    bool force_toggle = false; //!< force_fields act every step, otherwise only on ApplyForce()
+    bool auto_count = false;     //!< particle count follows target_step_ms
+    float target_step_ms = 8.f;
+    unsigned max_count = 80000;  //!< storage grows on demand up to this many particles
+    bool long_range = false;          //!< mutual attraction of all particles through BarnesHutTree
+    float long_range_strength = 20.f; //!< acceleration scale, negative repels like charges
+    float opening_angle = 0.7f;       //!< Barnes-Hut theta, smaller is more accurate and slower
+    bool incremental_grid = true;     //!< only particles that changed cell are moved, see Octree::UpdateTree
+    bool sleeping = true;             //!< resting particles are frozen until something disturbs them
+    float sleep_speed = 0.1f;         //!< particles slower than this for sleep_steps steps fall asleep
+    int sleep_steps = 30;             //!< at most 255
+    int substeps = 1;                 //!< collision and integration passes per fixed step, all on one grid build
+    bool auto_substeps = false;       //!< picks 1 to max_substeps passes from the penetration depth instead
+    int max_substeps = 8;
+    float max_penetration = 0.2f;     //!< deepest overlap auto_substeps accepts, in radii
+    float grid_margin = 0.25f;        //!< cells grow by this many radii while substepping, see SolverStep
+    bool adaptive_step = false;       //!< fixed step length follows the fastest particle, see UpdateTimeStep
+    float max_travel = 0.5f;          //!< radii the fastest particle may cross per step with adaptive_step
+    float min_step = 0.0025f;         //!< seconds
+    float max_step = 0.02f;
+    std::vector< Emitter > emitters;
+    std::vector< Sink > sinks;
+};
+
+//! Smoothed cost of the phases of one fixed step in milliseconds
+struct StepTimings {
+    float broadphase = 0.f;
+    float collision = 0.f;
+    float colliders = 0.f;
+    float container = 0.f;
+    float forces = 0.f;
+    float integrate = 0.f;
+    float total = 0.f;
+};
+
+//! Particle positions of the last two fixed steps
+struct ParticleState {
+    float previous[3];
+    float current[3];
+    float speed;
+    uint8_t alive; //!< 0 for free slots, they are not drawn
+};
+
+//! Completed fixed step published by the simulation thread
+struct SimulationState {
+    ChunkedArray< ParticleState > particles;
+    unsigned count = 0;       //!< slots in use, live particles and holes
+    unsigned alive_count = 0;
+    unsigned sleeping_count = 0;
+    unsigned sleeping_cells = 0; //!< occupied cells the collision pass skipped against each other
+    unsigned compactions = 0; //!< Compact() calls since the start
+    float grid_churn = 0.f;   //!< fraction of the particles that changed cell this step
+    unsigned substeps = 1;
+    float time_step = 0.f;    //!< length of the step in seconds
+    float penetration = 0.f;  //!< deepest overlap of the step's first collision pass, in radii
+    bool grid_rebuilt = true; //!< the grid was refilled instead of updated
+    unsigned capacity = 0;   //!< particles the solver has storage for
+    size_t solver_memory = 0; //!< bytes of particle, state and grid storage on the simulation side
+    std::chrono::steady_clock::time_point step_time; //!< Engine::GetStepTime() of the step
+    StepTimings timings;
+    std::vector< float > thread_busy; //!< smoothed collision time of every solver thread in ms
+};
+
 struct VerletManager {
 public:
     void CreateVerlets( ContainerShape CShape );
+    void Shutdown();
 
+    //! Fixed step, runs on the simulation thread
     void Update();
     void CollisionUpdate();
-    void PositionUpdate() noexcept;
-    void PositionUpdateThread( int ThreadId ) noexcept;
+    //! One substep of integration, LastSubstep also puts particles to sleep and writes the state
+    void PositionUpdateThread( int ThreadId, bool LastSubstep ) noexcept;
+
+    //! Per frame bookkeeping on the main thread
+    void FrameUpdate();
 
     void DrawVerlets();
 
@@ -58,45 +183,273 @@ public:
     static VerletManager& Instance();
 
     unsigned GetCurrCount() const;
+    bool IsSimulating() const;
 
     void DisplayMenu();
 
-    static constexpr unsigned MAX = 80000;
-
 private:
     void SetupVerletPosition( Verlet* verlet, int i );
     void SetupVerlets();
-    void SetupContainer( ContainerShape CShape );
+    void SetupContainer( ContainerShape CShape, const std::string& FieldFile = "" );
+
+    //! Scales the container model to container.collision_radius
+    void UpdateContainerMatrix();
 
-    void CheckCollisionBetweenVerlets( Verlet* Verlet1, Verlet* Verlet2 );
+    //! @return overlap the pair was pushed apart by, 0 when not touching
+    float CheckCollisionBetweenVerlets( Verlet* Verlet1, Verlet* Verlet2 );
 
     void CheckCollisionsWithKDTree( int ThreadId );
 
-    void ContainerCollision();
+    //! Loads one of the obstacle presets of the menu, 0 removes all static colliders
+    void SetupObstacles( int Preset );
+
+    /**
+     * @brief Static collider contacts, batched per grid cell over the columns CheckCollisions used.
+     *
+     * @return Particle-triangle tests of the pass
+     */
+    size_t ColliderCollision();
+    void ColliderCollisionThread( int ThreadId );
+
+    //! Times ColliderCollision() against floors of growing triangle counts, results go to the trace
+    void RunColliderBenchmark();
 
-    std::array< std::unique_ptr< Verlet >, MAX > verlet_list{ nullptr };
-    std::array< float, MAX * 3 > positions{ 0.f };
-    std::array< float, MAX > velocities{ 0.f };
+    //! Times BarnesHutTree against brute force over the current particles, results go to the trace
+    void RunBarnesHutBenchmark();
 
-    glm::mat4 projection;
+    //! Container and obstacles
+    void DrawStatic();
 
-    Model* model;
+    void ContainerCollision();
+    void ContainerCollisionThread( int ThreadId ) noexcept;
+
+    //! Particles [Start, End) of curr_count integrated and collided by ThreadId
+    void ThreadRange( int ThreadId, unsigned& Start, unsigned& End ) const noexcept;
+
+    //! Queues Command to run on the simulation thread before its next step
+    void PushCommand( std::function< void() > Command );
+
+    //! @return true when at least one command ran
+    bool ProcessCommands();
+
+    //! Pushes menu_settings to the simulation thread
+    void PushSettings();
+
+    //! One step worth of force field acceleration on every particle
+    void AddFieldForces() noexcept;
+
+    //! Force fields on particles [Start, End), one ForceFieldSet::WIDTH group at a time
+    void ApplyFields( unsigned Start, unsigned End ) noexcept;
+
+    /**
+     * @brief PID loop on the smoothed step cost, grows or shrinks curr_count
+     *        towards the largest count that fits settings.target_step_ms.
+     */
+    void UpdateCountController();
+
+    //! Sets the live particle count, holes are filled first and removed particles go back to their spawn position
+    void SetCount( unsigned Count );
+
+    //! Live particles, curr_count minus the free slots
+    unsigned AliveCount() const noexcept;
+
+    /**
+     * @brief Places a particle in a free slot, or after the last slot when
+     *        there are no holes.
+     *
+     * @return false when settings.max_count particles are alive
+     */
+    bool Spawn( const glm::vec3& Position, const glm::vec3& Velocity );
+
+    //! Frees the slot of particle Index, it stays a hole until reused or compacted
+    void Kill( unsigned Index ) noexcept;
+
+    /**
+     * @brief Moves the last live particles into the holes so [0, curr_count)
+     *        is dense again. Costs a sort of the free slots and one copy per hole.
+     */
+    void Compact();
+
+    //! Emitters, sinks and compaction, runs before the solver step
+    void UpdateLifecycle();
+
+    //! Spawns the particles every emitter owes for one step
+    void UpdateEmitters();
+
+    //! Kills particles inside a sink, tested in parallel and freed serially
+    void ApplySinks();
+
+    //! Wakes every particle, for changes that reach sleeping particles without pushing them
+    void WakeAll() noexcept;
+
+    //! Grows the particle storage to hold Count particles, existing ones never move
+    void Reserve( unsigned Count );
+
+    /**
+     * @brief ChunkedArray::ParallelFor for particle storage. Each solver thread
+     *        constructs the part of [First, Last) PositionUpdateThread gives it
+     *        at Count particles, so the pages are first touched on its node.
+     */
+    void FirstTouch( size_t First, size_t Last, unsigned Count,
+                     const std::function< void( size_t, size_t ) >& Construct );
+
+    //! Broadphase, then substep_count passes of collisions, container and integration of curr_count particles
+    StepTimings SolverStep();
+
+    /**
+     * @brief Picks the substep count of the next step, from the settings or
+     *        from the last penetration with settings.auto_substeps.
+     */
+    void UpdateSubsteps();
+
+    //! Scales the velocity every particle keeps in old_position by Ratio, for step length changes
+    void RescaleVelocities( float Ratio ) noexcept;
+
+    /**
+     * @brief With settings.adaptive_step, sizes the next fixed step so the
+     *        fastest particle crosses settings.max_travel radii. Shrinks at
+     *        once, grows by TIME_STEP_GROWTH per step. Goes back to
+     *        Engine::BASE_TIME_STEP otherwise.
+     */
+    void UpdateTimeStep();
+
+    //! Pins the solver threads to CpuTopology::ThreadCpus(), NumaRegions also gives each node its own grid block
+    void ApplyAffinity( bool Pin, bool NumaRegions );
+
+    /**
+     * @brief Moves the particles into new chunks first touched by the solver
+     *        threads as they are pinned now, and empties the grid that pointed
+     *        into the old ones.
+     */
+    void PlaceParticles();
+
+    //! Times SolverStep() unpinned, pinned and pinned with node regions, each with its own particle placement
+    void RunAffinityBenchmark();
+
+    //! Particle and solver state benchmarks start from and put back when done
+    struct SolverSnapshot {
+        std::vector< Verlet > verlets;
+        std::vector< uint8_t > alive;
+        std::vector< uint8_t > sleeping;
+        std::vector< uint8_t > rest_steps;
+        unsigned substep_count = 1;
+        float step_dt = 0.f;
+        float penetration = 0.f;
+        unsigned calm_steps = 0;
+    };
+
+    SolverSnapshot TakeSnapshot() const;
+
+    //! Puts the particles back and empties the grid, the next step fills it again
+    void RestoreSnapshot( const SolverSnapshot& Snapshot );
+
+    //! Writes [Start, End) of the particles into the state being built
+    void WriteState( unsigned Start, unsigned End, bool Moving ) noexcept;
+
+    void SetupInstances();
+
+    //! Splits [0, Count) over ThreadCount render_pool tasks
+    void DispatchRanges( unsigned Count, unsigned ThreadCount,
+                         const std::function< void( int, unsigned, unsigned ) >& Function );
+
+    /**
+     * @brief Frustum culls the particles in [Start, End) and picks their LOD.
+     *        Counts per LOD are stored in thread_lod_counts[ThreadId].
+     */
+    void ClassifyInstances( int ThreadId, unsigned Start, unsigned End ) noexcept;
+
+    /**
+     * @brief Packs the visible particles in [Start, End), starting at the
+     *        per-LOD write offsets in thread_lod_counts[ThreadId].
+     */
+    void PackInstances( int ThreadId, unsigned Start, unsigned End, void* Instances,
+                        float Extent ) noexcept;
+
+    VerletArray verlet_list;
+
+    TripleBuffer< SimulationState > states;
+    const SimulationState* render_state = nullptr; //!< state the current frame is drawn from
+    float render_alpha = 0.f;                      //!< interpolation from previous to current
+
+    SpscQueue< std::function< void() >, 256 > commands;
+
+    SolverSettings settings;      //!< simulation thread copy
+    ForceFieldSet force_set;      //!< simulation thread, compiled from settings.force_fields
+    static constexpr size_t MAX_FORCE_FIELDS = 64;
+    static constexpr size_t MAX_EMITTERS = 16;
+    static constexpr size_t MAX_SINKS = 16;
+    std::shared_ptr< const SignedDistanceField > container_field; //!< simulation thread copy of container.field
+    std::shared_ptr< const StaticColliders > colliders;          //!< simulation thread, null without obstacles
+    std::vector< std::vector< unsigned > > collider_candidates;  //!< BVH query scratch of every solver thread
+    std::vector< size_t > thread_collider_tests;                 //!< particle-triangle tests of every solver thread
+    StepTimings timings;          //!< simulation thread
+    StepTimings drawn_timings;    //!< timings of the state drawn last
+    std::vector< float > thread_busy;       //!< simulation thread
+    std::vector< float > drawn_thread_busy;
+
+    struct CountController {
+        float count = 0.f; //!< fractional particle count
+        float integral = 0.f;
+        float last_error = 0.f;
+    } controller;
+
+    static constexpr float CONTROLLER_KP = 0.5f; //!< count change per second per relative error
+    static constexpr float CONTROLLER_KI = 0.1f;
+    static constexpr float CONTROLLER_KD = 0.01f;
+    static constexpr unsigned CONTROLLER_MAX_CHANGE = 50; //!< particles per step
+    static constexpr unsigned CONTROLLER_MIN_COUNT = 100; //!< floor of the count, an empty solver no longer times steps
+
+    SolverSettings menu_settings; //!< main thread copy, edited by the menu and input
+
+    std::unique_ptr< InstanceBuffer > instance_buffer;
+    static constexpr unsigned INITIAL_INSTANCES = 16384; //!< grows with the drawn count
+    static constexpr unsigned PARALLEL_PACK_MIN = 4096; //!< fewer instances are packed on one thread
+    bool packed_instances = false; //!< lossy 8 byte PackedInstanceData instead of 16 byte InstanceData
+
+    static constexpr unsigned LOD_COUNT = 2;
+    static constexpr uint8_t LOD_CULLED = 0xFF;
+
+    std::array< std::unique_ptr< Model >, LOD_COUNT > lod_models; //!< most detailed first
     Container container;
+    std::vector< Obstacle > obstacles;
+    int obstacle_preset = 0;
+    static constexpr int COLLIDER_BENCHMARK_STEPS = 100;
 
-    vec4 force_position{ 0.f, 4.f, 0.f, 0.f };
-    vec4 grav_vec{ 0.f, -4.5f, 0.f, 0.f };
+    std::vector< uint8_t > instance_lod; //!< LOD of every particle, LOD_CULLED when not visible
+    std::vector< std::array< unsigned, LOD_COUNT > > thread_lod_counts;
+    std::array< unsigned, LOD_COUNT > lod_first{}; //!< first instance of every LOD range
+    std::array< unsigned, LOD_COUNT > lod_visible{};
+    unsigned culled_count = 0;
 
-    int THREAD_COUNT = 24;
-    std::vector< std::thread > threads;
+    Frustum frustum;
+    glm::vec3 camera_position{ 0.f };
+    float lod_distance = 20.f; //!< particles further from the camera use the next LOD
+    bool frustum_culling = true;
 
-    std::unique_ptr< KDTree > kdtree;
-    std::unique_ptr< Octree > octree;
+    ParticleRenderMode render_mode = RenderMesh;
+    unsigned impostor_shader = 0; //!< drawn with the instance attributes of the first LOD's VAO
 
-    float vel_damping = 20.f;
+    bool pin_threads = false;  //!< menu state of ApplyAffinity()
+    bool numa_regions = false;
+    static constexpr int AFFINITY_BENCHMARK_STEPS = 200;
 
-    float verlet_radius = 0.15f;
+    int THREAD_COUNT = 24;
+    std::unique_ptr< ThreadPool > solver_pool; //!< simulation thread only, shared with octree
+    std::unique_ptr< ThreadPool > render_pool; //!< culling and packing
 
-    float dt;
+    std::unique_ptr< KDTree > kdtree;
+    std::unique_ptr< Octree > octree;
+    std::unique_ptr< BarnesHutTree > barnes_hut;
+    static constexpr int BARNES_HUT_SAMPLES = 1000; //!< particles the benchmark compares with brute force
+
+    float dt;                    //!< simulation thread, length of the fixed step
+    float step_dt;               //!< simulation thread, dt / substep_count
+    unsigned substep_count = 1;  //!< simulation thread, passes of the next step
+    float penetration = 0.f;     //!< simulation thread, see SimulationState::penetration
+    unsigned calm_steps = 0;     //!< steps one substep less would have stayed below settings.max_penetration
+    static constexpr int MAX_SUBSTEPS = 16;
+    static constexpr unsigned SUBSTEP_CALM_STEPS = 60; //!< calm steps before auto_substeps drops a pass
+    static constexpr float TIME_STEP_GROWTH = 1.02f;   //!< doubles in about 35 steps
 
     float add_timer = 0.25f;
     float add_cooldown = 0.1f;
@@ -106,11 +459,34 @@ private:
     float fps_limit = 90.f;
 
     int amount_to_add = 100;
-    unsigned curr_count = 0;
-
-    bool should_simulate = true;
-
-    bool force_toggle = false;
+    unsigned curr_count = 0;  //!< simulation thread only, slots in use including holes
+    std::vector< uint8_t > alive;       //!< simulation thread, one flag per slot of verlet_list
+    std::vector< unsigned > free_slots; //!< holes below curr_count, reused last freed first
+    std::vector< std::vector< unsigned > > thread_killed; //!< sink hits of every solver thread
+    std::vector< uint8_t > sleeping;    //!< simulation thread, frozen particles of verlet_list
+    std::vector< uint8_t > rest_steps;  //!< steps every particle has been slower than settings.sleep_speed
+    std::vector< unsigned > thread_sleeping; //!< sleeping particles every solver thread integrated
+    std::vector< float > thread_travel;      //!< longest last substep travel every solver thread integrated
+    std::vector< float > emitter_budget; //!< fractional particles every emitter still owes
+    std::minstd_rand emitter_random;
+    unsigned compactions = 0;
+    unsigned steps_since_compact = 0;
+    static constexpr unsigned COMPACT_HOLE_FRACTION = 8; //!< compact once more than 1 / 8 of the slots are holes
+    static constexpr unsigned COMPACT_INTERVAL = 120;    //!< steps a few holes may stay before compacting anyway
+    static constexpr float SLEEP_WAKE_FACTOR = 4.f;    //!< a push this many sleep distances wakes a particle
+    unsigned drawn_count = 0; //!< live particles of the state drawn last
+    unsigned drawn_slots = 0; //!< live particles and holes of the state drawn last
+    unsigned drawn_compactions = 0;
+    unsigned drawn_sleeping = 0;
+    unsigned drawn_sleeping_cells = 0;
+    float drawn_churn = 0.f;
+    unsigned drawn_substeps = 1;
+    float drawn_time_step = 0.f;
+    float drawn_penetration = 0.f;
+    bool drawn_rebuilt = true;
+    unsigned drawn_capacity = 0;
+    size_t drawn_memory = 0;
+    bool published_paused = false; //!< the last published state is already a paused one
 };
 
 #endif